@@ -58,10 +58,13 @@ int wmain (int argc, wchar_t* argv[])
     {
         MP4AudioFormat mp4Format;
 
+        // The pipeline resamples rates the encoder does not take, e.g. 96000 to 48000 and 88200 to 44100 Hz.
+        const double encoderSampleRate = (std::fmod (reader->sampleRate, 11025.0) == 0.0) ? 44100.0 : 48000.0;
+
         std::unique_ptr<juce::AudioFormatWriter> writer (
                 mp4Format.createWriterFor (outputStream,
                     juce::AudioFormatWriterOptions{}
-                    .withSampleRate (reader->sampleRate) // 44100 or 48000
+                    .withSampleRate (encoderSampleRate) // 44100 or 48000
                     .withNumChannels (reader->numChannels) // 1, 2 or 6
                     .withBitsPerSample (16) // 16
                     .withQualityOptionIndex (4) // 0-7, 4 = 96kbps per channel
@@ -74,7 +77,23 @@ int wmain (int argc, wchar_t* argv[])
         }
         else
         {
-            writer->writeFromAudioReader (*reader, 0, -1);
+            // Decode, resample and round to 16 bits, and encode on separate threads.
+            MP4TranscodePipeline pipeline;
+            pipeline.setResamplerQuality (MP4Resampler::Quality::best);
+
+            pipeline.onThroughput = [sampleRate = reader->sampleRate] (const MP4TranscodePipeline::Statistics& statistics)
+            {
+                printf ("\r%3d%%  %.1fx real time  (decode %d%%, convert %d%%, encode %d%%)",
+                        (int) (100 * statistics.numSamplesDone / statistics.numSamplesTotal),
+                        statistics.samplesPerSecond / sampleRate,
+                        (int) (100 * statistics.decodeLoad), (int) (100 * statistics.convertLoad), (int) (100 * statistics.encodeLoad));
+            };
+
+            if (! pipeline.transcode (*reader, *writer))
+            {
+                printf ("\nError transcoding audio.\n");
+                return 1;
+            }
         }
     }
 
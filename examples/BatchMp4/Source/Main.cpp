@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//////////////////////////////////////////////////////////////////////////
+
+#include <JuceHeader.h>
+
+using namespace mole;
+
+int wmain (int argc, wchar_t* argv[])
+{
+    if (argc != 3 && argc != 4)
+    {
+        printf ("Usage: BatchMp4 input_directory|file_list.txt output_directory [quality 0-7]\n");
+        return 1;
+    }
+
+    juce::File input (juce::File::getCurrentWorkingDirectory()
+           .getChildFile (juce::String (argv[1])));
+
+    juce::File outputDirectory (juce::File::getCurrentWorkingDirectory()
+           .getChildFile (juce::String (argv[2])));
+
+    MP4BatchTranscoder transcoder;
+
+    if (argc == 4)
+        transcoder.setQualityOptionIndex (juce::jlimit (0, 7, juce::String (argv[3]).getIntValue()));
+
+    int numFiles = 0;
+
+    if (input.isDirectory())
+    {
+        numFiles = transcoder.addDirectory (input, outputDirectory, "*.wav;*.aif;*.aiff;*.flac;*.ogg;*.mp3;*.mp4;*.m4a;*.aac;*.wma");
+    }
+    else if (input.existsAsFile())
+    {
+        // One input file per line, the outputs mirror their paths relative to the list.
+        const juce::File listDirectory (input.getParentDirectory());
+        juce::StringArray lines;
+        input.readLines (lines);
+
+        for (auto& line : lines)
+        {
+            if (line.trim().isEmpty())
+                continue;
+
+            juce::File file (listDirectory.getChildFile (line.trim()));
+
+            // Files outside the directory of the list go to the top of the output directory.
+            const juce::String path = file.isAChildOf (listDirectory) ? file.getRelativePathFrom (listDirectory) : file.getFileName();
+
+            if (transcoder.addFile (file, outputDirectory.getChildFile (path).withFileExtension ("mp4")))
+                ++numFiles;
+            else
+                printf ("SKIPPED         %s: same output as an earlier file\n", file.getFullPathName().toRawUTF8());
+        }
+    }
+    else
+    {
+        printf ("Input not found.\n");
+        return 1;
+    }
+
+    printf ("Transcoding %d files on %d threads.\n", numFiles, juce::SystemStats::getNumCpus());
+
+    transcoder.onFileFinished = [] (const MP4BatchTranscoder::Result& result)
+    {
+        if (result.succeeded)
+            printf ("ok     %7.1fx  %s\n", result.audioSeconds / juce::jmax (0.001, result.elapsedSeconds),
+                    result.input.getFullPathName().toRawUTF8());
+        else
+            printf ("FAILED          %s: %s\n", result.input.getFullPathName().toRawUTF8(), result.error.toRawUTF8());
+    };
+
+    const bool succeeded = transcoder.run();
+    const auto statistics = transcoder.getStatistics();
+
+    printf ("\n%d files, %d failed, %.1f s of audio in %.1f s (%.1fx real time).\n",
+            statistics.numFiles, statistics.numFailed, statistics.audioSeconds, statistics.elapsedSeconds,
+            statistics.audioSeconds / juce::jmax (0.001, statistics.elapsedSeconds));
+
+    return succeeded ? 0 : 1;
+}
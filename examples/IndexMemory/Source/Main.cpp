@@ -0,0 +1,110 @@
+//////////////////////////////////////////////////////////////////////////
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//////////////////////////////////////////////////////////////////////////
+// Prints the memory of the compact sample table of a long MP4 or ADTS
+// file, against one offset and size per access unit, and the memory of
+// each reader that shares the index.
+//////////////////////////////////////////////////////////////////////////
+
+#include <JuceHeader.h>
+#include <windows.h>
+#include <psapi.h>
+
+using namespace mole;
+
+namespace
+{
+    /* Returns the private bytes of the process. */
+    juce::int64 getPrivateBytes()
+    {
+        PROCESS_MEMORY_COUNTERS_EX counters = {};
+        counters.cb = sizeof (counters);
+
+        if (! GetProcessMemoryInfo (GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*) &counters, sizeof (counters)))
+            return 0;
+
+        return (juce::int64) counters.PrivateUsage;
+    }
+
+    double toMegabytes (juce::int64 bytes)
+    {
+        return (double) bytes / (1024 * 1024);
+    }
+}
+
+//==============================================================================
+int wmain (int argc, wchar_t* argv[])
+{
+    if (argc != 2 && argc != 3)
+    {
+        printf ("Usage: IndexMemory input.mp4|input.aac [number of readers]\n");
+        return 1;
+    }
+
+    juce::File inputFile (juce::File::getCurrentWorkingDirectory()
+           .getChildFile (juce::String (argv[1])));
+
+    const int numReaders = (argc == 3) ? juce::jlimit (1, 1024, juce::String (argv[2]).getIntValue()) : 16;
+
+    if (inputFile.existsAsFile() == false)
+    {
+        printf ("Input file not found.\n");
+        return 1;
+    }
+
+    MP4AudioIndex::Ptr index;
+    const double parseStart = juce::Time::getMillisecondCounterHiRes();
+
+    if (std::unique_ptr<juce::FileInputStream> stream = inputFile.createInputStream())
+        index = MP4AudioIndex::createFrom (*stream);
+
+    const double parseSeconds = (juce::Time::getMillisecondCounterHiRes() - parseStart) / 1000;
+
+    if (index == nullptr)
+    {
+        printf ("The input has no AAC audio in MP4 or ADTS.\n");
+        return 1;
+    }
+
+    const int numFrames = index->getNumFrames();
+    const juce::int64 expandedBytes = (juce::int64) numFrames * (juce::int64) (sizeof (juce::int64) + sizeof (juce::uint32));
+
+    printf ("%s\n", inputFile.getFullPathName().toRawUTF8());
+    printf ("duration                 %.2f hours, %d access units\n", (double) index->getLengthInSamples() / index->getSampleRate() / 3600, numFrames);
+    printf ("parsed in                %.2f s\n", parseSeconds);
+    printf ("index                    %.2f MB (%.2f bytes per access unit)\n",
+            toMegabytes ((juce::int64) index->getMemoryUsage()), (double) index->getMemoryUsage() / juce::jmax (1, numFrames));
+    printf ("offset and size tables   %.2f MB (int64 offset and uint32 size per access unit)\n", toMegabytes (expandedBytes));
+
+    // Readers share the index, each adds its own decoder, input stream and buffers.
+    MP4AudioFormat mp4Format;
+    std::vector<std::unique_ptr<juce::AudioFormatReader>> readers;
+    juce::AudioBuffer<float> buffer ((int) index->getNumChannels(), index->getSamplesPerFrame());
+
+    const juce::int64 privateBytesBefore = getPrivateBytes();
+
+    for (int i = 0; i < numReaders; ++i)
+    {
+        std::unique_ptr<juce::AudioFormatReader> reader (
+                mp4Format.createReaderFor (inputFile.createInputStream().release(), index, MP4AudioReaderOptions(), true));
+
+        if (reader == nullptr)
+        {
+            printf ("Error creating reader %d.\n", i + 1);
+            return 1;
+        }
+
+        // One read, so the decoder has its buffers.
+        reader->read (&buffer, 0, buffer.getNumSamples(), reader->lengthInSamples * i / numReaders, true, true);
+        readers.push_back (std::move (reader));
+    }
+
+    const juce::int64 privateBytesAfter = getPrivateBytes();
+
+    printf ("%-25s%.2f MB private bytes, %.2f MB per reader\n", (juce::String (numReaders) + " readers").toRawUTF8(),
+            toMegabytes (privateBytesAfter - privateBytesBefore), toMegabytes (privateBytesAfter - privateBytesBefore) / numReaders);
+
+    return 0;
+}
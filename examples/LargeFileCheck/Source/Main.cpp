@@ -0,0 +1,377 @@
+//////////////////////////////////////////////////////////////////////////
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//////////////////////////////////////////////////////////////////////////
+// Checks the portable demuxer on a file over 4 GB.
+//
+// Writes a sparse MP4 file of about 4.5 GB: an ftyp box, an mdat box with
+// a 64-bit largesize and a moov box at the end, whose sample table has a
+// co64 chunk offset box. Only the boxes and a few marked access units are
+// written, the rest of mdat stays unallocated. The file is opened with
+// MP4AudioIndex::createFrom() and from an index sidecar, and every access
+// unit offset and size is compared with the generated ones.
+//////////////////////////////////////////////////////////////////////////
+
+#include <JuceHeader.h>
+#include <windows.h>
+#include <winioctl.h>
+
+using namespace mole;
+
+namespace
+{
+    constexpr int numFrames = 1 << 20;          // about 6.2 hours of 5.1 at 48 kHz
+    constexpr int framesPerChunk = 1024;
+    constexpr int samplesPerFrame = 1024;
+    constexpr int sampleRate = 48000;
+    constexpr juce::int64 mdatHeaderSize = 16;  // size 1, type, largesize
+    constexpr juce::int64 firstFrameOffset = 24 + mdatHeaderSize;
+
+    /* Sizes around those of 5.1 AAC at a high bit rate, so the access units pass 4 GB. */
+    int getFrameSize (int frame)
+    {
+        return 4096 + (int) (((juce::uint32) frame * 37u) % 512u);
+    }
+
+    /* Bytes of a marked access unit, different for each one. */
+    juce::uint8 getMarkerByte (int frame, int i)
+    {
+        return (juce::uint8) (frame * 7 + i * 13 + 1);
+    }
+
+    //==========================================================================
+    /* Writes a box: 32-bit size, type and content. */
+    void writeBox (juce::OutputStream& out, const char* type, const juce::MemoryBlock& content)
+    {
+        out.writeIntBigEndian ((int) (8 + content.getSize()));
+        out.write (type, 4);
+        out.write (content.getData(), content.getSize());
+    }
+
+    /* Builds the content of a box with a function that writes to it. */
+    template <typename Fn>
+    juce::MemoryBlock createContent (Fn&& writeContent)
+    {
+        juce::MemoryOutputStream out;
+        writeContent (out);
+        return out.getMemoryBlock();
+    }
+
+    juce::MemoryBlock createMoov (const std::vector<juce::int64>& chunkOffsets)
+    {
+        // MPEG-4 AAC LC, 48 kHz, 5.1 (audio object type 2, frequency index 3, channel configuration 6).
+        const juce::uint8 audioSpecificConfig[] = { 0x11, 0xb0 };
+
+        const auto esds = createContent ([&] (juce::OutputStream& out)
+        {
+            out.writeIntBigEndian (0);                              // version, flags
+            out.writeByte (0x03); out.writeByte (25);               // ES_DescrTag, length
+            out.writeShortBigEndian (1); out.writeByte (0);         // ES_ID, flags
+            out.writeByte (0x04); out.writeByte (17);               // DecoderConfigDescrTag, length
+            out.writeByte (0x40);                                   // MPEG-4 audio
+            out.writeByte (0x15);                                   // audio stream
+            out.writeByte (0); out.writeShortBigEndian (0);         // bufferSizeDB
+            out.writeIntBigEndian (1536000);                        // maxBitrate
+            out.writeIntBigEndian (1536000);                        // avgBitrate
+            out.writeByte (0x05); out.writeByte (2);                // DecSpecificInfoTag, length
+            out.write (audioSpecificConfig, sizeof (audioSpecificConfig));
+            out.writeByte (0x06); out.writeByte (1); out.writeByte (2); // SLConfigDescriptor
+        });
+
+        const auto stsd = createContent ([&] (juce::OutputStream& out)
+        {
+            const auto mp4a = createContent ([&] (juce::OutputStream& entry)
+            {
+                entry.writeIntBigEndian (0); entry.writeShortBigEndian (0);  // reserved
+                entry.writeShortBigEndian (1);                              // data_reference_index
+                entry.writeShortBigEndian (0);                              // version
+                entry.writeShortBigEndian (0); entry.writeIntBigEndian (0); // revision level, vendor
+                entry.writeShortBigEndian (6);                              // channel count
+                entry.writeShortBigEndian (16);                             // sample size
+                entry.writeShortBigEndian (0); entry.writeShortBigEndian (0); // compression id, packet size
+                entry.writeIntBigEndian ((int) ((juce::uint32) sampleRate << 16)); // sample rate, 16.16
+                writeBox (entry, "esds", esds);
+            });
+
+            out.writeIntBigEndian (0);                              // version, flags
+            out.writeIntBigEndian (1);                              // entry count
+            writeBox (out, "mp4a", mp4a);
+        });
+
+        const auto stts = createContent ([] (juce::OutputStream& out)
+        {
+            out.writeIntBigEndian (0);
+            out.writeIntBigEndian (1);
+            out.writeIntBigEndian (numFrames);
+            out.writeIntBigEndian (samplesPerFrame);
+        });
+
+        const auto stsc = createContent ([] (juce::OutputStream& out)
+        {
+            out.writeIntBigEndian (0);
+            out.writeIntBigEndian (1);
+            out.writeIntBigEndian (1);                              // first chunk
+            out.writeIntBigEndian (framesPerChunk);                 // samples per chunk
+            out.writeIntBigEndian (1);                              // sample description index
+        });
+
+        const auto stsz = createContent ([] (juce::OutputStream& out)
+        {
+            out.writeIntBigEndian (0);
+            out.writeIntBigEndian (0);                              // no fixed sample size
+            out.writeIntBigEndian (numFrames);
+
+            for (int frame = 0; frame < numFrames; ++frame)
+                out.writeIntBigEndian (getFrameSize (frame));
+        });
+
+        const auto co64 = createContent ([&] (juce::OutputStream& out)
+        {
+            out.writeIntBigEndian (0);
+            out.writeIntBigEndian ((int) chunkOffsets.size());
+
+            for (auto offset : chunkOffsets)
+                out.writeInt64BigEndian (offset);
+        });
+
+        const auto stbl = createContent ([&] (juce::OutputStream& out)
+        {
+            writeBox (out, "stsd", stsd);
+            writeBox (out, "stts", stts);
+            writeBox (out, "stsc", stsc);
+            writeBox (out, "stsz", stsz);
+            writeBox (out, "co64", co64);
+        });
+
+        const auto mdhd = createContent ([] (juce::OutputStream& out)
+        {
+            out.writeIntBigEndian (0);                              // version 0, flags
+            out.writeIntBigEndian (0); out.writeIntBigEndian (0);   // creation, modification time
+            out.writeIntBigEndian (sampleRate);                     // timescale
+            out.writeIntBigEndian (numFrames * samplesPerFrame);    // duration
+            out.writeShortBigEndian (0x55c4);                       // language "und"
+            out.writeShortBigEndian (0);
+        });
+
+        const auto hdlr = createContent ([] (juce::OutputStream& out)
+        {
+            out.writeIntBigEndian (0);                              // version, flags
+            out.writeIntBigEndian (0);                              // pre_defined
+            out.write ("soun", 4);
+            out.writeIntBigEndian (0); out.writeIntBigEndian (0); out.writeIntBigEndian (0);
+            out.writeByte (0);                                      // empty name
+        });
+
+        const auto minf = createContent ([&] (juce::OutputStream& out) { writeBox (out, "stbl", stbl); });
+
+        const auto mdia = createContent ([&] (juce::OutputStream& out)
+        {
+            writeBox (out, "mdhd", mdhd);
+            writeBox (out, "hdlr", hdlr);
+            writeBox (out, "minf", minf);
+        });
+
+        const auto trak = createContent ([&] (juce::OutputStream& out) { writeBox (out, "mdia", mdia); });
+
+        return createContent ([&] (juce::OutputStream& out) { writeBox (out, "moov", createContent ([&] (juce::OutputStream& moov) { writeBox (moov, "trak", trak); })); });
+    }
+
+    //==========================================================================
+    bool writeAt (HANDLE file, juce::int64 position, const void* data, size_t size)
+    {
+        LARGE_INTEGER distance;
+        distance.QuadPart = position;
+        DWORD numWritten = 0;
+
+        return SetFilePointerEx (file, distance, nullptr, FILE_BEGIN)
+            && WriteFile (file, data, (DWORD) size, &numWritten, nullptr)
+            && numWritten == (DWORD) size;
+    }
+
+    /* Returns the file offsets of the access units, which follow each other from the start of mdat. */
+    std::vector<juce::int64> getFrameOffsets()
+    {
+        std::vector<juce::int64> offsets ((size_t) numFrames);
+        juce::int64 offset = firstFrameOffset;
+
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            offsets[(size_t) frame] = offset;
+            offset += getFrameSize (frame);
+        }
+
+        return offsets;
+    }
+
+    /* Writes the sparse test file with data in the marked access units. */
+    bool createSparseFile (const juce::File& file, const std::vector<juce::int64>& offsets, const std::vector<int>& markedFrames)
+    {
+        std::vector<juce::int64> chunkOffsets;
+
+        for (int frame = 0; frame < numFrames; frame += framesPerChunk)
+            chunkOffsets.push_back (offsets[(size_t) frame]);
+
+        const juce::int64 mdatEnd = offsets.back() + getFrameSize (numFrames - 1);
+        const juce::int64 mdatSize = mdatEnd - firstFrameOffset + mdatHeaderSize;
+
+        HANDLE handle = CreateFileW (file.getFullPathName().toWideCharPointer(), GENERIC_WRITE, 0, nullptr,
+                                     CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        // Without a sparse file the file system fills the gaps with zeros, which takes a while.
+        DWORD numReturned = 0;
+
+        if (! DeviceIoControl (handle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &numReturned, nullptr))
+            printf ("The file system has no sparse files, writing %.1f GB.\n", (double) mdatEnd / (1 << 30));
+
+        juce::MemoryOutputStream header;
+        header.write ("\0\0\0\x18" "ftypM4A \0\0\0\0" "M4A mp42", 24);
+        header.writeIntBigEndian (1);                               // size 1: largesize follows
+        header.write ("mdat", 4);
+        header.writeInt64BigEndian (mdatSize);
+
+        const juce::MemoryBlock moov (createMoov (chunkOffsets));
+        bool ok = writeAt (handle, 0, header.getData(), header.getDataSize())
+               && writeAt (handle, mdatEnd, moov.getData(), moov.getSize());
+
+        for (int frame : markedFrames)
+        {
+            juce::HeapBlock<juce::uint8> data ((size_t) getFrameSize (frame));
+
+            for (int i = 0; i < getFrameSize (frame); ++i)
+                data[i] = getMarkerByte (frame, i);
+
+            ok = ok && writeAt (handle, offsets[(size_t) frame], data, (size_t) getFrameSize (frame));
+        }
+
+        CloseHandle (handle);
+
+        return ok;
+    }
+
+    //==========================================================================
+    /* Compares an index with the generated file, prints the first difference. */
+    bool check (const char* name, const MP4AudioIndex* index, const std::vector<juce::int64>& offsets,
+                const juce::File& file, const std::vector<int>& markedFrames)
+    {
+        if (index == nullptr)
+        {
+            printf ("%-8s could not be opened.\n", name);
+            return false;
+        }
+
+        if (index->getNumFrames() != numFrames || index->getNumChannels() != 6 || index->getSampleRate() != sampleRate
+            || index->getLengthInSamples() != (juce::int64) numFrames * samplesPerFrame)
+        {
+            printf ("%-8s has %d access units, %u channels, %.0f Hz and %lld samples.\n", name, index->getNumFrames(),
+                    index->getNumChannels(), index->getSampleRate(), (long long) index->getLengthInSamples());
+            return false;
+        }
+
+        int numAbove4GB = 0;
+
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            if (index->getFrameOffset (frame) != offsets[(size_t) frame] || index->getFrameSize (frame) != getFrameSize (frame))
+            {
+                printf ("%-8s access unit %d is at %lld with %d bytes, expected %lld with %d bytes.\n", name, frame,
+                        (long long) index->getFrameOffset (frame), index->getFrameSize (frame),
+                        (long long) offsets[(size_t) frame], getFrameSize (frame));
+                return false;
+            }
+
+            if (offsets[(size_t) frame] > 0xffffffffLL)
+                ++numAbove4GB;
+        }
+
+        // The marked access units are read back at the offsets of the index.
+        juce::FileInputStream stream (file);
+
+        for (int frame : markedFrames)
+        {
+            juce::HeapBlock<juce::uint8> data ((size_t) index->getFrameSize (frame));
+            bool matches = stream.setPosition (index->getFrameOffset (frame))
+                        && stream.read (data, index->getFrameSize (frame)) == index->getFrameSize (frame);
+
+            for (int i = 0; i < index->getFrameSize (frame) && matches; ++i)
+                matches = data[i] == getMarkerByte (frame, i);
+
+            if (! matches)
+            {
+                printf ("%-8s access unit %d does not hold its data.\n", name, frame);
+                return false;
+            }
+        }
+
+        printf ("%-8s ok: %d access units, %d above 4 GB, last at %lld.\n", name, numFrames, numAbove4GB,
+                (long long) index->getFrameOffset (numFrames - 1));
+
+        return true;
+    }
+}
+
+//==============================================================================
+int wmain (int argc, wchar_t* argv[])
+{
+    if (argc > 2)
+    {
+        printf ("Usage: LargeFileCheck [directory]\n");
+        return 1;
+    }
+
+    const juce::File directory = (argc == 2) ? juce::File::getCurrentWorkingDirectory().getChildFile (juce::String (argv[1]))
+                                             : juce::File::getSpecialLocation (juce::File::tempDirectory);
+
+    const juce::File file (directory.getNonexistentChildFile ("LargeFileCheck", ".mp4"));
+    const juce::File sidecar (file.withFileExtension ("mp4idx"));
+
+    const std::vector<juce::int64> offsets = getFrameOffsets();
+
+    // The first access unit, the ones on both sides of 4 GB and the last one.
+    const int firstAbove4GB = (int) (std::upper_bound (offsets.begin(), offsets.end(), 0xffffffffLL) - offsets.begin());
+    const std::vector<int> markedFrames { 0, firstAbove4GB - 1, firstAbove4GB, numFrames - 1 };
+
+    if (! createSparseFile (file, offsets, markedFrames))
+    {
+        printf ("Error writing %s.\n", file.getFullPathName().toRawUTF8());
+        file.deleteFile();
+        return 1;
+    }
+
+    printf ("Wrote %s, %.2f GB.\n", file.getFullPathName().toRawUTF8(), (double) file.getSize() / (1 << 30));
+
+    bool ok = false;
+
+    {
+        juce::FileInputStream stream (file);
+        MP4AudioIndex::Ptr index (stream.openedOk() ? MP4AudioIndex::createFrom (stream) : nullptr);
+
+        ok = check ("demuxer", index.get(), offsets, file, markedFrames);
+
+        if (ok && ! index->writeSidecar (sidecar, file))
+        {
+            printf ("Error writing the sidecar.\n");
+            ok = false;
+        }
+
+        // The sidecar stores the offsets in its own tables.
+        if (ok)
+            ok = check ("sidecar", MP4AudioIndex::createFromSidecar (sidecar, file).get(), offsets, file, markedFrames);
+    }
+
+    sidecar.deleteFile();
+    file.deleteFile();
+
+    if (! ok)
+    {
+        printf ("\nFailed.\n");
+        return 1;
+    }
+
+    printf ("\nThe operation completed successfully.\n");
+
+    return 0;
+}
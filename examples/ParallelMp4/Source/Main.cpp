@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//////////////////////////////////////////////////////////////////////////
+// Encodes a long file with MP4ParallelEncoder and prints the seam,
+// decoder buffer and bit rate checks, and the speed against a single
+// encoder.
+//////////////////////////////////////////////////////////////////////////
+
+#include <JuceHeader.h>
+
+using namespace mole;
+
+int wmain (int argc, wchar_t* argv[])
+{
+    if (argc != 3 && argc != 4)
+    {
+        printf ("Usage: ParallelMp4 input.any output.mp4 [quality 0-7]\n");
+        return 1;
+    }
+
+    juce::File inputFile (juce::File::getCurrentWorkingDirectory()
+           .getChildFile (juce::String (argv[1])));
+
+    juce::File outputFile (juce::File::getCurrentWorkingDirectory()
+           .getChildFile (juce::String (argv[2])));
+
+    const int quality = (argc == 4) ? juce::jlimit (0, 7, juce::String (argv[3]).getIntValue()) : 4;
+
+    if (inputFile.existsAsFile() == false)
+    {
+        printf ("Input file not found.\n");
+        return 1;
+    }
+
+    juce::AudioFormatManager manager;
+    manager.registerBasicFormats();
+    manager.registerFormat (new MP4AudioFormat(), false);
+
+    // Each segment of the encoder reads with its own reader.
+    const auto createReader = [&manager, inputFile]
+    {
+        return std::unique_ptr<juce::AudioFormatReader> (manager.createReaderFor (inputFile));
+    };
+
+    std::unique_ptr<juce::AudioFormatReader> reader (createReader());
+
+    if (reader == nullptr)
+    {
+        printf ("Error creating audio format reader.\n");
+        return 1;
+    }
+
+    if (reader->sampleRate != 44100 && reader->sampleRate != 48000)
+    {
+        printf ("The input must be 44100 or 48000 Hz.\n");
+        return 1;
+    }
+
+    const auto options = juce::AudioFormatWriterOptions{}
+                            .withSampleRate (reader->sampleRate)
+                            .withNumChannels ((int) reader->numChannels) // 1, 2 or 6
+                            .withBitsPerSample (16)
+                            .withQualityOptionIndex (quality);
+
+    const double seconds = (double) reader->lengthInSamples / reader->sampleRate;
+
+    printf ("Encoding %.1f minutes on %d workers.\n", seconds / 60, MP4DecodeScheduler::getInstance().getNumWorkers());
+
+    if (outputFile.existsAsFile())
+        outputFile.deleteFile();
+
+    MP4ParallelEncoder encoder;
+    bool ok = false;
+    const double parallelStart = juce::Time::getMillisecondCounterHiRes();
+
+    if (std::unique_ptr<juce::FileOutputStream> stream = outputFile.createOutputStream())
+        ok = encoder.write (createReader, *stream, options);
+
+    const double parallelSeconds = (juce::Time::getMillisecondCounterHiRes() - parallelStart) / 1000;
+    const MP4ParallelEncoder::Statistics& statistics = encoder.getStatistics();
+
+    printf ("\nseams                    %d\n", statistics.numSeams);
+    printf ("encoded again            %d\n", statistics.numReencodedSeams);
+    printf ("encoded sequentially     %d\n", statistics.numSequentialSeams);
+    printf ("mismatched windows       %d\n", statistics.numMismatchedSeams);
+    printf ("decoder buffer underflow %d\n", statistics.numReservoirUnderflows);
+    printf ("bit rate                 %.0f of %.0f bits per second (%+.2f%%)\n",
+            statistics.bitsPerSecond, statistics.targetBitsPerSecond, 100 * statistics.getBitRateError());
+    printf ("parallel                 %.1fx real time\n", seconds / juce::jmax (0.001, parallelSeconds));
+
+    // The same file through a single writer, for the speed-up.
+    juce::File sequentialFile (juce::File::createTempFile (".mp4"));
+    const double sequentialStart = juce::Time::getMillisecondCounterHiRes();
+
+    {
+        MP4AudioFormat mp4Format;
+        std::unique_ptr<juce::OutputStream> stream = sequentialFile.createOutputStream();
+        std::unique_ptr<juce::AudioFormatWriter> writer (mp4Format.createWriterFor (stream, options));
+
+        if (writer != nullptr)
+            writer->writeFromAudioReader (*reader, 0, -1);
+    }
+
+    const double sequentialSeconds = (juce::Time::getMillisecondCounterHiRes() - sequentialStart) / 1000;
+    sequentialFile.deleteFile();
+
+    printf ("sequential               %.1fx real time\n", seconds / juce::jmax (0.001, sequentialSeconds));
+
+    if (! ok)
+    {
+        printf ("\nFailed: the encoder or one of its checks failed, the output is not valid.\n");
+        outputFile.deleteFile();
+        return 1;
+    }
+
+    printf ("\nThe operation completed successfully.\n");
+
+    return 0;
+}
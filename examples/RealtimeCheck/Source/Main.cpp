@@ -0,0 +1,416 @@
+//////////////////////////////////////////////////////////////////////////
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//////////////////////////////////////////////////////////////////////////
+// Checks that the real-time read path and the writer's write() do not
+// allocate or lock once they are warmed up.
+//
+// Global operator new is replaced, and the executable's imports of the
+// heap and lock functions are patched. JUCE and MOLE are compiled into
+// the executable, so their calls go through these imports; calls inside
+// Media Foundation do not. Only the thread that runs the check counts.
+//////////////////////////////////////////////////////////////////////////
+
+#include <JuceHeader.h>
+#include <windows.h>
+
+using namespace mole;
+
+namespace
+{
+    std::atomic<int> numAllocations { 0 };
+    std::atomic<int> numLockEntries { 0 };
+
+    thread_local bool isCounting = false;
+    thread_local int allocationDepth = 0;
+
+    /* Counts an allocation once, an allocation that calls another one (new, malloc, HeapAlloc) is not counted again. */
+    struct AllocationCount
+    {
+        AllocationCount() noexcept   { if (allocationDepth++ == 0 && isCounting) ++numAllocations; }
+        ~AllocationCount() noexcept  { --allocationDepth; }
+    };
+
+    void countLockEntry() noexcept
+    {
+        if (isCounting)
+            ++numLockEntries;
+    }
+
+    /* Replaces an entry of the import address table of the executable, the original function is stored first. */
+    template <typename Function>
+    void hook (const char* name, Function hookFunction, Function& original)
+    {
+        auto* base = (BYTE*) GetModuleHandleW (nullptr);
+        auto* nt = (IMAGE_NT_HEADERS*) (base + ((IMAGE_DOS_HEADER*) base)->e_lfanew);
+        const IMAGE_DATA_DIRECTORY& imports = nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+
+        if (imports.VirtualAddress == 0)
+            return;
+
+        for (auto* library = (IMAGE_IMPORT_DESCRIPTOR*) (base + imports.VirtualAddress); library->Name != 0; ++library)
+        {
+            if (library->OriginalFirstThunk == 0)
+                continue;
+
+            auto* names = (IMAGE_THUNK_DATA*) (base + library->OriginalFirstThunk);
+            auto* functions = (IMAGE_THUNK_DATA*) (base + library->FirstThunk);
+
+            for (; names->u1.AddressOfData != 0; ++names, ++functions)
+            {
+                if (IMAGE_SNAP_BY_ORDINAL (names->u1.Ordinal))
+                    continue;
+
+                if (strcmp ((const char*) ((IMAGE_IMPORT_BY_NAME*) (base + names->u1.AddressOfData))->Name, name) != 0)
+                    continue;
+
+                DWORD protection = 0;
+                VirtualProtect (&functions->u1.Function, sizeof (void*), PAGE_READWRITE, &protection);
+
+                original = (Function) functions->u1.Function;
+                functions->u1.Function = (ULONG_PTR) hookFunction;
+
+                VirtualProtect (&functions->u1.Function, sizeof (void*), protection, &protection);
+
+                return;
+            }
+        }
+    }
+
+    //==========================================================================
+    // Heap functions, malloc() and friends are imported with the dynamic CRT,
+    // HeapAlloc() with the static CRT.
+    decltype (&HeapAlloc) originalHeapAlloc = nullptr;
+    decltype (&HeapReAlloc) originalHeapReAlloc = nullptr;
+    void* (__cdecl* originalMalloc) (size_t) = nullptr;
+    void* (__cdecl* originalCalloc) (size_t, size_t) = nullptr;
+    void* (__cdecl* originalRealloc) (void*, size_t) = nullptr;
+
+    LPVOID WINAPI countingHeapAlloc (HANDLE heap, DWORD flags, SIZE_T size)
+    {
+        const AllocationCount count;
+        return originalHeapAlloc (heap, flags, size);
+    }
+
+    LPVOID WINAPI countingHeapReAlloc (HANDLE heap, DWORD flags, LPVOID memory, SIZE_T size)
+    {
+        const AllocationCount count;
+        return originalHeapReAlloc (heap, flags, memory, size);
+    }
+
+    void* __cdecl countingMalloc (size_t size)
+    {
+        const AllocationCount count;
+        return originalMalloc (size);
+    }
+
+    void* __cdecl countingCalloc (size_t number, size_t size)
+    {
+        const AllocationCount count;
+        return originalCalloc (number, size);
+    }
+
+    void* __cdecl countingRealloc (void* memory, size_t size)
+    {
+        const AllocationCount count;
+        return originalRealloc (memory, size);
+    }
+
+    //==========================================================================
+    // Lock functions, juce::CriticalSection enters a CRITICAL_SECTION, events
+    // and threads are waited for with WaitForSingleObject().
+    decltype (&EnterCriticalSection) originalEnterCriticalSection = nullptr;
+    decltype (&TryEnterCriticalSection) originalTryEnterCriticalSection = nullptr;
+    decltype (&AcquireSRWLockExclusive) originalAcquireSRWLockExclusive = nullptr;
+    decltype (&AcquireSRWLockShared) originalAcquireSRWLockShared = nullptr;
+    decltype (&WaitForSingleObject) originalWaitForSingleObject = nullptr;
+
+    void WINAPI countingEnterCriticalSection (LPCRITICAL_SECTION section)
+    {
+        countLockEntry();
+        originalEnterCriticalSection (section);
+    }
+
+    BOOL WINAPI countingTryEnterCriticalSection (LPCRITICAL_SECTION section)
+    {
+        countLockEntry();
+        return originalTryEnterCriticalSection (section);
+    }
+
+    void WINAPI countingAcquireSRWLockExclusive (PSRWLOCK lock)
+    {
+        countLockEntry();
+        originalAcquireSRWLockExclusive (lock);
+    }
+
+    void WINAPI countingAcquireSRWLockShared (PSRWLOCK lock)
+    {
+        countLockEntry();
+        originalAcquireSRWLockShared (lock);
+    }
+
+    DWORD WINAPI countingWaitForSingleObject (HANDLE handle, DWORD milliseconds)
+    {
+        countLockEntry();
+        return originalWaitForSingleObject (handle, milliseconds);
+    }
+
+    void hookImports()
+    {
+        hook ("HeapAlloc", &countingHeapAlloc, originalHeapAlloc);
+        hook ("HeapReAlloc", &countingHeapReAlloc, originalHeapReAlloc);
+        hook ("malloc", &countingMalloc, originalMalloc);
+        hook ("calloc", &countingCalloc, originalCalloc);
+        hook ("realloc", &countingRealloc, originalRealloc);
+
+        hook ("EnterCriticalSection", &countingEnterCriticalSection, originalEnterCriticalSection);
+        hook ("TryEnterCriticalSection", &countingTryEnterCriticalSection, originalTryEnterCriticalSection);
+        hook ("AcquireSRWLockExclusive", &countingAcquireSRWLockExclusive, originalAcquireSRWLockExclusive);
+        hook ("AcquireSRWLockShared", &countingAcquireSRWLockShared, originalAcquireSRWLockShared);
+        hook ("WaitForSingleObject", &countingWaitForSingleObject, originalWaitForSingleObject);
+    }
+
+    //==========================================================================
+    /** Counts the allocations and lock entries of the calling thread while it exists. */
+    struct Measurement
+    {
+        Measurement() noexcept
+        {
+            numAllocations = 0;
+            numLockEntries = 0;
+            isCounting = true;
+        }
+
+        ~Measurement() noexcept
+        {
+            isCounting = false;
+        }
+    };
+
+    struct Result
+    {
+        int numCalls = 0;
+        int numAllocations = 0;
+        int numLockEntries = 0;
+
+        void add (const Measurement&) noexcept
+        {
+            ++numCalls;
+            numAllocations += ::numAllocations;
+            numLockEntries += ::numLockEntries;
+        }
+
+        bool isClean() const noexcept
+        {
+            return numAllocations == 0 && numLockEntries == 0;
+        }
+
+        void print (const char* name) const
+        {
+            printf ("%-36s %6d calls  %6d allocations  %6d lock entries\n", name, numCalls, numAllocations, numLockEntries);
+        }
+    };
+
+    constexpr int blockSize = 64;               // samples per call, a small audio callback
+    constexpr int numWarmUpBlocks = 64;         // calls before counting starts
+    constexpr int numMeasuredBlocks = 4096;     // calls counted, about 6 seconds at 44.1 kHz
+    constexpr int samplesPerAccessUnit = 1024;  // the writer collects one AAC frame per pooled block
+    constexpr int numWarmUpWrites = 64 * samplesPerAccessUnit / blockSize; // 64 pooled blocks, the pool grows to the ones the sink writer holds
+}
+
+//==============================================================================
+void* operator new (size_t size)
+{
+    const AllocationCount count;
+
+    if (void* memory = std::malloc (size != 0 ? size : 1))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[] (size_t size)
+{
+    return operator new (size);
+}
+
+void* operator new (size_t size, std::align_val_t alignment)
+{
+    const AllocationCount count;
+
+    if (void* memory = _aligned_malloc (size != 0 ? size : 1, (size_t) alignment))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[] (size_t size, std::align_val_t alignment)
+{
+    return operator new (size, alignment);
+}
+
+void operator delete (void* memory) noexcept                                { std::free (memory); }
+void operator delete[] (void* memory) noexcept                              { std::free (memory); }
+void operator delete (void* memory, size_t) noexcept                        { std::free (memory); }
+void operator delete[] (void* memory, size_t) noexcept                      { std::free (memory); }
+void operator delete (void* memory, std::align_val_t) noexcept              { _aligned_free (memory); }
+void operator delete[] (void* memory, std::align_val_t) noexcept            { _aligned_free (memory); }
+void operator delete (void* memory, size_t, std::align_val_t) noexcept      { _aligned_free (memory); }
+void operator delete[] (void* memory, size_t, std::align_val_t) noexcept    { _aligned_free (memory); }
+
+//==============================================================================
+int wmain (int argc, wchar_t* argv[])
+{
+    if (argc != 2)
+    {
+        printf ("Usage: RealtimeCheck input.mp4\n");
+        return 1;
+    }
+
+    juce::File inputFile (juce::File::getCurrentWorkingDirectory()
+           .getChildFile (juce::String (argv[1])));
+
+    if (inputFile.existsAsFile() == false)
+    {
+        printf ("Input file not found.\n");
+        return 1;
+    }
+
+    hookImports();
+
+    MP4AudioFormat mp4Format;
+    mp4Format.setReaderOptions (MP4AudioReaderOptions().withRealtimeMode (true));
+
+    std::unique_ptr<juce::AudioFormatReader> reader (mp4Format.createReaderFor (inputFile.createInputStream().release(), true));
+    auto* realtimeReader = dynamic_cast<MP4RealtimeReader*> (reader.get());
+
+    if (realtimeReader == nullptr)
+    {
+        printf ("Error creating real-time reader, the input must be AAC in MP4 or ADTS.\n");
+        return 1;
+    }
+
+    const int numChannels = (int) reader->numChannels;
+    const juce::int64 numSamplesNeeded = (juce::int64) (numWarmUpBlocks + numMeasuredBlocks) * blockSize;
+
+    if (reader->lengthInSamples < numSamplesNeeded)
+    {
+        printf ("The input must be at least %.1f seconds long.\n", (double) numSamplesNeeded / reader->sampleRate);
+        return 1;
+    }
+
+    juce::AudioBuffer<float> buffer (numChannels, blockSize);
+
+    //==========================================================================
+    // Real-time reader: the audio thread only copies from the lock-free ring.
+    // Waiting for the decode-ahead happens outside the measured calls.
+    Result readResult;
+    realtimeReader->prepareToRead (0);
+
+    for (int i = 0; i < numWarmUpBlocks + numMeasuredBlocks; ++i)
+    {
+        const juce::int64 position = (juce::int64) i * blockSize;
+
+        while (! realtimeReader->isReady (position, blockSize))
+            juce::Thread::sleep (1);
+
+        auto* const* channels = reinterpret_cast<int* const*> (buffer.getArrayOfWritePointers());
+
+        if (i < numWarmUpBlocks)
+        {
+            reader->readSamples (channels, numChannels, 0, position, blockSize);
+        }
+        else
+        {
+            const Measurement measurement;
+            reader->readSamples (channels, numChannels, 0, position, blockSize);
+            readResult.add (measurement);
+        }
+    }
+
+    //==========================================================================
+    // Writer: a call that fills part of a pooled block only converts samples.
+    // The call that starts a block takes it from the pool, under the lock the
+    // pool shares with the Media Foundation callback that returns blocks, and
+    // must not allocate. The call that completes a block hands it to the
+    // Media Foundation sink writer, which encodes it; only those calls are
+    // counted without a check.
+    juce::File outputFile (juce::File::createTempFile (".mp4"));
+    std::unique_ptr<juce::OutputStream> outputStream = outputFile.createOutputStream();
+
+    std::unique_ptr<juce::AudioFormatWriter> writer (
+            mp4Format.createWriterFor (outputStream,
+                juce::AudioFormatWriterOptions{}
+                .withSampleRate (reader->sampleRate) // 44100 or 48000
+                .withNumChannels (numChannels) // 1, 2 or 6
+                .withBitsPerSample (16)
+                .withQualityOptionIndex (4)
+                ));
+
+    if (writer == nullptr)
+    {
+        printf ("Error creating audio format writer.\n");
+        return 1;
+    }
+
+    // 16-bit samples are passed in the top bits of ints.
+    juce::HeapBlock<int> samples ((size_t) (numChannels * blockSize), true);
+    juce::HeapBlock<const int*> channels ((size_t) numChannels);
+
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        channels[ch] = samples + ch * blockSize;
+
+        for (int i = 0; i < blockSize; ++i)
+            samples[ch * blockSize + i] = juce::roundToInt (0.25 * std::sin (0.05 * i) * 0x7fffffff);
+    }
+
+    Result writeResult, startResult, completeResult;
+
+    for (int i = 0; i < numWarmUpWrites + numMeasuredBlocks; ++i)
+    {
+        if (i < numWarmUpWrites)
+        {
+            writer->write (channels, blockSize);
+            continue;
+        }
+
+        const juce::int64 position = (juce::int64) i * blockSize;
+        Result& result = (position % samplesPerAccessUnit == 0) ? startResult
+                       : ((position + blockSize) % samplesPerAccessUnit == 0) ? completeResult
+                       : writeResult;
+
+        const Measurement measurement;
+        writer->write (channels, blockSize);
+        result.add (measurement);
+    }
+
+    writer.reset();
+    outputFile.deleteFile();
+
+    //==========================================================================
+    readResult.print ("MP4 real-time readSamples()");
+    writeResult.print ("MP4 writer write() within a block");
+    startResult.print ("MP4 writer write() starting a block");
+    completeResult.print ("MP4 writer write() to the sink writer");
+
+    if (realtimeReader->getNumUnderruns() > 0)
+        printf ("%d underruns (the decoder did not keep up).\n", realtimeReader->getNumUnderruns());
+
+    const bool ok = readResult.isClean() && writeResult.isClean() && startResult.numAllocations == 0;
+
+    jassert (readResult.isClean());
+    jassert (writeResult.isClean());
+    jassert (startResult.numAllocations == 0);
+
+    if (! ok)
+    {
+        printf ("\nFailed: the real-time paths allocated or locked.\n");
+        return 1;
+    }
+
+    printf ("\nThe real-time paths did not allocate or lock.\n");
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    namespace WindowsMediaFoundation {
+
+        using namespace mole::Windows;
+
+        //=============================================================================
+        /** Writes encoded AAC access units to MP4 file format.
+         *
+         * The sink writer passes the access units through without encoding, so
+         * they can be produced by any number of AACEncoder instances.
+         */
+        class MP4AccessUnitWriter final
+        {
+            COMLibrary library;
+            MFPlatform platform;
+
+            IMFSinkWriter* sinkWriter = nullptr;
+
+            DWORD streamIndex = 0; // Audio stream index.
+            double sampleRate = 0;
+            juce::int64 numSamplesWritten = 0;
+
+            //=============================================================================
+            public:
+
+            MP4AccessUnitWriter() = default;
+
+            ~MP4AccessUnitWriter()
+            {
+                SafeRelease (&sinkWriter);
+            }
+
+            /** Creates the sink writer.
+             *
+             * @param stream Output stream, not owned.
+             * @param mediaType Output type of the encoder (see AACEncoder::GetOutputType()).
+             */
+            HRESULT Initialize (juce::OutputStream* stream, IMFMediaType* mediaType)
+            {
+                HRESULT hr = (stream != nullptr && mediaType != nullptr) ? S_OK : E_INVALIDARG;
+
+                if (SUCCEEDED (hr)) hr = library.Initialize();
+                if (SUCCEEDED (hr)) hr = platform.Initialize();
+
+                if (SUCCEEDED (hr))
+                {
+                    UINT32 rate = 0;
+                    hr = mediaType->GetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, &rate);
+                    sampleRate = (double) rate;
+                }
+
+                if (SUCCEEDED (hr))
+                {
+                    IMFAttributes* attributes = nullptr;
+                    IMFByteStream* byteStream = nullptr;
+
+                    hr = ::MFCreateAttributes (&attributes, 1);
+                    if (SUCCEEDED (hr)) hr = attributes->SetGUID (MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_MPEG4);
+
+                    if (SUCCEEDED (hr)) hr = ByteStreamFromOutputStream (&byteStream, stream, L"audio/mp4");
+                    if (SUCCEEDED (hr)) hr = ::MFCreateSinkWriterFromURL (nullptr, byteStream, attributes, &sinkWriter);
+
+                    SafeRelease (&byteStream);
+                    SafeRelease (&attributes);
+                }
+
+                // Same input and output type, no encoder is inserted.
+                if (SUCCEEDED (hr)) hr = sinkWriter->AddStream (mediaType, &streamIndex);
+                if (SUCCEEDED (hr)) hr = sinkWriter->SetInputMediaType (streamIndex, mediaType, nullptr);
+                if (SUCCEEDED (hr)) hr = sinkWriter->BeginWriting();
+
+                return hr;
+            }
+
+            /** Writes one access unit of 1024 samples per channel.  */
+            HRESULT Write (const void* data, size_t size)
+            {
+                IMFSample* sample = nullptr;
+                IMFMediaBuffer* buffer = nullptr;
+                BYTE* bufferData = nullptr;
+
+                HRESULT hr = ::MFCreateSample (&sample);
+                if (SUCCEEDED (hr)) hr = ::MFCreateMemoryBuffer ((DWORD) size, &buffer);
+                if (SUCCEEDED (hr)) hr = buffer->Lock (&bufferData, nullptr, nullptr);
+
+                if (SUCCEEDED (hr))
+                {
+                    memcpy (bufferData, data, size);
+                    hr = buffer->Unlock();
+                }
+
+                const LONGLONG sampleTime = GetTime (numSamplesWritten);
+
+                if (SUCCEEDED (hr)) hr = buffer->SetCurrentLength ((DWORD) size);
+                if (SUCCEEDED (hr)) hr = sample->AddBuffer (buffer);
+                if (SUCCEEDED (hr)) hr = sample->SetSampleTime (sampleTime);
+                if (SUCCEEDED (hr)) hr = sample->SetSampleDuration (GetTime (numSamplesWritten + 1024) - sampleTime);
+                if (SUCCEEDED (hr)) hr = sinkWriter->WriteSample (streamIndex, sample);
+                if (SUCCEEDED (hr)) numSamplesWritten += 1024;
+
+                SafeRelease (&buffer);
+                SafeRelease (&sample);
+
+                return hr;
+            }
+
+            /** Completes the file.  */
+            HRESULT Finalize()
+            {
+                return sinkWriter->Finalize();
+            }
+
+            //=============================================================================
+            private:
+
+            /** Returns the presentation time of a sample in 100 ns time units.  */
+            LONGLONG GetTime (juce::int64 sampleNumber) const noexcept
+            {
+                return (LONGLONG) (sampleNumber * 10000000 / (juce::int64) sampleRate);
+            }
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4AccessUnitWriter)
+        };
+    } // namespace WindowsMediaFoundation
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,259 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    //==============================================================================
+    void MP4LoudnessTap::prepare (double sampleRate, int numChannels)
+    {
+        const double pi = juce::MathConstants<double>::pi;
+
+        // Pre-filter (high shelf) and RLB filter (high pass) of BS.1770, for any sample rate.
+        Filter shelf;
+        {
+            const double k = std::tan (pi * 1681.974450955533 / sampleRate);
+            const double q = 0.7071752369554196;
+            const double vh = std::pow (10.0, 3.999843853973347 / 20.0);
+            const double vb = std::pow (vh, 0.4996667741545416);
+            const double a0 = 1.0 + k / q + k * k;
+
+            shelf.b0 = (vh + vb * k / q + k * k) / a0;
+            shelf.b1 = 2.0 * (k * k - vh) / a0;
+            shelf.b2 = (vh - vb * k / q + k * k) / a0;
+            shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+            shelf.a2 = (1.0 - k / q + k * k) / a0;
+        }
+
+        Filter highPass;
+        {
+            const double k = std::tan (pi * 38.13547087602444 / sampleRate);
+            const double q = 0.5003270373238773;
+            const double a0 = 1.0 + k / q + k * k;
+
+            highPass.b0 = 1.0;
+            highPass.b1 = -2.0;
+            highPass.b2 = 1.0;
+            highPass.a1 = 2.0 * (k * k - 1.0) / a0;
+            highPass.a2 = (1.0 - k / q + k * k) / a0;
+        }
+
+        shelfFilters.assign ((size_t) numChannels, shelf);
+        highPassFilters.assign ((size_t) numChannels, highPass);
+        channelWeights.assign ((size_t) numChannels, 1.0);
+
+        if (numChannels == 6)
+        {
+            channelWeights[3] = 0.0;   // LFE
+            channelWeights[4] = 1.41;  // Ls
+            channelWeights[5] = 1.41;  // Rs
+        }
+
+        subBlockSize = juce::jmax (1, juce::roundToInt (sampleRate / 10.0));
+        subBlockPosition = 0;
+        subBlockEnergy = 0;
+        subBlockEnergies.assign ((size_t) numShortTermSubBlocks, 0.0);
+        numSubBlocks = 0;
+
+        blockPowers.clear();
+        maxMomentaryPower = 0;
+        maxShortTermPower = 0;
+    }
+
+    void MP4LoudnessTap::process (const float* const* channels, int numSamples)
+    {
+        for (int done = 0; done < numSamples;)
+        {
+            const int numToDo = juce::jmin (numSamples - done, subBlockSize - subBlockPosition);
+
+            for (size_t ch = 0; ch < channelWeights.size(); ++ch)
+            {
+                if (channelWeights[ch] == 0.0)
+                    continue;
+
+                Filter& shelf = shelfFilters[ch];
+                Filter& highPass = highPassFilters[ch];
+                const float* samples = channels[ch] + done;
+                double sum = 0;
+
+                for (int i = 0; i < numToDo; ++i)
+                {
+                    const double z = highPass.process (shelf.process (samples[i]));
+                    sum += z * z;
+                }
+
+                subBlockEnergy += channelWeights[ch] * sum;
+            }
+
+            done += numToDo;
+            subBlockPosition += numToDo;
+
+            if (subBlockPosition == subBlockSize)
+                addSubBlock();
+        }
+    }
+
+    /* Ends a sub-block of 100 ms, each one completes a momentary gating block and a short-term window. */
+    void MP4LoudnessTap::addSubBlock()
+    {
+        subBlockEnergies[(size_t) (numSubBlocks % numShortTermSubBlocks)] = subBlockEnergy;
+        subBlockEnergy = 0;
+        subBlockPosition = 0;
+        ++numSubBlocks;
+
+        if (numSubBlocks >= numMomentarySubBlocks)
+        {
+            const double power = getPowerOfLast (numMomentarySubBlocks);
+            maxMomentaryPower = juce::jmax (maxMomentaryPower, power);
+
+            // Absolute gate, the relative gate depends on all blocks and is applied at the end.
+            if (toLoudness (power) > -70.0)
+                blockPowers.push_back (power);
+        }
+
+        if (numSubBlocks >= numShortTermSubBlocks)
+            maxShortTermPower = juce::jmax (maxShortTermPower, getPowerOfLast (numShortTermSubBlocks));
+    }
+
+    /* Returns the mean square of the last sub-blocks. */
+    double MP4LoudnessTap::getPowerOfLast (int numSubBlocksInBlock) const noexcept
+    {
+        double sum = 0;
+
+        for (int i = 1; i <= numSubBlocksInBlock; ++i)
+            sum += subBlockEnergies[(size_t) ((numSubBlocks - i) % numShortTermSubBlocks)];
+
+        return sum / ((double) numSubBlocksInBlock * subBlockSize);
+    }
+
+    double MP4LoudnessTap::toLoudness (double power) noexcept
+    {
+        return (power > 0) ? -0.691 + 10.0 * std::log10 (power) : -std::numeric_limits<double>::infinity();
+    }
+
+    double MP4LoudnessTap::getIntegratedLoudness() const noexcept
+    {
+        if (blockPowers.empty())
+            return toLoudness (0);
+
+        double sum = 0;
+
+        for (const double power : blockPowers)
+            sum += power;
+
+        // Relative gate, 10 LU below the loudness of the blocks above the absolute gate.
+        const double relativeGate = sum / (double) blockPowers.size() * std::pow (10.0, -10.0 / 10.0);
+        double gatedSum = 0;
+        size_t numGated = 0;
+
+        for (const double power : blockPowers)
+        {
+            if (power > relativeGate)
+            {
+                gatedSum += power;
+                ++numGated;
+            }
+        }
+
+        return (numGated > 0) ? toLoudness (gatedSum / (double) numGated) : toLoudness (0);
+    }
+
+    double MP4LoudnessTap::getShortTermLoudness() const noexcept
+    {
+        if (numSubBlocks == 0)
+            return toLoudness (0);
+
+        // Streams shorter than 3 s are measured over what there is.
+        return toLoudness (getPowerOfLast ((int) juce::jmin (numSubBlocks, (juce::int64) numShortTermSubBlocks)));
+    }
+
+    //==============================================================================
+    void MP4TruePeakTap::prepare (double sampleRate, int numChannels)
+    {
+        upsampler = std::make_unique<MP4Resampler> (sampleRate, sampleRate * oversampling, numChannels, MP4Resampler::Quality::fast);
+        upsampled.setSize (numChannels, upsampler->getMaxNumOutputSamples (upsampler->getLatency()), false, false, true);
+        peaks.assign ((size_t) numChannels, 0.0f);
+    }
+
+    void MP4TruePeakTap::process (const float* const* channels, int numSamples)
+    {
+        if (upsampler == nullptr)
+            return;
+
+        const int numUpsampled = upsampler->getMaxNumOutputSamples (numSamples);
+
+        if (numUpsampled > upsampled.getNumSamples())
+            upsampled.setSize (upsampled.getNumChannels(), numUpsampled, false, false, true);
+
+        addPeaks (upsampler->process (channels, numSamples, upsampled.getArrayOfWritePointers()));
+    }
+
+    void MP4TruePeakTap::finish()
+    {
+        // The filter still holds the interpolated samples around the last input samples.
+        if (upsampler != nullptr)
+            addPeaks (upsampler->flush (upsampled.getArrayOfWritePointers()));
+    }
+
+    void MP4TruePeakTap::addPeaks (int numUpsampled) noexcept
+    {
+        for (int ch = 0; ch < upsampled.getNumChannels(); ++ch)
+        {
+            const auto range = juce::FloatVectorOperations::findMinAndMax (upsampled.getReadPointer (ch), numUpsampled);
+            peaks[(size_t) ch] = juce::jmax (peaks[(size_t) ch], -range.getStart(), range.getEnd());
+        }
+    }
+
+    float MP4TruePeakTap::getTruePeak (int channel) const noexcept
+    {
+        return juce::isPositiveAndBelow (channel, (int) peaks.size()) ? peaks[(size_t) channel] : 0.0f;
+    }
+
+    float MP4TruePeakTap::getMaxTruePeakDecibels() const noexcept
+    {
+        float peak = 0.0f;
+
+        for (const float channelPeak : peaks)
+            peak = juce::jmax (peak, channelPeak);
+
+        return juce::Decibels::gainToDecibels (peak, -std::numeric_limits<float>::infinity());
+    }
+
+    //==============================================================================
+    void MP4ChecksumTap::prepare (double, int channels)
+    {
+        numChannels = channels;
+        hash = offsetBasis;
+    }
+
+    void MP4ChecksumTap::process (const float* const* channels, int numSamples)
+    {
+        juce::uint64 h = hash;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                juce::uint32 bits;
+                memcpy (&bits, channels[ch] + i, sizeof (bits));
+
+                // Lowest byte first, the little-endian byte order on any machine.
+                for (int shift = 0; shift < 32; shift += 8)
+                    h = (h ^ ((bits >> shift) & 0xff)) * prime;
+            }
+        }
+
+        hash = h;
+    }
+
+    juce::String MP4ChecksumTap::toString() const
+    {
+        return juce::String::toHexString ((juce::int64) hash).paddedLeft ('0', 16);
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,193 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Analysis that runs on decoded samples while a reader reads them.
+     *
+     * Readers with taps in their options (MP4AudioReaderOptions::withAnalysisTaps())
+     * pass every sample to every tap once, in stream order, as it is read.
+     * Reading a stream from start to end, e.g. to transcode it, measures all
+     * taps in the same pass, without decoding it again.
+     *
+     * A tap is used on the thread that reads, read its results when reading
+     * is done. A tap measures one reader at a time, prepare() starts over.
+     */
+    class MP4AnalysisTap : public juce::ReferenceCountedObject
+    {
+        //==========================================================================
+        public:
+            using Ptr = juce::ReferenceCountedObjectPtr<MP4AnalysisTap>;
+
+            /** Destructor. */
+            ~MP4AnalysisTap() override = default;
+
+            /** Clears the results for a new stream. */
+            virtual void prepare (double sampleRate, int numChannels) = 0;
+
+            /** Measures the next samples of the stream.
+             *
+             * @param channels One channel per channel passed to prepare().
+             * @param numSamples Number of samples per channel.
+             */
+            virtual void process (const float* const* channels, int numSamples) = 0;
+
+            /** Called after the last sample of the stream. */
+            virtual void finish() {}
+    };
+
+    //==========================================================================
+    /** EBU R128 loudness (ITU-R BS.1770-4).
+     *
+     * Samples are K-weighted and measured in gating blocks of 400 ms that
+     * overlap by 75%. The integrated loudness is gated at -70 LUFS and then
+     * at 10 LU below the loudness of the blocks above -70 LUFS. The 5.1
+     * layout of the decoder (L R C LFE Ls Rs) weights the surround channels
+     * by 1.41 and leaves out the LFE channel.
+     *
+     * Loudness values are in LUFS, minus infinity for silence or streams
+     * shorter than a block.
+     */
+    class MP4LoudnessTap final : public MP4AnalysisTap
+    {
+        //==========================================================================
+        public:
+            /** Creates a tap. */
+            MP4LoudnessTap() = default;
+
+            /** Returns the integrated loudness of the stream so far. */
+            double getIntegratedLoudness() const noexcept;
+
+            /** Returns the short-term loudness of the last 3 seconds. */
+            double getShortTermLoudness() const noexcept;
+
+            /** Returns the highest short-term loudness of the stream so far. */
+            double getMaxShortTermLoudness() const noexcept           { return toLoudness (maxShortTermPower); }
+
+            /** Returns the highest momentary (400 ms) loudness of the stream so far. */
+            double getMaxMomentaryLoudness() const noexcept           { return toLoudness (maxMomentaryPower); }
+
+            void prepare (double sampleRate, int numChannels) override;
+            void process (const float* const* channels, int numSamples) override;
+
+        //==========================================================================
+        private:
+            static constexpr int numMomentarySubBlocks = 4;     // 400 ms in steps of 100 ms
+            static constexpr int numShortTermSubBlocks = 30;    // 3 s in steps of 100 ms
+
+            // Biquad in direct form II transposed.
+            struct Filter
+            {
+                double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+                double z1 = 0, z2 = 0;
+
+                double process (double x) noexcept
+                {
+                    const double y = b0 * x + z1;
+                    z1 = b1 * x - a1 * y + z2;
+                    z2 = b2 * x - a2 * y;
+                    return y;
+                }
+            };
+
+            std::vector<Filter> shelfFilters, highPassFilters; // per channel
+            std::vector<double> channelWeights;
+
+            int subBlockSize = 0;                   // samples in 100 ms
+            int subBlockPosition = 0;
+            double subBlockEnergy = 0;              // weighted sum of squares
+            std::vector<double> subBlockEnergies;   // ring of the last 30 sub-blocks
+            juce::int64 numSubBlocks = 0;
+
+            std::vector<double> blockPowers;        // mean square of each gating block above -70 LUFS
+            double maxMomentaryPower = 0;
+            double maxShortTermPower = 0;
+
+            double getPowerOfLast (int numSubBlocksInBlock) const noexcept;
+            void addSubBlock();
+            static double toLoudness (double power) noexcept;
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4LoudnessTap)
+    };
+
+    //==========================================================================
+    /** True-peak level (ITU-R BS.1770-4, Annex 2).
+     *
+     * Samples are oversampled 4 times with the fast MP4Resampler filter and
+     * the highest absolute value of each channel is kept, so peaks between
+     * samples that clip after encoding or conversion are found.
+     */
+    class MP4TruePeakTap final : public MP4AnalysisTap
+    {
+        //==========================================================================
+        public:
+            /** Creates a tap. */
+            MP4TruePeakTap() = default;
+
+            /** Returns the true-peak level of a channel, 1.0 is full scale. */
+            float getTruePeak (int channel) const noexcept;
+
+            /** Returns the highest true-peak level of all channels in dBTP. */
+            float getMaxTruePeakDecibels() const noexcept;
+
+            void prepare (double sampleRate, int numChannels) override;
+            void process (const float* const* channels, int numSamples) override;
+            void finish() override;
+
+        //==========================================================================
+        private:
+            static constexpr int oversampling = 4;
+
+            std::unique_ptr<MP4Resampler> upsampler;
+            juce::AudioBuffer<float> upsampled;
+            std::vector<float> peaks;               // per channel
+
+            void addPeaks (int numUpsampled) noexcept;
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4TruePeakTap)
+    };
+
+    //==========================================================================
+    /** 64-bit FNV-1a hash of the decoded samples.
+     *
+     * Hashes the 32-bit float samples, interleaved, in little-endian byte
+     * order. Two streams that decode to the same samples with the same
+     * decoder have the same checksum, whatever their container or metadata.
+     */
+    class MP4ChecksumTap final : public MP4AnalysisTap
+    {
+        //==========================================================================
+        public:
+            /** Creates a tap. */
+            MP4ChecksumTap() = default;
+
+            /** Returns the checksum of the samples so far. */
+            juce::uint64 getChecksum() const noexcept                   { return hash; }
+
+            /** Returns the checksum as 16 hexadecimal digits. */
+            juce::String toString() const;
+
+            void prepare (double sampleRate, int numChannels) override;
+            void process (const float* const* channels, int numSamples) override;
+
+        //==========================================================================
+        private:
+            static constexpr juce::uint64 offsetBasis = 0xcbf29ce484222325ULL;
+            static constexpr juce::uint64 prime = 0x100000001b3ULL;
+
+            int numChannels = 0;
+            juce::uint64 hash = offsetBasis;
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4ChecksumTap)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -14,7 +14,40 @@ namespace mole {
     juce::AudioFormatReader* MP4AudioFormat::createReaderFor (
             juce::InputStream* sourceStream, bool deleteStreamIfOpeningFails)
     {
-        std::unique_ptr<juce::AudioFormatReader> p (new MP4AudioFormatReader (sourceStream, false));
+        if (sourceStream != nullptr)
+        {
+            MP4AudioIndex::Ptr index;
+            auto* fileStream = dynamic_cast<juce::FileInputStream*> (sourceStream);
+
+            // Files are indexed once per process (see MP4AudioIndexCache).
+            if (fileStream != nullptr)
+                index = MP4AudioIndexCache::getInstance().getIndexFor (fileStream->getFile(), *sourceStream);
+            else
+                index = MP4AudioIndex::createFrom (*sourceStream);
+
+            if (index != nullptr)
+            {
+                auto options = readerOptions;
+
+                // Waveforms of files with a level sidecar are drawn without decoding, other
+                // readers build the pyramid and its sidecar when they read the whole file.
+                if (fileStream != nullptr && options.getLevelPyramid() == nullptr)
+                {
+                    const juce::File sidecarFile = MP4AudioIndexCache::getInstance().getSidecarFileFor (fileStream->getFile(), ".molelvl");
+
+                    if (sidecarFile != juce::File())
+                        options = options.withLevelPyramid (MP4LevelPyramid::createFromSidecar (sidecarFile, fileStream->getFile()));
+                }
+
+                if (auto* reader = createReaderFor (sourceStream, index, options, false))
+                    return reader;
+            }
+
+            // Not indexed by the portable demuxer, try Media Foundation source reader.
+            sourceStream->setPosition (0);
+        }
+
+        std::unique_ptr<juce::AudioFormatReader> p (new MFAudioFormatReader (sourceStream, false));
 
         if (p->bitsPerSample == 32 && p->sampleRate > 0 && p->numChannels > 0 && p->lengthInSamples > 0)
             return p.release();
@@ -25,26 +58,170 @@ namespace mole {
         return nullptr;
     }
 
-    /* Tries to create an object that can write to a stream with this audio format. */
-    std::unique_ptr<juce::AudioFormatWriter> MP4AudioFormat::createWriterFor (
-            std::unique_ptr<juce::OutputStream>& streamToWriteTo,
-            const juce::AudioFormatWriterOptions& options)
+    /* Creates a reader that decodes with an existing index. */
+    juce::AudioFormatReader* MP4AudioFormat::createReaderFor (juce::InputStream* sourceStream,
+            MP4AudioIndex::Ptr index, bool deleteStreamIfOpeningFails)
+    {
+        return createReaderFor (sourceStream, index, readerOptions, deleteStreamIfOpeningFails);
+    }
+
+    /* Creates a reader that decodes with an existing index and its own options. */
+    juce::AudioFormatReader* MP4AudioFormat::createReaderFor (juce::InputStream* sourceStream,
+            MP4AudioIndex::Ptr index, const MP4AudioReaderOptions& options, bool deleteStreamIfOpeningFails)
+    {
+        std::unique_ptr<juce::AudioFormatReader> p (new MP4AudioFormatReader (sourceStream, index, options));
+
+        if (p->sampleRate > 0 && p->numChannels > 0 && p->lengthInSamples > 0)
+            return p.release();
+
+        if (! deleteStreamIfOpeningFails)
+            p->input = nullptr;
+
+        return nullptr;
+    }
+
+    /* Attempts to create a MemoryMappedAudioFormatReader, if possible for this format. */
+    juce::MemoryMappedAudioFormatReader* MP4AudioFormat::createMemoryMappedReader (const juce::File& file)
+    {
+        auto& cache = MP4DecodedAudioCache::getInstance();
+
+        if (cache.getDirectory() == juce::File())
+            return nullptr;
+
+        juce::File decodedFile = cache.findDecodedFileFor (file);
+
+        if (decodedFile == juce::File())
+        {
+            std::unique_ptr<juce::FileInputStream> stream (file.createInputStream());
+
+            if (stream == nullptr)
+                return nullptr;
+
+            std::unique_ptr<juce::AudioFormatReader> reader;
+
+            // Decode on this thread, the reader options may select real-time mode that drops samples.
+            if (auto index = MP4AudioIndexCache::getInstance().getIndexFor (file, *stream))
+            {
+                reader.reset (createReaderFor (stream.release(), index, MP4AudioReaderOptions(), true));
+            }
+            else
+            {
+                stream->setPosition (0);
+                reader.reset (createReaderFor (stream.release(), true));
+            }
+
+            if (reader == nullptr)
+                return nullptr;
+
+            decodedFile = cache.getDecodedFileFor (file, *reader);
+
+            if (decodedFile == juce::File())
+                return nullptr;
+        }
+
+        return juce::WavAudioFormat().createMemoryMappedReader (decodedFile);
+    }
+
+    /* Attempts to create a MemoryMappedAudioFormatReader, if possible for this format. */
+    juce::MemoryMappedAudioFormatReader* MP4AudioFormat::createMemoryMappedReader (juce::FileInputStream* fin)
+    {
+        // Takes ownership of the stream, like the other formats.
+        std::unique_ptr<juce::FileInputStream> stream (fin);
+
+        if (stream == nullptr)
+            return nullptr;
+
+        return createMemoryMappedReader (stream->getFile());
+    }
+
+    /* Returns the level pyramid of a file, from its sidecar or by decoding the file. */
+    MP4LevelPyramid::Ptr MP4AudioFormat::getLevelPyramidFor (const juce::File& file)
+    {
+        const juce::File sidecarFile = MP4AudioIndexCache::getInstance().getSidecarFileFor (file, ".molelvl");
+
+        if (sidecarFile != juce::File())
+        {
+            if (auto pyramid = MP4LevelPyramid::createFromSidecar (sidecarFile, file))
+                return pyramid;
+        }
+
+        std::unique_ptr<juce::FileInputStream> stream (file.createInputStream());
+
+        if (stream == nullptr)
+            return nullptr;
+
+        std::unique_ptr<juce::AudioFormatReader> reader;
+
+        // Default options, the pyramid is shared by readers with any options that keep the stream as it is.
+        if (auto index = MP4AudioIndexCache::getInstance().getIndexFor (file, *stream))
+        {
+            reader.reset (createReaderFor (stream.release(), index, MP4AudioReaderOptions(), true));
+        }
+        else
+        {
+            stream->setPosition (0);
+            reader.reset (createReaderFor (stream.release(), true));
+        }
+
+        if (reader == nullptr)
+            return nullptr;
+
+        // Readers of the portable demuxer build the pyramid and write its sidecar as they read to the end.
+        if (auto* mp4Reader = dynamic_cast<MP4AudioFormatReader*> (reader.get()))
+        {
+            juce::AudioBuffer<float> buffer ((int) reader->numChannels, 65536);
+
+            for (juce::int64 position = 0; position < reader->lengthInSamples; position += buffer.getNumSamples())
+            {
+                const int numToRead = (int) juce::jmin ((juce::int64) buffer.getNumSamples(), reader->lengthInSamples - position);
+
+                if (! reader->read (&buffer, 0, numToRead, position, true, true))
+                    return nullptr;
+            }
+
+            return mp4Reader->getLevelPyramid();
+        }
+
+        auto pyramid = MP4LevelPyramid::createFrom (*reader);
+
+        if (pyramid != nullptr && sidecarFile != juce::File())
+        {
+            sidecarFile.getParentDirectory().createDirectory();
+
+            if (! pyramid->writeSidecar (sidecarFile, file))
+                DBGSTR("Writing level sidecar failed.");
+        }
+
+        return pyramid;
+    }
+
+    /* Returns true if the writer options are supported, the quality option index is checked by the caller. */
+    static bool isWriterOptionsSupported (MP4AudioFormat& format, const juce::AudioFormatWriterOptions& options)
     {
-        switch ((int) options.getSampleRate())
+        // Other input sample rates are resampled to the output sample rate.
+        const double outputSampleRate = format.getWriterOptions().getOutputSampleRate();
+
+        switch ((int) ((outputSampleRate > 0) ? outputSampleRate : options.getSampleRate()))
         {
             case 44100: case 48000:
                 break;
             default:
                 DBGSTR("The specified sample rate is not supported.");
-                return nullptr;
+                return false;
+        }
+
+        if (options.getSampleRate() <= 0)
+        {
+            DBGSTR("The specified sample rate is not supported.");
+            return false;
         }
 
         if (options.getChannelLayout().has_value())
         {
-            if (isChannelLayoutSupported (options.getChannelLayout().value()) == false)
+            if (format.isChannelLayoutSupported (options.getChannelLayout().value()) == false)
             {
                 DBGSTR("The specified channel layout is not supported.");
-                return nullptr;
+                return false;
             }
         }
         else
@@ -55,38 +232,125 @@ namespace mole {
                     break;
                 default:
                     DBGSTR("The specified number of channels is not supported.");
-                    return nullptr;
+                    return false;
             }
         }
 
         switch ((int) options.getBitsPerSample())
         {
-            case 16:
+            case 16: case 24: case 32:
                 break;
             default:
                 DBGSTR("The specified bits per sample is not supported.");
-                return nullptr;
+                return false;
         }
 
         if (options.getMetadataValues().size() > 0)
         {
             DBGSTR("Writing metadata values is not supported.");
-            return nullptr;
+            return false;
         }
 
-        switch ((int) options.getQualityOptionIndex())
+        return true;
+    }
+
+    /* Returns true if the quality option index is supported. */
+    static bool isQualityOptionSupported (int qualityOptionIndex)
+    {
+        switch (qualityOptionIndex)
         {
             case 0: case 1: case 2: case 3:
             case 4: case 5: case 6: case 7:
-                break;
+                return true;
             default:
                 DBGSTR("The specified quality option index is not supported.");
-                return nullptr;
+                return false;
         }
+    }
+
+    /* Tries to create an object that can write to a stream with this audio format. */
+    std::unique_ptr<juce::AudioFormatWriter> MP4AudioFormat::createWriterFor (
+            std::unique_ptr<juce::OutputStream>& streamToWriteTo,
+            const juce::AudioFormatWriterOptions& options)
+    {
+        if (! isWriterOptionsSupported (*this, options) || ! isQualityOptionSupported (options.getQualityOptionIndex()))
+            return nullptr;
 
         return std::make_unique<MP4AudioFormatWriter> (streamToWriteTo.release(),
                 options.getChannelLayout().has_value()
-                ? options.withNumChannels (options.getChannelLayout().value().size()) : options);
+                ? options.withNumChannels (options.getChannelLayout().value().size()) : options,
+                writerOptions);
+    }
+
+    /* Creates a writer that encodes the same audio to several streams, each at its own bit rate. */
+    std::unique_ptr<juce::AudioFormatWriter> MP4AudioFormat::createMultiBitrateWriterFor (
+            std::vector<std::unique_ptr<juce::OutputStream>>& streamsToWriteTo,
+            const juce::AudioFormatWriterOptions& options, const juce::Array<int>& qualityOptionIndices)
+    {
+        if (streamsToWriteTo.empty() || streamsToWriteTo.size() != (size_t) qualityOptionIndices.size())
+        {
+            DBGSTR("The number of streams and quality options are different.");
+            return nullptr;
+        }
+
+        if (! isWriterOptionsSupported (*this, options))
+            return nullptr;
+
+        for (const int index : qualityOptionIndices)
+        {
+            if (! isQualityOptionSupported (index))
+                return nullptr;
+        }
+
+        return std::make_unique<MP4MultiBitrateWriter> (streamsToWriteTo,
+                options.getChannelLayout().has_value()
+                ? options.withNumChannels (options.getChannelLayout().value().size()) : options,
+                qualityOptionIndices, writerOptions);
+    }
+
+    /* Completes the file of a writer on a background thread and deletes the writer. */
+    std::future<bool> MP4AudioFormat::finalizeAsync (std::unique_ptr<juce::AudioFormatWriter> writer,
+            std::function<void (bool)> onFinished)
+    {
+        auto promise = std::make_shared<std::promise<bool>>();
+        auto future = promise->get_future();
+
+        auto finished = [promise, onFinished] (bool succeeded)
+        {
+            if (onFinished) onFinished (succeeded);
+            promise->set_value (succeeded);
+        };
+
+        if (auto* mp4Writer = dynamic_cast<MP4AudioFormatWriter*> (writer.get()))
+        {
+            mp4Writer->finalizeAsync (finished);
+        }
+        else if (auto* multiBitrateWriter = dynamic_cast<MP4MultiBitrateWriter*> (writer.get()))
+        {
+            multiBitrateWriter->finalizeAsync (finished);
+        }
+        else
+        {
+            const bool succeeded = (writer != nullptr);
+            writer.reset();
+            finished (succeeded);
+        }
+
+        writer.reset(); // does not wait for the background thread
+
+        return future;
+    }
+
+    /* Returns the throughput of the sample rate conversion of a writer. */
+    MP4Resampler::Statistics MP4AudioFormat::getResamplerStatistics (const juce::AudioFormatWriter& writer)
+    {
+        if (auto* mp4Writer = dynamic_cast<const MP4AudioFormatWriter*> (&writer))
+            return mp4Writer->getResamplerStatistics();
+
+        if (auto* multiBitrateWriter = dynamic_cast<const MP4MultiBitrateWriter*> (&writer))
+            return multiBitrateWriter->getResamplerStatistics();
+
+        return {};
     }
 
 #endif // JUCE_WINDOWS
@@ -13,8 +13,14 @@ namespace mole {
     //==========================================================================
     /** Windows Media Foundation MP4 audio format.
      *
-     * - AudioFormatReader: Read MP4, AAC and 3GP file formats.
-     * - AudioFormatWriter: Write MP4 file format with AAC audio.
+     * - AudioFormatReader: Read MP4, AAC and 3GP file formats, as 32-bit float
+     *   samples (usesFloatingPointData is true for all streams).
+     * - AudioFormatWriter: Write MP4 file format with AAC audio, from 16, 24 or
+     *   32 (float) bits per sample (see MP4AudioWriterOptions).
+     *
+     * AAC streams in MP4 and ADTS containers are indexed by a portable demuxer
+     * (see MP4AudioIndex) and decoded by the Media Foundation AAC decoder. Other
+     * streams are read with the Media Foundation source reader.
      */
     class MP4AudioFormat final : public juce::AudioFormat
     {
@@ -33,13 +39,13 @@ namespace mole {
             /* Returns a set of sample rates that the format can read and write. */
             juce::Array<int> getPossibleSampleRates() override
             {
-                return { 44100, 48000 }; // encoder sample rates
+                return { 44100, 48000 }; // encoder sample rates, writers resample other rates to the output sample rate of MP4AudioWriterOptions
             }
 
             /* Returns a set of bit depths that the format can read and write. */
             juce::Array<int> getPossibleBitDepths() override
             {
-                return { 16, 32 }; // encoder 16, decoder 32 bits per sample
+                return { 16, 24, 32 }; // encoder 16, 24 and 32 (float) rounded to 16, decoder 32 bits per sample (float)
             }
 
             /* Returns true if the format can do 2-channel audio. */
@@ -100,23 +106,134 @@ namespace mole {
             juce::AudioFormatReader* createReaderFor (
                     juce::InputStream* sourceStream, bool deleteStreamIfOpeningFails) override;
 
-            /* Attempts to create a MemoryMappedAudioFormatReader, if possible for this format. */
-            juce::MemoryMappedAudioFormatReader* createMemoryMappedReader (const juce::File& /*file*/) override
+            /** Creates a reader that decodes with an existing index.
+             *
+             * The index is not copied and the container is not parsed again, so this
+             * is the cheap way to open many readers of the same stream, for example
+             * one per voice or thread.
+             *
+             * @param sourceStream Stream the index was created from (or another stream with the same content).
+             * @param index Index created by MP4AudioIndex::createFrom().
+             * @param deleteStreamIfOpeningFails Deletes the stream if the reader cannot be created.
+             */
+            juce::AudioFormatReader* createReaderFor (juce::InputStream* sourceStream,
+                    MP4AudioIndex::Ptr index, bool deleteStreamIfOpeningFails);
+
+            /** Creates a reader that decodes with an existing index and its own options.
+             *
+             * @param sourceStream Stream the index was created from (or another stream with the same content).
+             * @param index Index created by MP4AudioIndex::createFrom().
+             * @param options Reader options, replaces the ones set with setReaderOptions().
+             * @param deleteStreamIfOpeningFails Deletes the stream if the reader cannot be created.
+             */
+            juce::AudioFormatReader* createReaderFor (juce::InputStream* sourceStream,
+                    MP4AudioIndex::Ptr index, const MP4AudioReaderOptions& options, bool deleteStreamIfOpeningFails);
+
+            /** Sets the options of readers created afterwards. */
+            void setReaderOptions (const MP4AudioReaderOptions& options)
             {
-                return nullptr;
+                readerOptions = options;
             }
 
-            /* Attempts to create a MemoryMappedAudioFormatReader, if possible for this format. */
-            juce::MemoryMappedAudioFormatReader* createMemoryMappedReader (juce::FileInputStream* /*fin*/) override
+            /** Returns the options of new readers. */
+            const MP4AudioReaderOptions& getReaderOptions() const noexcept
             {
-                return nullptr;
+                return readerOptions;
             }
 
+            /** Sets the options of writers created afterwards. */
+            void setWriterOptions (const MP4AudioWriterOptions& options)
+            {
+                writerOptions = options;
+            }
+
+            /** Returns the options of new writers. */
+            const MP4AudioWriterOptions& getWriterOptions() const noexcept
+            {
+                return writerOptions;
+            }
+
+            /** Attempts to create a MemoryMappedAudioFormatReader, if possible for this format.
+             *
+             * Compressed audio can not be mapped. With a directory set in
+             * MP4DecodedAudioCache, the file is decoded into the cache on the first
+             * call and a reader of the decoded WAV file is returned. Otherwise
+             * this returns nullptr, use createReaderFor() (indexes are cached).
+             */
+            juce::MemoryMappedAudioFormatReader* createMemoryMappedReader (const juce::File& file) override;
+
+            /* Attempts to create a MemoryMappedAudioFormatReader, if possible for this format. */
+            juce::MemoryMappedAudioFormatReader* createMemoryMappedReader (juce::FileInputStream* fin) override;
+
+            /** Returns the level pyramid of a file, for waveforms without decoding.
+             *
+             * With a sidecar directory set in MP4AudioIndexCache, the pyramid is
+             * mapped from its sidecar if the file did not change, or the file is
+             * decoded once and the sidecar written. Readers created by
+             * createReaderFor() afterwards find the sidecar and answer
+             * readMaxLevels() from it. Without a sidecar directory, the file is
+             * decoded on every call, keep the pyramid and pass it with
+             * MP4AudioReaderOptions::withLevelPyramid().
+             *
+             * Readers of files without a sidecar build the same pyramid, and
+             * write the same sidecar, when they read the file from start to end,
+             * e.g. to draw a thumbnail or transcode it, so this only has to be
+             * called for files that are not read in full.
+             *
+             * @param file MP4, AAC or 3GP file.
+             * @return Pyramid or nullptr if the file cannot be read.
+             */
+            MP4LevelPyramid::Ptr getLevelPyramidFor (const juce::File& file);
+
             /* Tries to create an object that can write to a stream with this audio format. */
             std::unique_ptr<juce::AudioFormatWriter> createWriterFor (
                     std::unique_ptr<juce::OutputStream>& streamToWriteTo,
                     const juce::AudioFormatWriterOptions& options) override;
 
+            /** Creates a writer that encodes the same audio to several streams, each at its own bit rate.
+             *
+             * Meant for bit rate ladders: the input is read and converted once and
+             * the streams are encoded in parallel, each on its own thread. The
+             * writer takes the options of createWriterFor(), except for the
+             * quality option index.
+             *
+             * @param streamsToWriteTo One output stream per bit rate, released if the writer is created.
+             * @param options Sample rate, number of channels or channel layout and bits per sample.
+             * @param qualityOptionIndices Quality option index of each stream (see getQualityOptions()).
+             */
+            std::unique_ptr<juce::AudioFormatWriter> createMultiBitrateWriterFor (
+                    std::vector<std::unique_ptr<juce::OutputStream>>& streamsToWriteTo,
+                    const juce::AudioFormatWriterOptions& options, const juce::Array<int>& qualityOptionIndices);
+
+            /** Completes the file of a writer on a background thread and deletes the writer.
+             *
+             * Deleting a writer completes its file, which rewrites the index and can
+             * take seconds for long recordings. This returns right away instead;
+             * the index is written and the stream flushed and deleted on a
+             * background thread. Writers of other formats are deleted on the
+             * calling thread.
+             *
+             * @param writer Writer created by createWriterFor() or createMultiBitrateWriterFor().
+             * @param onFinished Called on the background thread with true if the file was completed, may be empty.
+             * @return Future that becomes true when the file was completed.
+             */
+            static std::future<bool> finalizeAsync (std::unique_ptr<juce::AudioFormatWriter> writer,
+                    std::function<void (bool)> onFinished = nullptr);
+
+            /** Returns the throughput of the sample rate conversion of a writer.
+             *
+             * Measured apart from encoding, so the cost of each can be compared.
+             * Empty for writers without conversion and writers of other formats.
+             *
+             * @param writer Writer created by createWriterFor() or createMultiBitrateWriterFor().
+             */
+            static MP4Resampler::Statistics getResamplerStatistics (const juce::AudioFormatWriter& writer);
+
+        //==========================================================================
+        private:
+            MP4AudioReaderOptions readerOptions;
+            MP4AudioWriterOptions writerOptions;
+
             JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4AudioFormat)
     };
 
@@ -13,184 +13,249 @@ namespace mole {
         using namespace mole::Windows;
 
         //=============================================================================
-        /** Reads AAC audio from any file format supported by Media Foundation.
+        /** Reads AAC audio through a shared MP4AudioIndex.
          *
-         * Metadata values are not supported (see readMetadataFromFile()).
+         * The reader is a lightweight decoding cursor: the container is parsed once
+         * into the index, and each reader only owns its input stream and decoder.
+         * Use one reader per thread, the index can be shared by all of them.
+         *
+         * With a scheduler in the reader options, access units after the read
+         * position are decoded ahead on a background worker into a ring of
+         * decoded frames; readSamples() only decodes when the ring misses.
+         *
+         * In real-time mode only the decode-ahead job decodes, it passes decoded
+         * frames to readSamples() through a lock-free ring (see MP4RealtimeReader).
+         * The ring has one consumer, the audio thread; readMaxLevels() does not
+         * decode and needs a level pyramid.
+         *
+         * With a frame cache in the reader options, every access unit is looked
+         * up in the cache before it is decoded.
+         *
+         * A few backward reads in a row switch to windowed decoding: a window of
+         * access units is decoded forward into the ring and read backward, then
+         * the window before it is decoded (ahead on the scheduler if there is
+         * one). Real-time mode reads forward only.
+         *
+         * With a level pyramid in the reader options, readMaxLevels() decodes
+         * nothing for ranges of at least a block of the pyramid, for waveforms
+         * and thumbnails (see MP4LevelPyramid). Without one, readSamples()
+         * builds the pyramid while the stream is read from start to end, like
+         * the analysis taps, and writes its sidecar (see buildLevelPyramid()).
+         *
+         * With an output number of channels in the reader options, the decoder
+         * downmixes and the reader has fewer channels than the stream.
+         *
+         * With analysis taps in the reader options, readSamples() passes the
+         * samples it reads to the taps, so reading a stream once, e.g. in a
+         * transcode, also measures it (see analyse()).
+         *
+         * With an output sample rate in the reader options, each decoded access
+         * unit is resampled as it is read and the reader reports lengths and
+         * positions in the output sample rate (see readResampled()).
          */
-        class MP4AudioFormatReader : public juce::AudioFormatReader
+        class MP4AudioFormatReader : public juce::AudioFormatReader, public MP4RealtimeReader
         {
             COMLibrary library;
             MFPlatform platform;
 
-            IMFSourceReader* sourceReader = nullptr;
-            IMFSample* sample = nullptr;
-            IMFMediaBuffer* mediaBuffer = nullptr;
+            MP4AudioIndex::Ptr index;
+            AACDecoder decoder;
+            std::atomic<bool> hasError { false };
+
+            juce::HeapBlock<char> frameData; // compressed access unit
+            juce::HeapBlock<float> frameSamples; // ring of decoded access units (interleaved)
+
+            int samplesPerFrame = 0; // decoded samples per access unit
+            int prerollFrames = 1; // access units decoded before a seek target
+            int nextFrame = 0; // next access unit expected by the decoder
 
-            int bufferOffset = 0;
-            int bufferNumSamples = 0;
-            const int bytesPerSample = 4; // 32 bits per sample (int32)
-            const DWORD firstAudioStream = (DWORD) MF_SOURCE_READER_FIRST_AUDIO_STREAM;
+            MP4FrameCache::Ptr frameCache; // decoded access units shared with other readers, or nullptr
 
-            juce::int64 currentSampleInFile = 0;
+            int numSlots = 1; // access units in the ring
+            int numAheadSlots = 1; // access units in the ring when reading forward
+            int firstFrame = 0; // first access unit in the ring
+            int numFrames = 0; // decoded access units in the ring
 
-            DWORD readResult = 0;
-            const DWORD readError = MF_SOURCE_READERF_ERROR // An error occured. Do not make any further calls to sourceReader.
-                | MF_SOURCE_READERF_ENDOFSTREAM // The source reader reached end of stream.
-                | MF_SOURCE_READERF_NEWSTREAM // One or more new streams were created.
-                | MF_SOURCE_READERF_NATIVEMEDIATYPECHANGED // The native format has changed for one or more streams.
-                | MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED // The current media type has changed for one or more streams.
-                | MF_SOURCE_READERF_STREAMTICK // There is a gap in the stream.
-                | MF_SOURCE_READERF_ALLEFFECTSREMOVED; // All transforms inserted by the application have been removed for a particular stream.
+            // Backward reads, see updateDirection().
+            int reverseWindow = 0; // access units per window, 0 reads forward only
+            int reverseCount = 0; // backward reads in a row
+            bool reverse = false;
+            juce::int64 lastReadStart = 0;
+            int behindNumFrames = 0; // decoded access units of the window before the ring
+
+            // Decodes ahead of the read position on the scheduler.
+            struct DecodeAheadJob final : public MP4DecodeScheduler::Job
+            {
+                explicit DecodeAheadJob (MP4AudioFormatReader& r) : reader (r) {}
+                bool run() override { return reader.realtime ? reader.decodeAheadRealtime() : reader.decodeAhead(); }
+
+                MP4AudioFormatReader& reader;
+            };
+
+            MP4DecodeScheduler* scheduler = nullptr;
+            MP4DecodeScheduler::Priority priority = MP4DecodeScheduler::Priority::interactive;
+            std::unique_ptr<DecodeAheadJob> decodeAheadJob;
+            juce::CriticalSection decodeLock; // decoder and ring, shared with the decode-ahead job
+
+            // Real-time mode, the ring slots are handed over with a lock-free FIFO.
+            bool realtime = false;
+            std::unique_ptr<juce::AbstractFifo> fifo;
+            juce::HeapBlock<int> slotFrames; // access unit in each ring slot
+            std::atomic<int> requestedFrame { -1 }; // seek request for the decode-ahead job
+            int aheadFrame = 0; // next access unit of the decode-ahead job
+            int expectedFrame = 0; // next access unit readSamples() expects from the decode-ahead job
+            bool underrun = false;
+            int numUnderruns = 0;
+
+            MP4LevelPyramid::Ptr levelPyramid; // answers readMaxLevels() without decoding, or nullptr
+
+            // Level pyramid built while the stream is read, see buildLevelPyramid().
+            std::unique_ptr<MP4LevelPyramid::Builder> levelBuilder; // nullptr until a read from the start
+            juce::File sourceFile, levelSidecarFile; // default Files if the sidecar is not written
+
+            // Analysis taps, see analyse().
+            juce::Array<MP4AnalysisTap::Ptr> analysisTaps;
+            juce::int64 analysisPosition = 0; // next sample the taps expect
+
+            juce::HeapBlock<const float*> readChannels; // samples of a read for the taps and the level builder, see getSamplesFrom()
+
+            // Sample rate conversion, see readResampled().
+            std::unique_ptr<MP4Resampler> resampler; // nullptr reads at the decoded sample rate
+            double decodedSampleRate = 0;
+            juce::int64 numDecodedSamples = 0; // length at the decoded sample rate
+            juce::AudioBuffer<float> decodedBlock; // one access unit, not interleaved
+            juce::AudioBuffer<float> resampledBlock; // resampled samples not read yet
+            juce::HeapBlock<float*> resampledChannels; // destination channels when resampling straight into them
+            juce::int64 decodedPosition = 0; // next decoded sample for the resampler
+            juce::int64 resampledPosition = -1; // output sample of the next resampled sample, -1 seeks
+            int resampledOffset = 0;
+            int numResampled = 0;
 
             //=============================================================================
             public:
 
             MP4AudioFormatReader() = delete;
 
-            MP4AudioFormatReader (juce::InputStream* stream, bool usingNetwork)
-                : AudioFormatReader (stream, "MP4 file")
+            MP4AudioFormatReader (juce::InputStream* stream, MP4AudioIndex::Ptr sharedIndex, const MP4AudioReaderOptions& options)
+                : AudioFormatReader (stream, "MP4 file"), index (sharedIndex)
             {
-                HRESULT hr = (stream != nullptr) ? S_OK : E_INVALIDARG;
+                HRESULT hr = (stream != nullptr && index != nullptr) ? S_OK : E_INVALIDARG;
 
                 if (SUCCEEDED (hr)) hr = library.Initialize();
                 if (SUCCEEDED (hr)) hr = platform.Initialize();
+                if (SUCCEEDED (hr)) hr = decoder.Initialize (*index, options.getOutputNumChannels());
 
-                // Create source reader.
-                if (SUCCEEDED (hr))
-                {
-                    IMFAttributes* attributes = nullptr;
-                    IMFByteStream* byteStream = nullptr;
-
-                    hr = ::MFCreateAttributes (&attributes, 1);
-
-                    // Enables the source reader to use hardware-based Media Foundation transforms (MFTs).
-                    if (SUCCEEDED (hr)) hr = attributes->SetUINT32 (MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
-
-                    // Open all media formats supported by Media Foundation.
-                    if (SUCCEEDED (hr)) hr = ByteStreamFromInputStream (&byteStream, stream, nullptr, nullptr, usingNetwork);
-                    if (SUCCEEDED (hr)) hr = ::MFCreateSourceReaderFromByteStream (byteStream, attributes, &sourceReader);
-
-                    SafeRelease (&byteStream);
-                    SafeRelease (&attributes);
-                }
-
-                // Select audio stream.
-                if (SUCCEEDED (hr)) hr = sourceReader->SetStreamSelection ((DWORD) MF_SOURCE_READER_ALL_STREAMS, false);
-                if (SUCCEEDED (hr)) hr = sourceReader->SetStreamSelection (firstAudioStream, true);
-
-                // Set decoder output (pcm, 32 bits per sample)
-                if (SUCCEEDED (hr))
-                {
-                    IMFMediaType* pcmType = nullptr;
-
-                    hr = ::MFCreateMediaType (&pcmType);
-
-                    if (SUCCEEDED (hr)) hr = pcmType->SetGUID (MF_MT_MAJOR_TYPE, MFMediaType_Audio);
-                    if (SUCCEEDED (hr)) hr = pcmType->SetGUID (MF_MT_SUBTYPE, MFAudioFormat_PCM);
-                    if (SUCCEEDED (hr)) hr = pcmType->SetUINT32 (MF_MT_AUDIO_BITS_PER_SAMPLE, 32);
-                    if (SUCCEEDED (hr)) hr = sourceReader->SetCurrentMediaType (firstAudioStream, nullptr, pcmType);
-
-                    SafeRelease (&pcmType);
-                }
-
-                // Get audio attributes.
                 if (SUCCEEDED (hr))
                 {
-                    IMFMediaType* mediaType = nullptr;
-                    IMFAttributes* attributes = nullptr;
+                    sampleRate = decoder.GetSampleRate();
+                    numChannels = decoder.GetNumChannels();
+                    bitsPerSample = 32;
+                    usesFloatingPointData = true;
+                    metadataValues = index->getMetadataValues();
 
-                    hr = sourceReader->GetCurrentMediaType (firstAudioStream, &mediaType);
+                    // Implicitly signalled SBR doubles the decoded sample rate.
+                    const double ratio = sampleRate / index->getSampleRate();
 
-                    if (SUCCEEDED (hr)) hr = mediaType->QueryInterface (IID_IMFAttributes, (void**) &attributes);
+                    samplesPerFrame = juce::roundToInt (index->getSamplesPerFrame() * ratio);
+                    lengthInSamples = (juce::int64) ((double) index->getLengthInSamples() * ratio);
+                    prerollFrames = (samplesPerFrame > 1024) ? 2 : 1; // SBR needs a longer pre-roll
+                    frameCache = options.getFrameCache();
 
-                    // double sampleRate
-                    if (SUCCEEDED (hr))
+                    if (options.isRealtimeMode())
                     {
-                        UINT32 value;
-                        hr = attributes->GetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, &value);
-
-                        if (SUCCEEDED (hr)) sampleRate = (double) value;
+                        realtime = true;
+                        scheduler = (options.getScheduler() != nullptr) ? options.getScheduler() : &MP4DecodeScheduler::getInstance();
+                        priority = options.getPriority();
+                        numSlots = 1 + juce::jmax (1, options.getDecodeAhead()); // one FIFO slot stays free
+                        decodeAheadJob = std::make_unique<DecodeAheadJob> (*this);
+                        fifo = std::make_unique<juce::AbstractFifo> (numSlots);
+                        slotFrames.calloc ((size_t) numSlots);
                     }
-
-                    // unsigned int bitsPerSample
-                    if (SUCCEEDED (hr))
+                    else if (options.getScheduler() != nullptr && options.getDecodeAhead() > 0)
                     {
-                        UINT32 value;
-                        hr = attributes->GetUINT32 (MF_MT_AUDIO_BITS_PER_SAMPLE, &value);
+                        scheduler = options.getScheduler();
+                        priority = options.getPriority();
+                        numSlots = 1 + options.getDecodeAhead();
+                        decodeAheadJob = std::make_unique<DecodeAheadJob> (*this);
+                    }
 
-                        if (SUCCEEDED (hr)) bitsPerSample = (unsigned int) value;
+                    if (! realtime)
+                        reverseWindow = juce::jmax (0, options.getReverseWindow());
 
-                        jassert (bitsPerSample == 32);
-                    }
+                    numDecodedSamples = lengthInSamples;
+                    decodedSampleRate = sampleRate;
 
-                    // int64 lengthInSamples
-                    if (SUCCEEDED (hr))
+                    if (options.getOutputSampleRate() > 0 && options.getOutputSampleRate() != sampleRate && samplesPerFrame > 0)
                     {
-                        UINT64 value = 0;
-                        PROPVARIANT prop;
-                        PropVariantInit (&prop); // Macro
+                        resampler = std::make_unique<MP4Resampler> (decodedSampleRate, options.getOutputSampleRate(),
+                                                                    (int) numChannels, options.getResamplerQuality());
 
-                        hr = sourceReader->GetPresentationAttribute ((DWORD) MF_SOURCE_READER_MEDIASOURCE, MF_PD_DURATION, &prop);
+                        decodedBlock.setSize ((int) numChannels, samplesPerFrame);
+                        resampledBlock.setSize ((int) numChannels, resampler->getMaxNumOutputSamples (samplesPerFrame));
+                        resampledChannels.calloc (numChannels);
 
-                        if (SUCCEEDED (hr))
-                        {
-                            // Duration is in 100 ns time units.
-                            hr = ::PropVariantToUInt64 (prop, &value);
-                        }
-                        ::PropVariantClear (&prop);
-
-                        // length in seconds * sample rate
-                        if (SUCCEEDED (hr)) lengthInSamples = (juce::int64) ((double) value * 1e-7 * sampleRate);
+                        sampleRate = options.getOutputSampleRate();
+                        lengthInSamples = (juce::int64) ((double) numDecodedSamples * sampleRate / decodedSampleRate);
                     }
 
-                    // unsigned int numChannels
-                    if (SUCCEEDED (hr))
+                    // A pyramid of another stream or of other reader options would draw the wrong waveform.
+                    if (auto pyramid = options.getLevelPyramid())
                     {
-                        UINT32 value;
-                        hr = attributes->GetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, &value);
-
-                        if (SUCCEEDED (hr)) numChannels = (unsigned int) value;
+                        if (pyramid->getNumChannels() == numChannels && pyramid->getLengthInSamples() == lengthInSamples
+                            && pyramid->getSampleRate() == sampleRate)
+                            levelPyramid = pyramid;
                     }
 
-                    // bool usesFloatingPointData
-                    if (SUCCEEDED (hr))
+                    // Real-time reads may drop samples, the taps and the pyramid would measure the gaps.
+                    if (! realtime)
                     {
-                        usesFloatingPointData = false;
+                        readChannels.calloc (numChannels);
+                        analysisTaps = options.getAnalysisTaps();
+
+                        for (auto& tap : analysisTaps)
+                            tap->prepare (sampleRate, (int) numChannels);
                     }
 
-                    // StringPairArray metadataValues
-                    if (SUCCEEDED (hr))
+                    // Only a pyramid of the stream as it is can be shared with other readers of the file.
+                    auto* fileStream = dynamic_cast<juce::FileInputStream*> (stream);
+
+                    if (! realtime && levelPyramid == nullptr && fileStream != nullptr
+                        && options.getOutputNumChannels() == 0 && resampler == nullptr)
                     {
-                        // Not supported
+                        sourceFile = fileStream->getFile();
+                        levelSidecarFile = MP4AudioIndexCache::getInstance().getSidecarFileFor (sourceFile, ".molelvl");
                     }
 
-                    SafeRelease (&mediaType);
-                    SafeRelease (&attributes);
+                    numAheadSlots = numSlots;
+
+                    frameData.malloc ((size_t) index->getMaxFrameSize());
+                    frameSamples.calloc ((size_t) numSlots * (size_t) samplesPerFrame * numChannels);
                 }
 
-                if (FAILED (hr))
+                if (FAILED (hr) || samplesPerFrame <= 0 || numChannels == 0)
                 {
-                    DBGAPI(hr);
+                    if (FAILED (hr)) DBGAPI(hr);
 
-                    readResult = MF_SOURCE_READERF_ERROR;
+                    hasError = true;
 
                     sampleRate = 0;
                     bitsPerSample = 0;
                     lengthInSamples = 0;
                     numChannels = 0;
                     metadataValues.clear();
-
-                    SafeRelease (&mediaBuffer);
-                    SafeRelease (&sample);
-                    SafeRelease (&sourceReader);
+                }
+                else if (realtime)
+                {
+                    // Start decoding before the first read.
+                    requestedFrame = 0;
+                    scheduler->schedule (*decodeAheadJob, priority);
                 }
             }
 
             ~MP4AudioFormatReader() override
             {
-                SafeRelease (&mediaBuffer);
-                SafeRelease (&sample);
-                SafeRelease (&sourceReader);
+                if (decodeAheadJob != nullptr)
+                    scheduler->remove (*decodeAheadJob);
             }
 
             //=============================================================================
@@ -207,8 +272,224 @@ namespace mole {
             //=============================================================================
             bool readSamples (int* const* destChannels, int numDestChannels, int startOffsetInDestBuffer, juce::int64 startSampleInFile, int numSamples) override
             {
-                // All errors except end of stream.
-                if ((readResult & (~MF_SOURCE_READERF_ENDOFSTREAM)) & readError)
+                const bool ok = (resampler != nullptr)
+                    ? readResampled (destChannels, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples)
+                    : readDecoded (destChannels, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples);
+
+                if (ok && ! analysisTaps.isEmpty())
+                    analyse (destChannels, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples);
+
+                if (ok && ! realtime && levelPyramid == nullptr)
+                    buildLevelPyramid (destChannels, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples);
+
+                return ok;
+            }
+
+            /** Returns the levels of a range.
+             *
+             * Ranges of at least a block of the level pyramid are answered from
+             * the pyramid, in a few steps at any zoom level; shorter ranges, and
+             * all ranges until the pyramid is built, are decoded.
+             *
+             * In real-time mode only the pyramid answers, ranges shorter than a
+             * block included: decoding would read the ring of the audio thread
+             * and get underruns. Without a pyramid this asserts and returns empty
+             * ranges; draw waveforms with a reader without real-time mode.
+             */
+            void readMaxLevels (juce::int64 startSampleInFile, juce::int64 numSamples, juce::Range<float>* results, int numChannelsToRead) override
+            {
+                if (levelPyramid != nullptr && (numSamples >= levelPyramid->getSamplesPerBlock() || realtime))
+                {
+                    levelPyramid->readMaxLevels (startSampleInFile, numSamples, results, numChannelsToRead);
+                }
+                else if (realtime)
+                {
+                    jassertfalse; // real-time readers only read on the audio thread, see MP4RealtimeReader
+
+                    for (int ch = 0; ch < numChannelsToRead; ++ch)
+                        results[ch] = juce::Range<float>();
+                }
+                else
+                {
+                    juce::AudioFormatReader::readMaxLevels (startSampleInFile, numSamples, results, numChannelsToRead);
+                }
+            }
+
+            /** Returns the level pyramid of the options, or the one built by reading the whole stream, or nullptr. */
+            MP4LevelPyramid::Ptr getLevelPyramid() const noexcept
+            {
+                return levelPyramid;
+            }
+
+            //=============================================================================
+            bool hasUnderrun() const noexcept override
+            {
+                return underrun;
+            }
+
+            int getNumUnderruns() const noexcept override
+            {
+                return numUnderruns;
+            }
+
+            bool isReady (juce::int64 startSampleInFile, int numSamples) const noexcept override
+            {
+                if (! realtime)
+                    return true;
+
+                juce::int64 start = startSampleInFile;
+                juce::int64 end = startSampleInFile + juce::jmax (1, numSamples);
+
+                if (resampler != nullptr)
+                {
+                    // The resampler continues after the samples it was given, or seeks and reads back by its latency.
+                    start = (startSampleInFile == resampledPosition) ? decodedPosition
+                                                                     : juce::jmax ((juce::int64) 0, toDecodedPosition (startSampleInFile) - resampler->getLatency());
+                    end = juce::jmin (numDecodedSamples, toDecodedPosition (end) + resampler->getLatency() + 1);
+
+                    if (end <= start)
+                        return true;
+                }
+
+                const int first = (int) (start / samplesPerFrame);
+                const int last = (int) ((end - 1) / samplesPerFrame);
+
+                int start1, size1, start2, size2;
+                fifo->prepareToRead (fifo->getNumReady(), start1, size1, start2, size2);
+
+                // Ready slots hold consecutive access units, unless a seek is pending.
+                for (int i = 0; i < size1 + size2; ++i)
+                {
+                    if (slotFrames[(i < size1) ? start1 + i : start2 + i - size1] == first)
+                        return first + (size1 + size2 - i) > last;
+                }
+
+                return false;
+            }
+
+            void prepareToRead (juce::int64 startSampleInFile) noexcept override
+            {
+                if (! realtime)
+                    return;
+
+                const juce::int64 latency = (resampler != nullptr) ? resampler->getLatency() : 0;
+                const int frame = (int) (juce::jmax ((juce::int64) 0, toDecodedPosition (startSampleInFile) - latency) / samplesPerFrame);
+
+                requestedFrame = frame;
+                expectedFrame = frame;
+                scheduler->scheduleFromAudioThread (*decodeAheadJob, priority);
+            }
+
+            //=============================================================================
+            private:
+
+            /** Points readChannels at the samples of a read from a position on.
+             *
+             * @return Number of samples from the position to the end of the read,
+             *         0 if the read does not include the position or leaves out a channel.
+             */
+            int getSamplesFrom (juce::int64 position, int* const* destChannels, int numDestChannels, int startOffsetInDestBuffer,
+                                juce::int64 startSampleInFile, int numSamples) noexcept
+            {
+                const juce::int64 end = juce::jmin (lengthInSamples, startSampleInFile + numSamples);
+
+                if (position < startSampleInFile || position >= end || numDestChannels < (int) numChannels)
+                    return 0;
+
+                const int offset = startOffsetInDestBuffer + (int) (position - startSampleInFile);
+
+                for (unsigned int ch = 0; ch < numChannels; ++ch)
+                {
+                    if (destChannels[ch] == nullptr)
+                        return 0;
+
+                    readChannels[ch] = reinterpret_cast<const float*> (destChannels[ch]) + offset;
+                }
+
+                return (int) (end - position);
+            }
+
+            /** Passes the samples of a read to the analysis taps.
+             *
+             * The taps see each sample once, in stream order: a read that overlaps
+             * the samples already analysed passes only the new ones, a read that
+             * skips ahead or leaves out a channel passes none. Reading from start
+             * to end, in any block size, analyses the whole stream and finishes
+             * the taps with the last sample.
+             */
+            void analyse (int* const* destChannels, int numDestChannels, int startOffsetInDestBuffer, juce::int64 startSampleInFile, int numSamples)
+            {
+                const int numNew = getSamplesFrom (analysisPosition, destChannels, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples);
+
+                if (numNew <= 0)
+                    return;
+
+                for (auto& tap : analysisTaps)
+                    tap->process (readChannels, numNew);
+
+                analysisPosition += numNew;
+
+                if (analysisPosition == lengthInSamples)
+                {
+                    for (auto& tap : analysisTaps)
+                        tap->finish();
+                }
+            }
+
+            /** Passes the samples of a read to the level pyramid builder.
+             *
+             * A read from the start of the stream starts the builder, reads that
+             * continue it add their new samples like for the analysis taps, and a
+             * read that skips ahead drops it until the next read from the start.
+             * With the last sample, the pyramid answers readMaxLevels() and, for
+             * file streams read as they are, is written to the level sidecar in
+             * the sidecar directory of MP4AudioIndexCache, on the reading thread.
+             */
+            void buildLevelPyramid (int* const* destChannels, int numDestChannels, int startOffsetInDestBuffer, juce::int64 startSampleInFile, int numSamples)
+            {
+                if (levelBuilder == nullptr && startSampleInFile == 0)
+                    levelBuilder = std::make_unique<MP4LevelPyramid::Builder> (sampleRate, numChannels, lengthInSamples);
+
+                if (levelBuilder == nullptr)
+                    return;
+
+                if (startSampleInFile > levelBuilder->getNumSamples())
+                {
+                    levelBuilder.reset();
+                    return;
+                }
+
+                const int numNew = getSamplesFrom (levelBuilder->getNumSamples(), destChannels, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples);
+
+                if (numNew <= 0)
+                    return;
+
+                levelBuilder->addSamples (readChannels, numNew);
+
+                if (levelBuilder->getNumSamples() < lengthInSamples)
+                    return;
+
+                levelPyramid = levelBuilder->finish();
+                levelBuilder.reset();
+
+                if (levelPyramid != nullptr && levelSidecarFile != juce::File())
+                {
+                    levelSidecarFile.getParentDirectory().createDirectory();
+
+                    if (! levelPyramid->writeSidecar (levelSidecarFile, sourceFile))
+                        DBGSTR("Writing level sidecar failed.");
+                }
+            }
+
+            /** Reads at the decoded sample rate.  */
+            bool readDecoded (int* const* destChannels, int numDestChannels, int startOffsetInDestBuffer, juce::int64 startSampleInFile, int numSamples)
+            {
+                if (realtime)
+                    return readSamplesRealtime (destChannels, numDestChannels, startOffsetInDestBuffer, startSampleInFile, numSamples);
+
+                const juce::ScopedLock sl (decodeLock);
+
+                if (hasError)
                 {
                     // Clear all samples.
                     juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
@@ -220,135 +501,465 @@ namespace mole {
                 // Clear samples beyond available length.
                 juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
                         destChannels, numDestChannels, startOffsetInDestBuffer,
-                        startSampleInFile, numSamples, lengthInSamples);
+                        startSampleInFile, numSamples, numDecodedSamples);
 
-                if (numSamples <= 0)
+                updateDirection (startSampleInFile);
+
+                const int lastFrame = (int) ((startSampleInFile + juce::jmax (1, numSamples) - 1) / samplesPerFrame);
+
+                if (reverse)
+                    prepareReverse ((int) (startSampleInFile / samplesPerFrame), lastFrame);
+
+                while (numSamples > 0)
                 {
-                    return true;
-                }
+                    const int frame = (int) (startSampleInFile / samplesPerFrame);
+                    const int offset = (int) (startSampleInFile % samplesPerFrame);
+                    const float* samples = getFrame (frame);
 
-                HRESULT hr = S_OK;
+                    if (samples == nullptr)
+                    {
+                        // Clear all remaining samples.
+                        juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
+                                destChannels, numDestChannels, startOffsetInDestBuffer, 0, numSamples, 0);
+
+                        return false;
+                    }
+
+                    const int readNumSamples = juce::jmin (numSamples, samplesPerFrame - offset);
+
+                    juce::AudioFormatReader::ReadHelper
+                        <juce::AudioData::Float32, juce::AudioData::Float32, juce::AudioData::LittleEndian>
+                        ::read (destChannels, startOffsetInDestBuffer, numDestChannels,
+                                samples + (size_t) offset * numChannels, numChannels, readNumSamples);
+
+                    numSamples -= readNumSamples;
+                    startOffsetInDestBuffer += readNumSamples;
+                    startSampleInFile += readNumSamples;
+                }
 
-                if (currentSampleInFile != startSampleInFile)
+                if (reverse)
                 {
-                    // Position in 100 ns time units.
-                    juce::int64 newPosition = (juce::int64) ((double) startSampleInFile * 1e+7 / sampleRate);
+                    // Access units after the read position are not needed anymore, keep one for overlapping reads.
+                    numFrames = juce::jlimit (0, numFrames, lastFrame + 2 - firstFrame);
 
-                    PROPVARIANT prop;
-                    ::InitPropVariantFromInt64 (newPosition, &prop);
+                    if (decodeAheadJob != nullptr && firstFrame > 0 && numFrames > 0)
+                        scheduler->schedule (*decodeAheadJob, priority);
+                }
+                else if (decodeAheadJob != nullptr && numFrames < numAheadSlots)
+                {
+                    scheduler->schedule (*decodeAheadJob, priority);
+                }
 
-                    hr = sourceReader->SetCurrentPosition (GUID_NULL, prop);
-                    ::PropVariantClear (&prop);
+                return true;
+            }
 
-                    bufferOffset = 0;
-                    bufferNumSamples = 0;
+            /** Reads at the output sample rate.
+             *
+             * Each decoded access unit is resampled once, straight into the
+             * destination when it has room for all resampled samples. Samples
+             * resampled beyond the read are kept for the next read, a read at
+             * another position seeks the resampler; the output is the same as
+             * reading continuously.
+             */
+            bool readResampled (int* const* destChannels, int numDestChannels, int startOffsetInDestBuffer, juce::int64 startSampleInFile, int numSamples)
+            {
+                // Clear samples beyond available length.
+                juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
+                        destChannels, numDestChannels, startOffsetInDestBuffer,
+                        startSampleInFile, numSamples, lengthInSamples);
 
-                    if (SUCCEEDED (hr)) currentSampleInFile = startSampleInFile;
+                if (startSampleInFile != resampledPosition)
+                {
+                    decodedPosition = resampler->seek (startSampleInFile);
+                    resampledPosition = startSampleInFile;
+                    numResampled = 0;
                 }
-                else if (bufferNumSamples > 0)
+
+                while (numSamples > 0)
                 {
-                    const int readNumSamples = juce::jmin (numSamples, bufferNumSamples);
+                    if (numResampled > 0)
+                    {
+                        const int numToCopy = juce::jmin (numSamples, numResampled);
+
+                        for (int ch = 0; ch < numDestChannels; ++ch)
+                        {
+                            if (destChannels[ch] == nullptr)
+                                continue;
+
+                            float* dest = reinterpret_cast<float*> (destChannels[ch]) + startOffsetInDestBuffer;
+
+                            if (ch < (int) numChannels)
+                                juce::FloatVectorOperations::copy (dest, resampledBlock.getReadPointer (ch, resampledOffset), numToCopy);
+                            else
+                                juce::FloatVectorOperations::clear (dest, numToCopy);
+                        }
+
+                        resampledOffset += numToCopy;
+                        numResampled -= numToCopy;
+                        resampledPosition += numToCopy;
+                        numSamples -= numToCopy;
+                        startOffsetInDestBuffer += numToCopy;
+                        continue;
+                    }
+
+                    // The rest of the access unit at the decoded position, silent beyond the end.
+                    const int numToDecode = samplesPerFrame - (int) (decodedPosition % samplesPerFrame);
+
+                    if (! readDecoded (reinterpret_cast<int* const*> (decodedBlock.getArrayOfWritePointers()), (int) numChannels,
+                                       0, decodedPosition, numToDecode))
+                    {
+                        // The resampler missed samples, seek on the next read.
+                        resampledPosition = -1;
+
+                        juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
+                                destChannels, numDestChannels, startOffsetInDestBuffer, 0, numSamples, 0);
+
+                        return false;
+                    }
 
-                    BYTE* data = nullptr;
-                    DWORD dataSize = 0;
+                    decodedPosition += numToDecode;
 
-                    hr = mediaBuffer->Lock (&data, nullptr, &dataSize);
+                    // Skip the copy if the destination has room for every sample the access unit may give.
+                    bool isDirect = numSamples >= resampler->getMaxNumOutputSamples (numToDecode) && numDestChannels >= (int) numChannels;
 
-                    if (SUCCEEDED (hr))
+                    for (int ch = 0; ch < (int) numChannels && isDirect; ++ch)
                     {
-                        juce::AudioFormatReader::ReadHelper
-                            <juce::AudioData::Int32, juce::AudioData::Int32, juce::AudioData::LittleEndian>
-                            ::read (destChannels, startOffsetInDestBuffer, numDestChannels,
-                                    data + bufferOffset, numChannels, readNumSamples);
+                        isDirect = destChannels[ch] != nullptr;
+                        resampledChannels[ch] = isDirect ? reinterpret_cast<float*> (destChannels[ch]) + startOffsetInDestBuffer : nullptr;
+                    }
 
-                        hr = mediaBuffer->Unlock();
+                    if (isDirect)
+                    {
+                        const int numDone = resampler->process (decodedBlock.getArrayOfReadPointers(), numToDecode, resampledChannels);
 
-                        if (SUCCEEDED (hr))
+                        for (int ch = (int) numChannels; ch < numDestChannels; ++ch)
                         {
-                            numSamples -= readNumSamples;
-                            bufferNumSamples -= readNumSamples;
-                            bufferOffset += readNumSamples * numChannels * bytesPerSample; // offset in bytes
-                            startOffsetInDestBuffer += readNumSamples;
-                            currentSampleInFile += readNumSamples;
+                            if (destChannels[ch] != nullptr)
+                                juce::FloatVectorOperations::clear (reinterpret_cast<float*> (destChannels[ch]) + startOffsetInDestBuffer, numDone);
                         }
+
+                        resampledPosition += numDone;
+                        numSamples -= numDone;
+                        startOffsetInDestBuffer += numDone;
+                    }
+                    else
+                    {
+                        numResampled = resampler->process (decodedBlock.getArrayOfReadPointers(), numToDecode, resampledBlock.getArrayOfWritePointers());
+                        resampledOffset = 0;
                     }
                 }
 
-                if (FAILED (hr))
-                {
-                    DBGAPI(hr);
+                return true;
+            }
 
+            /** Converts a position at the output sample rate to the decoded sample rate.  */
+            juce::int64 toDecodedPosition (juce::int64 position) const noexcept
+            {
+                return (resampler != nullptr) ? (juce::int64) ((double) position * decodedSampleRate / sampleRate) : position;
+            }
+
+            /** Copies decoded samples from the lock-free ring, never blocks.  */
+            bool readSamplesRealtime (int* const* destChannels, int numDestChannels, int startOffsetInDestBuffer, juce::int64 startSampleInFile, int numSamples) noexcept
+            {
+                if (hasError)
+                {
                     // Clear all samples.
                     juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
                             destChannels, numDestChannels, startOffsetInDestBuffer, 0, numSamples, 0);
 
-                    readResult = MF_SOURCE_READERF_ERROR;
                     return false;
                 }
 
+                // Clear samples beyond available length.
+                juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
+                        destChannels, numDestChannels, startOffsetInDestBuffer,
+                        startSampleInFile, numSamples, numDecodedSamples);
+
                 while (numSamples > 0)
                 {
-                    SafeRelease (&sample);
-                    SafeRelease (&mediaBuffer);
+                    const int frame = (int) (startSampleInFile / samplesPerFrame);
+                    const int offset = (int) (startSampleInFile % samplesPerFrame);
+                    const float* samples = nullptr;
+                    int slot = 0;
 
-                    hr = sourceReader->ReadSample (firstAudioStream, 0, nullptr, &readResult, nullptr, &sample);
+                    // Drop access units before the read position, or all of them after a seek.
+                    while (fifo->getNumReady() > 0)
+                    {
+                        int size1, start2, size2;
+                        fifo->prepareToRead (1, slot, size1, start2, size2);
 
-                    if (FAILED (hr))
-                        break;
+                        if (slotFrames[slot] == frame)
+                        {
+                            samples = frameSamples + (size_t) slot * (size_t) samplesPerFrame * numChannels;
+                            break;
+                        }
+
+                        fifo->finishedRead (1);
+                    }
+
+                    if (samples == nullptr)
+                    {
+                        // Seek unless the decode-ahead job is on its way to the access unit.
+                        if (frame < expectedFrame || frame >= expectedFrame + numSlots)
+                        {
+                            requestedFrame = frame;
+                            expectedFrame = frame;
+                        }
 
-                    // Returns true on first error.
-                    if (readResult & readError)
                         break;
+                    }
 
-                    if (sample == nullptr)
-                        continue;
+                    const int readNumSamples = juce::jmin (numSamples, samplesPerFrame - offset);
+
+                    juce::AudioFormatReader::ReadHelper
+                        <juce::AudioData::Float32, juce::AudioData::Float32, juce::AudioData::LittleEndian>
+                        ::read (destChannels, startOffsetInDestBuffer, numDestChannels,
+                                samples + (size_t) offset * numChannels, numChannels, readNumSamples);
+
+                    if (offset + readNumSamples == samplesPerFrame)
+                        fifo->finishedRead (1);
+
+                    expectedFrame = frame + 1;
+                    numSamples -= readNumSamples;
+                    startOffsetInDestBuffer += readNumSamples;
+                    startSampleInFile += readNumSamples;
+                }
+
+                scheduler->scheduleFromAudioThread (*decodeAheadJob, priority);
+
+                underrun = numSamples > 0;
+
+                if (underrun)
+                {
+                    ++numUnderruns;
+
+                    juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
+                            destChannels, numDestChannels, startOffsetInDestBuffer, 0, numSamples, 0);
+
+                    return false;
+                }
 
-                    hr = sample->ConvertToContiguousBuffer (&mediaBuffer);
+                return true;
+            }
 
-                    BYTE* data = nullptr;
-                    DWORD dataSize = 0;
+            /** Decodes the next access unit into the lock-free ring, called by the decode-ahead job.  */
+            bool decodeAheadRealtime()
+            {
+                const int request = requestedFrame.exchange (-1);
 
-                    if (SUCCEEDED (hr)) hr = mediaBuffer->Lock (&data, nullptr, &dataSize);
+                if (request >= 0)
+                    aheadFrame = request;
+
+                if (hasError || fifo->getFreeSpace() == 0 || aheadFrame >= index->getNumFrames())
+                    return requestedFrame.load() >= 0;
+
+                int slot, size1, start2, size2;
+                fifo->prepareToWrite (1, slot, size1, start2, size2);
+
+                if (! decodeFrame (aheadFrame, frameSamples + (size_t) slot * (size_t) samplesPerFrame * numChannels))
+                    return false;
+
+                slotFrames[slot] = aheadFrame++;
+                fifo->finishedWrite (1);
+
+                return fifo->getFreeSpace() > 0 || requestedFrame.load() >= 0;
+            }
+
+            /** Returns the ring slot of an access unit.  */
+            float* getSlot (int frame) const noexcept
+            {
+                return frameSamples + (size_t) (frame % numSlots) * (size_t) samplesPerFrame * numChannels;
+            }
 
-                    if (SUCCEEDED (hr))
+            /** Returns a decoded access unit from the ring, decodes it on a miss.  */
+            const float* getFrame (int frame)
+            {
+                if (frame >= firstFrame && frame < firstFrame + numFrames)
+                {
+                    // Access units before the read position are not needed anymore, unless reading backward.
+                    if (! reverse)
                     {
-                        bufferOffset = 0;
-                        bufferNumSamples = dataSize / (numChannels * bytesPerSample);
+                        numFrames -= frame - firstFrame;
+                        firstFrame = frame;
+                    }
+
+                    return getSlot (frame);
+                }
 
-                        const int readNumSamples = juce::jmin (numSamples, bufferNumSamples);
+                firstFrame = frame;
+                numFrames = 0;
+                behindNumFrames = 0;
 
-                        juce::AudioFormatReader::ReadHelper
-                            <juce::AudioData::Int32, juce::AudioData::Int32, juce::AudioData::LittleEndian>
-                            ::read (destChannels, startOffsetInDestBuffer, numDestChannels,
-                                    data, numChannels, readNumSamples);
+                if (! decodeFrame (frame, getSlot (frame)))
+                    return nullptr;
 
-                        hr = mediaBuffer->Unlock();
+                numFrames = 1;
+                return getSlot (frame);
+            }
 
-                        if (SUCCEEDED (hr))
-                        {
-                            numSamples -= readNumSamples;
-                            bufferNumSamples -= readNumSamples;
-                            bufferOffset += readNumSamples * numChannels * bytesPerSample; // offset in bytes
-                            startOffsetInDestBuffer += readNumSamples;
-                            currentSampleInFile += readNumSamples;
-                        }
+            /** Decodes the next access unit after the ring, called by the decode-ahead job.  */
+            bool decodeAhead()
+            {
+                const juce::ScopedLock sl (decodeLock);
+
+                if (reverse)
+                    return decodeBehind();
+
+                const int frame = firstFrame + numFrames;
+
+                if (hasError || numFrames == 0 || numFrames >= numAheadSlots || frame >= index->getNumFrames())
+                    return false;
+
+                if (! decodeFrame (frame, getSlot (frame)))
+                    return false;
+
+                ++numFrames;
+                return numFrames < numAheadSlots;
+            }
+
+            //=============================================================================
+            /** Detects backward reads, two in a row switch to windowed decoding and a forward read switches back.  */
+            void updateDirection (juce::int64 startSampleInFile)
+            {
+                if (reverseWindow <= 0)
+                    return;
+
+                const juce::int64 step = lastReadStart - startSampleInFile;
+                lastReadStart = startSampleInFile;
+
+                // A jump further back than a window is a seek, e.g. the start of a loop.
+                if (step > 0 && step <= (juce::int64) reverseWindow * samplesPerFrame)
+                    reverseCount = juce::jmin (reverseCount + 1, 2);
+                else if (step != 0)
+                    reverseCount = 0;
+
+                if (reverse == (reverseCount >= 2))
+                    return;
+
+                reverse = ! reverse;
+                behindNumFrames = 0;
+
+                // The ring holds the window being read and the window before it.
+                if (reverse && numSlots < 2 * reverseWindow + 2)
+                {
+                    numSlots = 2 * reverseWindow + 2;
+                    frameSamples.malloc ((size_t) numSlots * (size_t) samplesPerFrame * numChannels);
+                    numFrames = 0;
+                }
+            }
+
+            /** Makes sure the ring holds the access units of a backward read.  */
+            void prepareReverse (int first, int last)
+            {
+                last = juce::jmin (last, index->getNumFrames() - 1);
+
+                // Reads longer than a window decode forward.
+                if (hasError || first > last || last - first >= reverseWindow)
+                    return;
+
+                if (first >= firstFrame && last < firstFrame + numFrames)
+                    return;
+
+                // Step back a whole window, or finish the one decoded ahead.
+                if (numFrames > 0 && first < firstFrame && first >= firstFrame - reverseWindow && last < firstFrame + numFrames)
+                {
+                    while (decodeBehind()) {}
+
+                    if (first >= firstFrame)
+                        return;
+                }
+
+                // Decode a window that ends with the read.
+                firstFrame = juce::jmax (0, last - reverseWindow + 1);
+                numFrames = 0;
+                behindNumFrames = 0;
+
+                for (int frame = firstFrame; frame <= last; ++frame)
+                {
+                    if (! decodeFrame (frame, getSlot (frame)))
+                    {
+                        numFrames = 0;
+                        return;
                     }
+
+                    ++numFrames;
                 }
+            }
 
-                // Clear samples beyond available length.
-                juce::AudioFormatReader::clearSamplesBeyondAvailableLength (
-                        destChannels, numDestChannels, startOffsetInDestBuffer,
-                        startSampleInFile, numSamples, currentSampleInFile);
+            /** Decodes the next access unit of the window before the ring, merges the window into the ring when it is complete.  */
+            bool decodeBehind()
+            {
+                const int first = juce::jmax (0, firstFrame - reverseWindow);
+
+                if (hasError || numFrames == 0 || firstFrame == 0 || (firstFrame - first) + numFrames > numSlots)
+                    return false;
+
+                const int frame = first + behindNumFrames;
+
+                if (! decodeFrame (frame, getSlot (frame)))
+                    return false;
+
+                if (++behindNumFrames < firstFrame - first)
+                    return true;
+
+                numFrames += behindNumFrames;
+                firstFrame = first;
+                behindNumFrames = 0;
+                return false;
+            }
+
+            /** Decodes an access unit, with pre-roll after a seek.  */
+            bool decodeFrame (int frame, float* samples)
+            {
+                if (frame < 0 || frame >= index->getNumFrames())
+                    return false;
+
+                // A cache hit leaves the decoder where it is, the next miss seeks if needed.
+                if (frameCache != nullptr && frameCache->read (index, frame, (int) numChannels, samplesPerFrame, samples))
+                    return true;
+
+                HRESULT hr = S_OK;
+
+                if (frame != nextFrame)
+                {
+                    hr = decoder.Flush();
+                    nextFrame = juce::jmax (0, frame - prerollFrames);
+                }
+
+                int numDecoded = 0;
+
+                while (SUCCEEDED (hr) && nextFrame <= frame)
+                {
+                    const int size = index->getFrameSize (nextFrame);
+
+                    if (! input->setPosition (index->getFrameOffset (nextFrame)) || input->read (frameData, size) != size)
+                        hr = E_FAIL;
+
+                    if (SUCCEEDED (hr)) hr = decoder.Decode (frameData, size, samples, samplesPerFrame, &numDecoded);
+                    if (SUCCEEDED (hr)) ++nextFrame;
+                }
 
                 if (FAILED (hr))
                 {
                     DBGAPI(hr);
-                    readResult = MF_SOURCE_READERF_ERROR;
+
+                    hasError = true;
+                    nextFrame = -1;
                     return false;
                 }
 
+                // Decoder delay or a damaged access unit, pad with silence.
+                if (numDecoded < samplesPerFrame)
+                    juce::FloatVectorOperations::clear (samples + (size_t) numDecoded * numChannels,
+                            (int) ((size_t) (samplesPerFrame - numDecoded) * numChannels));
+
+                if (frameCache != nullptr)
+                    frameCache->add (index, frame, (int) numChannels, samplesPerFrame, samples);
+
                 return true;
             }
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4AudioFormatReader)
         };
     } // namespace WindowsMediaFoundation
 
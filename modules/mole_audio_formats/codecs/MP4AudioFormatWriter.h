@@ -12,12 +12,261 @@ namespace mole {
 
         using namespace Windows;
 
+        //=============================================================================
+        /** TPDF dither for rounding to 16 bits.
+         *
+         * Adds the sum of two random values of up to half a 16-bit step each
+         * before rounding, which makes the rounding error noise independent of
+         * the signal. The samples are processed in blocks: the noise of a block
+         * is generated into a contiguous float array by four random generators
+         * side by side, the samples are scaled, added and rounded there, and
+         * only the finished 16-bit values are copied to the interleaved
+         * destination. Each of these loops is a plain loop over contiguous
+         * arrays that the compiler vectorizes.
+         */
+        class Dither final
+        {
+            static constexpr int numLanes = 4;
+            static constexpr int blockSize = 256; // samples rounded at once, a multiple of numLanes
+
+            juce::uint32 state[numLanes] = { 0x9e3779b9u, 0x7f4a7c15u, 0x85ebca6bu, 0xc2b2ae35u };
+
+            float values[blockSize];
+            juce::int16 quantized[blockSize];
+
+            //=============================================================================
+            public:
+
+            /** Rounds the samples of one channel to 16 bits.
+             *
+             * @param source Samples, int (full 32-bit range) or float (-1 to 1).
+             * @param dest First 16-bit sample of the channel.
+             * @param destStride Distance between 16-bit samples (number of interleaved channels).
+             * @param numSamples Number of samples.
+             */
+            template <typename SampleType>
+            void Process (const SampleType* source, juce::int16* dest, int destStride, int numSamples) noexcept
+            {
+                // 16-bit steps per input unit, the scales of juce::AudioData.
+                const float scale = std::is_floating_point<SampleType>::value ? 32767.0f : 1.0f / 65536.0f;
+
+                for (int done = 0; done < numSamples;)
+                {
+                    const int n = juce::jmin (blockSize, numSamples - done);
+
+                    GenerateNoise (n);
+
+                    for (int i = 0; i < n; ++i)
+                        values[i] += (float) source[done + i] * scale;
+
+                    juce::FloatVectorOperations::clip (values, values, -32768.0f, 32767.0f, n);
+
+                    // Rounds half up: the offset makes the values positive, where truncation is floor.
+                    for (int i = 0; i < n; ++i)
+                        quantized[i] = (juce::int16) ((juce::int32) (values[i] + 32768.5f) - 32768);
+
+                    juce::int16* d = dest + (size_t) done * (size_t) destStride;
+
+                    for (int i = 0; i < n; ++i)
+                        d[i * destStride] = quantized[i];
+
+                    done += n;
+                }
+            }
+
+            //=============================================================================
+            private:
+
+            /** Fills the values with triangular noise between -1 and 1 16-bit steps, in whole groups of lanes.  */
+            void GenerateNoise (int numSamples) noexcept
+            {
+                constexpr float toHalfStep = 1.0f / 4294967296.0f; // 32-bit range to -0.5 to 0.5
+
+                for (int i = 0; i < numSamples; i += numLanes)
+                {
+                    for (int lane = 0; lane < numLanes; ++lane)
+                    {
+                        const juce::uint32 r1 = state[lane] * 1664525u + 1013904223u;
+                        const juce::uint32 r2 = r1 * 1664525u + 1013904223u;
+
+                        state[lane] = r2;
+                        values[i + lane] = ((float) (juce::int32) r1 + (float) (juce::int32) r2) * toHalfStep;
+                    }
+                }
+            }
+        };
+
+        //=============================================================================
+        /** Sample rate conversion in front of the encoder.
+         *
+         * Converts the channels writers take to float, resamples them in blocks
+         * and passes the float output on. The buffers are allocated once.
+         */
+        class ResamplingStage final
+        {
+            static constexpr int blockSize = 1024;
+
+            MP4Resampler resampler;
+            juce::AudioBuffer<float> input;
+            juce::AudioBuffer<float> output;
+
+            //=============================================================================
+            public:
+
+            ResamplingStage (double inputSampleRate, double outputSampleRate, int numChannels, MP4Resampler::Quality quality)
+                : resampler (inputSampleRate, outputSampleRate, numChannels, quality),
+                  input (numChannels, blockSize),
+                  output (numChannels, resampler.getMaxNumOutputSamples (juce::jmax (blockSize, resampler.getLatency())))
+            {
+            }
+
+            /** Resamples the channels writers take.
+             *
+             * @param samplesToWrite Channels of 32-bit integer or float samples, null terminated.
+             * @param numSamples Number of samples per channel.
+             * @param isFloatingPoint True if the channels hold float samples.
+             * @param writeOutput Called with float channels (as const int**) and their number of samples.
+             */
+            template <typename WriteFunction>
+            HRESULT Process (const int** samplesToWrite, int numSamples, bool isFloatingPoint, WriteFunction&& writeOutput)
+            {
+                HRESULT hr = S_OK;
+
+                for (int done = 0; done < numSamples && SUCCEEDED (hr);)
+                {
+                    const int numToDo = juce::jmin (blockSize, numSamples - done);
+                    bool isSilent = false; // channels after a null one are silent
+
+                    for (int ch = 0; ch < input.getNumChannels(); ++ch)
+                    {
+                        isSilent = isSilent || samplesToWrite[ch] == nullptr;
+
+                        if (isSilent)
+                            input.clear (ch, 0, numToDo);
+                        else if (isFloatingPoint)
+                            input.copyFrom (ch, 0, reinterpret_cast<const float*> (samplesToWrite[ch]) + done, numToDo);
+                        else
+                            juce::FloatVectorOperations::convertFixedToFloat (input.getWritePointer (ch),
+                                    samplesToWrite[ch] + done, 1.0f / (float) 0x7fffffff, numToDo);
+                    }
+
+                    const int numOutput = resampler.process (input.getArrayOfReadPointers(), numToDo, output.getArrayOfWritePointers());
+
+                    if (numOutput > 0)
+                        hr = writeOutput ((const int**) output.getArrayOfReadPointers(), numOutput);
+
+                    done += numToDo;
+                }
+
+                return hr;
+            }
+
+            /** Passes the samples still in the filter on, at the end of the input.  */
+            template <typename WriteFunction>
+            HRESULT Drain (WriteFunction&& writeOutput)
+            {
+                const int numOutput = resampler.flush (output.getArrayOfWritePointers());
+
+                return (numOutput > 0) ? writeOutput ((const int**) output.getArrayOfReadPointers(), numOutput) : S_OK;
+            }
+
+            /** Returns the throughput of the sample rate conversion.  */
+            MP4Resampler::Statistics GetStatistics() const noexcept
+            {
+                return resampler.getStatistics();
+            }
+
+            JUCE_DECLARE_NON_COPYABLE (ResamplingStage)
+        };
+
+        //=============================================================================
+        /** Completes MP4 files on a background thread, after their writer is gone.
+         *
+         * Takes over the sink writers, output streams and sample pool of a
+         * writer. Finalize() rewrites the index of the file, which takes a while
+         * for long recordings.
+         */
+        class AsyncFinalizer final
+        {
+            MFPlatform platform; // keeps Media Foundation started until the files are complete
+
+            std::vector<IMFSinkWriter*> sinkWriters;
+            juce::OwnedArray<juce::OutputStream> streams;
+            SamplePool* samplePool = nullptr;
+            std::function<void (bool)> onFinished;
+
+            //=============================================================================
+            public:
+
+            explicit AsyncFinalizer (std::function<void (bool)> callback)
+                : onFinished (std::move (callback))
+            {
+                platform.Initialize();
+            }
+
+            /** Takes the reference of a sink writer.  */
+            void AddSinkWriter (IMFSinkWriter* sinkWriter) { sinkWriters.push_back (sinkWriter); }
+
+            /** Takes ownership of an output stream, deleted after the sink writers.  */
+            void AddStream (juce::OutputStream* stream) { streams.add (stream); }
+
+            /** Takes the reference of a sample pool.  */
+            void SetSamplePool (SamplePool* pool) { samplePool = pool; }
+
+            /** Completes the files on a new thread, then deletes the finalizer.  */
+            static void Start (std::unique_ptr<AsyncFinalizer> finalizer)
+            {
+                auto* f = finalizer.release();
+
+                if (! juce::Thread::launch ([f] { f->Run(); delete f; }))
+                {
+                    // No thread, complete the files here.
+                    f->Run();
+                    delete f;
+                }
+            }
+
+            //=============================================================================
+            private:
+
+            void Run()
+            {
+                COMLibrary library;
+                HRESULT hr = library.InitializeMTA();
+
+                for (auto*& sinkWriter : sinkWriters)
+                {
+                    const HRESULT result = (sinkWriter != nullptr) ? sinkWriter->Finalize() : E_UNEXPECTED;
+
+                    if (FAILED (result))
+                    {
+                        DBGAPI(result);
+                        hr = result;
+                    }
+
+                    SafeRelease (&sinkWriter);
+                }
+
+                if (samplePool)
+                    samplePool->Shutdown();
+
+                SafeRelease (&samplePool);
+
+                streams.clear(); // flushes and closes the files
+
+                if (onFinished)
+                    onFinished (SUCCEEDED (hr));
+            }
+
+            JUCE_DECLARE_NON_COPYABLE (AsyncFinalizer)
+        };
+
         //=============================================================================
         /** Writes AAC audio to MP4 file format.
          *
          * Requirements for audio format writer options:
-         * - sample rate: 44100 or 48000 Hz
-         * - bits per sample: 16
+         * - sample rate: 44100 or 48000 Hz, any with an output sample rate (see MP4AudioWriterOptions)
+         * - bits per sample: 16, 24 or 32 (float), rounded to 16 for the encoder
          * - number of channels: 1, 2 or 6
          * - channel layout: mono, stereo or 5.1
          * - metadata values: empty (not supported)
@@ -29,27 +278,139 @@ namespace mole {
             MFPlatform platform;
 
             IMFSinkWriter* sinkWriter = nullptr;
+            SamplePool* samplePool = nullptr;
 
             DWORD streamIndex = 0; // Audio stream index.
-            LONGLONG sampleTime = 0; // Sample presentation time in 100 ns time units.
+            juce::int64 numSamplesWritten = 0;
             const int sampleSize = 0; // (16 bits per sample / 8 bits per byte) * number of channels
-            const double sampleDuration = 0; // Duration of one sample in 100 ns time units.
+
+            // Block being filled, written to the sink writer when it holds samplesPerBlock samples.
+            IMFSample* block = nullptr;
+            IMFMediaBuffer* blockBuffer = nullptr;
+            BYTE* blockData = nullptr;
+            int numBlockSamples = 0;
+
+            static constexpr int samplesPerBlock = 1024; // AAC frame
+
+            Dither dither;
+            const double encoderSampleRate = 0;
+            const bool useDither = false;
+
+            std::unique_ptr<ResamplingStage> resampling; // if the input sample rate is not the encoder sample rate
 
             //=============================================================================
             public:
 
             MP4AudioFormatWriter() = delete;
 
-            MP4AudioFormatWriter (juce::OutputStream* stream, const juce::AudioFormatWriterOptions& options)
+            MP4AudioFormatWriter (juce::OutputStream* stream, const juce::AudioFormatWriterOptions& options,
+                                  const MP4AudioWriterOptions& writerOptions = {})
                 : juce::AudioFormatWriter (stream, "MP4 file",
                         options.getSampleRate(), options.getNumChannels(), options.getBitsPerSample()),
-                  sampleSize ((16 / 8) * numChannels), sampleDuration (1e+9 * 1e-2 / sampleRate)
+                  sampleSize ((16 / 8) * numChannels),
+                  encoderSampleRate ((writerOptions.getOutputSampleRate() > 0) ? writerOptions.getOutputSampleRate() : sampleRate),
+                  useDither (writerOptions.isDitherEnabled() && (bitsPerSample > 16 || encoderSampleRate != sampleRate))
             {
+                // 32 bits per sample is float, as in WavAudioFormat.
+                usesFloatingPointData = (bitsPerSample == 32);
+
                 HRESULT hr = (stream != nullptr) ? S_OK : E_INVALIDARG;
 
                 if (SUCCEEDED (hr)) hr = library.Initialize();
                 if (SUCCEEDED (hr)) hr = platform.Initialize();
 
+                if (SUCCEEDED (hr)) hr = createSinkWriter (stream, encoderSampleRate, (int) numChannels,
+                        getBytesPerSecond (options.getQualityOptionIndex(), (int) numChannels), &sinkWriter, &streamIndex);
+
+                if (SUCCEEDED (hr) && encoderSampleRate != sampleRate)
+                    resampling = std::make_unique<ResamplingStage> (sampleRate, encoderSampleRate, (int) numChannels,
+                                                                    writerOptions.getResamplerQuality());
+
+                // Enough blocks for the samples the encoder holds, write() allocates nothing once they come back.
+                if (SUCCEEDED (hr)) samplePool = new SamplePool ((DWORD) (samplesPerBlock * sampleSize), 8);
+
+                if (FAILED (hr))
+                {
+                    DBGAPI(hr);
+
+                    sampleRate = 0;
+                    numChannels = 0;
+                    bitsPerSample = 0;
+
+                    SafeRelease (&sinkWriter);
+                }
+            }
+
+            ~MP4AudioFormatWriter() override
+            {
+                if (sinkWriter)
+                {
+                    HRESULT hr = writeRemainingSamples();
+                    if (SUCCEEDED (hr)) hr = sinkWriter->Finalize();
+                    if (FAILED (hr)) DBGAPI(hr);
+                }
+
+                releaseBlock();
+
+                if (samplePool)
+                    samplePool->Shutdown();
+
+                SafeRelease (&samplePool);
+                SafeRelease (&sinkWriter);
+            }
+
+            /** Completes the file on a background thread.
+             *
+             * Writes the last samples, then hands the sink writer and output stream
+             * to a thread that finalizes the file. The writer can be deleted right
+             * away, the destructor does not wait; do not write afterwards.
+             *
+             * @param onFinished Called on the background thread with true if the file was completed, may be empty.
+             */
+            void finalizeAsync (std::function<void (bool)> onFinished)
+            {
+                if (sinkWriter == nullptr)
+                {
+                    if (onFinished) onFinished (false);
+                    return;
+                }
+
+                HRESULT hr = writeRemainingSamples();
+                if (FAILED (hr)) DBGAPI(hr);
+
+                auto finalizer = std::make_unique<AsyncFinalizer> (std::move (onFinished));
+
+                finalizer->AddSinkWriter (sinkWriter);
+                finalizer->AddStream (output);
+                finalizer->SetSamplePool (samplePool);
+
+                sinkWriter = nullptr;
+                output = nullptr; // the base class would delete it
+                samplePool = nullptr;
+
+                AsyncFinalizer::Start (std::move (finalizer));
+            }
+
+            /** Returns the throughput of the sample rate conversion, measured apart from encoding.  */
+            MP4Resampler::Statistics getResamplerStatistics() const noexcept
+            {
+                return (resampling != nullptr) ? resampling->GetStatistics() : MP4Resampler::Statistics();
+            }
+
+            /** Creates a sink writer that encodes 16-bit PCM to AAC in MP4 file format and begins writing.
+             *
+             * @param stream Output stream, not owned.
+             * @param sampleRate Sample rate, 44100 or 48000 Hz.
+             * @param numChannels Number of channels, 1, 2 or 6.
+             * @param bytesPerSecond Bit rate (see getBytesPerSecond()).
+             * @param sinkWriter Receives the sink writer.
+             * @param streamIndex Receives the audio stream index.
+             */
+            static HRESULT createSinkWriter (juce::OutputStream* stream, double sampleRate, int numChannels, UINT32 bytesPerSecond,
+                                             IMFSinkWriter** sinkWriter, DWORD* streamIndex)
+            {
+                HRESULT hr = (stream != nullptr && sinkWriter != nullptr && streamIndex != nullptr) ? S_OK : E_INVALIDARG;
+
                 // Create sink writer.
                 if (SUCCEEDED (hr))
                 {
@@ -62,7 +423,7 @@ namespace mole {
                     if (SUCCEEDED (hr)) hr = attributes->SetGUID (MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_MPEG4);
 
                     if (SUCCEEDED (hr)) hr = ByteStreamFromOutputStream (&byteStream, stream, L"audio/mp4");
-                    if (SUCCEEDED (hr)) hr = ::MFCreateSinkWriterFromURL (nullptr, byteStream, attributes, &sinkWriter);
+                    if (SUCCEEDED (hr)) hr = ::MFCreateSinkWriterFromURL (nullptr, byteStream, attributes, sinkWriter);
 
                     SafeRelease (&byteStream);
                     SafeRelease (&attributes);
@@ -71,17 +432,6 @@ namespace mole {
                 // Add stream and set output audio attributes.
                 if (SUCCEEDED (hr))
                 {
-                    UINT32 bitrate = 12000; // 12000 bytes per second == 96 kilobits per second
-                    const int quality = options.getQualityOptionIndex();
-
-                    if (quality > 0 && quality < 8)
-                    {
-                        if (quality < 4)
-                            bitrate += quality * 4000;
-                        else
-                            bitrate = (bitrate + (quality - 4) * 4000) * numChannels;
-                    }
-
                     IMFMediaType* outputMediaType = nullptr;
 
                     hr = ::MFCreateMediaType (&outputMediaType);
@@ -90,9 +440,9 @@ namespace mole {
                     if (SUCCEEDED (hr)) hr = outputMediaType->SetUINT32 (MF_MT_AUDIO_BITS_PER_SAMPLE, 16);
                     if (SUCCEEDED (hr)) hr = outputMediaType->SetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, (UINT32) sampleRate);
                     if (SUCCEEDED (hr)) hr = outputMediaType->SetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, (UINT32) numChannels);
-                    if (SUCCEEDED (hr)) hr = outputMediaType->SetUINT32 (MF_MT_AUDIO_AVG_BYTES_PER_SECOND, bitrate);
+                    if (SUCCEEDED (hr)) hr = outputMediaType->SetUINT32 (MF_MT_AUDIO_AVG_BYTES_PER_SECOND, bytesPerSecond);
 
-                    if (SUCCEEDED (hr)) hr = sinkWriter->AddStream (outputMediaType, &streamIndex);
+                    if (SUCCEEDED (hr)) hr = (*sinkWriter)->AddStream (outputMediaType, streamIndex);
 
                     SafeRelease (&outputMediaType);
                 }
@@ -109,41 +459,136 @@ namespace mole {
                     if (SUCCEEDED (hr)) hr = inputMediaType->SetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, (UINT32) sampleRate);
                     if (SUCCEEDED (hr)) hr = inputMediaType->SetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, (UINT32) numChannels);
 
-                    if (SUCCEEDED (hr)) hr = sinkWriter->SetInputMediaType (streamIndex, inputMediaType, nullptr);
+                    if (SUCCEEDED (hr)) hr = (*sinkWriter)->SetInputMediaType (*streamIndex, inputMediaType, nullptr);
 
                     SafeRelease (&inputMediaType);
                 }
 
-                if (SUCCEEDED (hr)) hr = sinkWriter->BeginWriting();
+                if (SUCCEEDED (hr)) hr = (*sinkWriter)->BeginWriting();
 
-                if (FAILED (hr))
+                if (FAILED (hr) && sinkWriter != nullptr)
+                    SafeRelease (sinkWriter);
+
+                return hr;
+            }
+
+            /** Converts the channels writers take to interleaved 16-bit samples.
+             *
+             * @param dest First 16-bit sample.
+             * @param samplesToWrite Channels of 32-bit integer or float samples, null terminated.
+             * @param numChannels Number of channels.
+             * @param numSamples Number of samples per channel.
+             * @param sourceOffset First sample of the channels.
+             * @param isFloatingPoint True if the channels hold float samples.
+             * @param dither Dither, or nullptr to round without dither.
+             */
+            static void convertTo16Bit (void* dest, const int** samplesToWrite, int numChannels, int numSamples,
+                                        int sourceOffset, bool isFloatingPoint, Dither* dither) noexcept
+            {
+                if (dither != nullptr)
                 {
-                    DBGAPI(hr);
+                    auto* dest16 = static_cast<juce::int16*> (dest);
+                    bool isSilent = false; // channels after a null one are silent
 
-                    sampleRate = 0;
-                    numChannels = 0;
-                    bitsPerSample = 0;
+                    for (int ch = 0; ch < numChannels; ++ch)
+                    {
+                        isSilent = isSilent || samplesToWrite[ch] == nullptr;
+
+                        if (isSilent)
+                        {
+                            for (int i = 0; i < numSamples; ++i)
+                                dest16[i * numChannels + ch] = 0;
+                        }
+                        else if (isFloatingPoint)
+                        {
+                            dither->Process (reinterpret_cast<const float*> (samplesToWrite[ch]) + sourceOffset,
+                                             dest16 + ch, numChannels, numSamples);
+                        }
+                        else
+                        {
+                            dither->Process (samplesToWrite[ch] + sourceOffset, dest16 + ch, numChannels, numSamples);
+                        }
+                    }
+                }
+                else if (isFloatingPoint)
+                {
+                    juce::AudioFormatWriter::WriteHelper
+                        <juce::AudioData::Int16, juce::AudioData::Float32, juce::AudioData::LittleEndian>
+                        ::write (dest, numChannels, samplesToWrite, numSamples, sourceOffset);
+                }
+                else
+                {
+                    juce::AudioFormatWriter::WriteHelper
+                        <juce::AudioData::Int16, juce::AudioData::Int32, juce::AudioData::LittleEndian>
+                        ::write (dest, numChannels, samplesToWrite, numSamples, sourceOffset);
+                }
+            }
 
-                    SafeRelease (&sinkWriter);
+            /** Creates a sample of interleaved 16-bit PCM from the channels writers take.
+             *
+             * @param samplesToWrite Channels of samples.
+             * @param numChannels Number of channels.
+             * @param numSamples Number of samples per channel.
+             * @param isFloatingPoint True if the channels hold float samples.
+             * @param dither Dither, or nullptr to round without dither.
+             * @param sampleTime Presentation time in 100 ns time units.
+             * @param duration Duration in 100 ns time units.
+             * @param sample Receives the sample.
+             */
+            static HRESULT createSample (const int** samplesToWrite, int numChannels, int numSamples, bool isFloatingPoint,
+                                         Dither* dither, LONGLONG sampleTime, LONGLONG duration, IMFSample** sample)
+            {
+                IMFMediaBuffer* buffer = nullptr;
+
+                const DWORD bufferSize = (DWORD) (numSamples * (16 / 8) * numChannels);
+
+                HRESULT hr = ::MFCreateSample (sample);
+                if (SUCCEEDED (hr)) hr = ::MFCreateAlignedMemoryBuffer (bufferSize, MF_4_BYTE_ALIGNMENT, &buffer);
+                if (SUCCEEDED (hr)) hr = buffer->SetCurrentLength (bufferSize);
+                if (SUCCEEDED (hr)) hr = (*sample)->AddBuffer (buffer);
+
+                BYTE* data = nullptr;
+
+                if (SUCCEEDED (hr)) hr = buffer->Lock (&data, nullptr, nullptr);
+
+                if (SUCCEEDED (hr))
+                {
+                    convertTo16Bit (data, samplesToWrite, numChannels, numSamples, 0, isFloatingPoint, dither);
+                    hr = buffer->Unlock();
                 }
+
+                if (SUCCEEDED (hr)) hr = (*sample)->SetSampleTime (sampleTime);
+                if (SUCCEEDED (hr)) hr = (*sample)->SetSampleDuration (duration);
+
+                SafeRelease (&buffer);
+
+                if (FAILED (hr))
+                    SafeRelease (sample);
+
+                return hr;
             }
 
-            ~MP4AudioFormatWriter() override
+            /** Returns the bit rate of a quality option in bytes per second (see MP4AudioFormat::getQualityOptions()).  */
+            static UINT32 getBytesPerSecond (int quality, int numChannels)
             {
-                if (sinkWriter)
+                UINT32 bitrate = 12000; // 12000 bytes per second == 96 kilobits per second
+
+                if (quality > 0 && quality < 8)
                 {
-                    HRESULT hr = sinkWriter->Finalize();
-                    if (FAILED (hr)) DBGAPI(hr);
+                    if (quality < 4)
+                        bitrate += quality * 4000;
+                    else
+                        bitrate = (bitrate + (quality - 4) * 4000) * numChannels;
                 }
 
-                SafeRelease (&sinkWriter);
+                return bitrate;
             }
 
             //=============================================================================
             bool flush() override
             {
                 if (sinkWriter)
-                    return SUCCEEDED (sinkWriter->Flush (streamIndex));
+                    return SUCCEEDED (writeBlock()) && SUCCEEDED (sinkWriter->Flush (streamIndex));
 
                 return false;
             }
@@ -151,46 +596,131 @@ namespace mole {
             //=============================================================================
             bool write (const int** samplesToWrite, int numSamples) override
             {
-                IMFSample* sample = nullptr;
-                IMFMediaBuffer* buffer = nullptr;
+                HRESULT hr = sinkWriter ? S_OK : E_UNEXPECTED;
 
-                const DWORD bufferSize = numSamples * sampleSize;
+                if (SUCCEEDED (hr))
+                {
+                    if (resampling != nullptr)
+                        hr = resampling->Process (samplesToWrite, numSamples, usesFloatingPointData,
+                                [this] (const int** resampled, int numResampled) { return writeSamples (resampled, numResampled, true); });
+                    else
+                        hr = writeSamples (samplesToWrite, numSamples, usesFloatingPointData);
+                }
 
-                HRESULT hr = ::MFCreateSample (&sample);
-                if (SUCCEEDED (hr)) hr = ::MFCreateAlignedMemoryBuffer (bufferSize, MF_4_BYTE_ALIGNMENT, &buffer);
-                if (SUCCEEDED (hr)) hr = buffer->SetCurrentLength (bufferSize);
-                if (SUCCEEDED (hr)) hr = sample->AddBuffer (buffer);
+                if (FAILED (hr))
+                {
+                    DBGAPI(hr);
+                    return false;
+                }
 
-                BYTE* data = nullptr;
+                return true;
+            }
 
-                if (SUCCEEDED (hr)) hr = buffer->Lock (&data, nullptr, nullptr);
+            //=============================================================================
+            private:
 
-                if (SUCCEEDED (hr))
+            /** Converts samples at the encoder sample rate to 16 bits and writes them in blocks.  */
+            HRESULT writeSamples (const int** samplesToWrite, int numSamples, bool isFloatingPoint)
+            {
+                HRESULT hr = S_OK;
+
+                // Samples are collected in pooled blocks of one AAC frame, small
+                // writes from a recorder allocate nothing.
+                for (int done = 0; done < numSamples && SUCCEEDED (hr);)
                 {
-                    juce::AudioFormatWriter::WriteHelper
-                        <juce::AudioData::Int16, juce::AudioData::Int32, juce::AudioData::LittleEndian>
-                        ::write (data, numChannels, samplesToWrite, numSamples);
+                    if (block == nullptr)
+                        hr = beginBlock();
 
-                    hr = buffer->Unlock();
+                    if (SUCCEEDED (hr))
+                    {
+                        const int numToCopy = juce::jmin (numSamples - done, samplesPerBlock - numBlockSamples);
+
+                        convertTo16Bit (blockData + numBlockSamples * sampleSize, samplesToWrite, (int) numChannels, numToCopy,
+                                        done, isFloatingPoint, useDither ? &dither : nullptr);
+
+                        numBlockSamples += numToCopy;
+                        done += numToCopy;
+
+                        if (numBlockSamples == samplesPerBlock)
+                            hr = writeBlock();
+                    }
                 }
 
-                const LONGLONG duration = (LONGLONG) (sampleDuration * (double) numSamples);
+                return hr;
+            }
+
+            /** Writes the samples still in the resampler and the last block, do not write afterwards.  */
+            HRESULT writeRemainingSamples()
+            {
+                HRESULT hr = S_OK;
 
-                if (SUCCEEDED (hr)) hr = sample->SetSampleTime (sampleTime);
-                if (SUCCEEDED (hr)) hr = sample->SetSampleDuration (duration);
-                if (SUCCEEDED (hr)) hr = sinkWriter->WriteSample (streamIndex, sample);
-                if (SUCCEEDED (hr)) sampleTime += duration;
+                if (resampling != nullptr)
+                    hr = resampling->Drain ([this] (const int** resampled, int numResampled) { return writeSamples (resampled, numResampled, true); });
 
-                SafeRelease (&buffer);
-                SafeRelease (&sample);
+                if (SUCCEEDED (hr)) hr = writeBlock();
+
+                return hr;
+            }
+
+            /** Takes an empty block from the pool and locks its buffer.  */
+            HRESULT beginBlock()
+            {
+                HRESULT hr = samplePool->GetSample (&block);
+                if (SUCCEEDED (hr)) hr = block->GetBufferByIndex (0, &blockBuffer);
+                if (SUCCEEDED (hr)) hr = blockBuffer->Lock (&blockData, nullptr, nullptr);
 
                 if (FAILED (hr))
+                    releaseBlock();
+
+                return hr;
+            }
+
+            /** Writes the samples of the current block, the sink writer returns the block to the pool.  */
+            HRESULT writeBlock()
+            {
+                if (block == nullptr)
+                    return S_OK;
+
+                HRESULT hr = S_OK;
+
+                if (numBlockSamples > 0)
                 {
-                    DBGAPI(hr);
-                    return false;
+                    // Times are derived from the total sample count, rounding errors
+                    // of single buffers would add up over hours of recording.
+                    const LONGLONG sampleTime = getTime (numSamplesWritten);
+                    const LONGLONG duration = getTime (numSamplesWritten + numBlockSamples) - sampleTime;
+
+                    hr = blockBuffer->Unlock();
+                    blockData = nullptr;
+
+                    if (SUCCEEDED (hr)) hr = blockBuffer->SetCurrentLength ((DWORD) (numBlockSamples * sampleSize));
+                    if (SUCCEEDED (hr)) hr = block->SetSampleTime (sampleTime);
+                    if (SUCCEEDED (hr)) hr = block->SetSampleDuration (duration);
+                    if (SUCCEEDED (hr)) hr = sinkWriter->WriteSample (streamIndex, block);
+                    if (SUCCEEDED (hr)) numSamplesWritten += numBlockSamples;
                 }
 
-                return true;
+                releaseBlock();
+
+                return hr;
+            }
+
+            void releaseBlock()
+            {
+                if (blockData != nullptr)
+                    blockBuffer->Unlock();
+
+                blockData = nullptr;
+                numBlockSamples = 0;
+
+                SafeRelease (&blockBuffer);
+                SafeRelease (&block);
+            }
+
+            /** Returns the presentation time of a sample in 100 ns time units.  */
+            LONGLONG getTime (juce::int64 sampleNumber) const noexcept
+            {
+                return (LONGLONG) (sampleNumber * 10000000 / (juce::int64) encoderSampleRate);
             }
         };
     } // namespace WindowsMediaFoundation
@@ -0,0 +1,1098 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    namespace {
+        //============================================================================
+        // Four character code of an MP4 box type.
+        constexpr juce::uint32 fourcc (const char (&s)[5]) noexcept
+        {
+            return ((juce::uint32) (juce::uint8) s[0] << 24) | ((juce::uint32) (juce::uint8) s[1] << 16)
+                 | ((juce::uint32) (juce::uint8) s[2] << 8) | (juce::uint32) (juce::uint8) s[3];
+        }
+
+        //============================================================================
+        // Big-endian reader of a memory range with bounds checking.
+        class BoxReader
+        {
+            const juce::uint8* data = nullptr;
+            size_t size = 0;
+            size_t pos = 0;
+            bool failed = false;
+
+            public:
+
+            BoxReader (const void* d, size_t s) : data (static_cast<const juce::uint8*> (d)), size (s) {}
+
+            bool hasFailed() const noexcept             { return failed; }
+            size_t getRemaining() const noexcept        { return size - pos; }
+            const juce::uint8* getCurrent() const noexcept { return data + pos; }
+
+            bool canRead (size_t n) noexcept
+            {
+                if (failed || n > size - pos)
+                    failed = true;
+
+                return ! failed;
+            }
+
+            void skip (size_t n) noexcept               { if (canRead (n)) pos += n; }
+
+            juce::uint32 readByte() noexcept            { return canRead (1) ? (juce::uint32) data[pos++] : 0; }
+
+            juce::uint32 readShort() noexcept
+            {
+                if (! canRead (2)) return 0;
+                pos += 2;
+                return (juce::uint32) juce::ByteOrder::bigEndianShort (data + pos - 2);
+            }
+
+            juce::uint32 readInt() noexcept
+            {
+                if (! canRead (4)) return 0;
+                pos += 4;
+                return (juce::uint32) juce::ByteOrder::bigEndianInt (data + pos - 4);
+            }
+
+            juce::uint64 readInt64() noexcept
+            {
+                if (! canRead (8)) return 0;
+                pos += 8;
+                return (juce::uint64) juce::ByteOrder::bigEndianInt64 (data + pos - 8);
+            }
+
+            // Reads the expandable length field of an MPEG-4 descriptor.
+            juce::uint32 readDescriptorLength() noexcept
+            {
+                juce::uint32 length = 0;
+
+                for (int i = 0; i < 4; ++i)
+                {
+                    const juce::uint32 b = readByte();
+                    length = (length << 7) | (b & 0x7f);
+
+                    if ((b & 0x80) == 0)
+                        break;
+                }
+
+                return length;
+            }
+
+            // Calls fn (type, reader) for every child box in the remaining range.
+            template<typename Fn> bool forEachBox (Fn&& fn)
+            {
+                while (! failed && getRemaining() >= 8)
+                {
+                    juce::uint64 boxSize = readInt();
+                    const juce::uint32 type = readInt();
+                    size_t headerSize = 8;
+
+                    if (boxSize == 1)
+                    {
+                        boxSize = readInt64(); // largesize
+                        headerSize = 16;
+                    }
+
+                    if (boxSize == 0)
+                        boxSize = getRemaining() + headerSize;
+
+                    if (boxSize < headerSize || boxSize - headerSize > getRemaining())
+                        return false;
+
+                    BoxReader child (getCurrent(), (size_t) boxSize - headerSize);
+
+                    if (! fn (type, child))
+                        return false;
+
+                    skip ((size_t) boxSize - headerSize);
+                }
+
+                return ! failed;
+            }
+        };
+
+        //============================================================================
+        // MSB first bit reader for the audio specific config.
+        class BitReader
+        {
+            const juce::uint8* data = nullptr;
+            size_t numBits = 0;
+            size_t pos = 0;
+
+            public:
+
+            BitReader (const void* d, size_t size) : data (static_cast<const juce::uint8*> (d)), numBits (size * 8) {}
+
+            size_t getRemaining() const noexcept { return numBits - juce::jmin (pos, numBits); }
+
+            juce::uint32 read (int n) noexcept
+            {
+                juce::uint32 value = 0;
+
+                for (int i = 0; i < n; ++i, ++pos)
+                {
+                    const juce::uint32 bit = (pos < numBits) ? (data[pos >> 3] >> (7 - (pos & 7))) & 1 : 0;
+                    value = (value << 1) | bit;
+                }
+
+                return value;
+            }
+        };
+
+        //============================================================================
+        // Decoded fields of an MPEG-4 audio specific config.
+        struct AudioConfig
+        {
+            int objectType = 0;
+            int coreSampleRate = 0;
+            int sampleRate = 0;
+            int numChannels = 0;
+            int frameLength = 1024;
+        };
+
+        int readObjectType (BitReader& bits) noexcept
+        {
+            const int objectType = (int) bits.read (5);
+            return (objectType == 31) ? 32 + (int) bits.read (6) : objectType;
+        }
+
+        int readSampleRate (BitReader& bits) noexcept
+        {
+            static const int rates[] = { 96000, 88200, 64000, 48000, 44100, 32000,
+                                         24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+            const int index = (int) bits.read (4);
+
+            if (index == 15)
+                return (int) bits.read (24);
+
+            return (index < 13) ? rates[index] : 0;
+        }
+
+        int channelsFromConfiguration (int channelConfiguration) noexcept
+        {
+            switch (channelConfiguration)
+            {
+                case 1: case 2: case 3: case 4: case 5: case 6:
+                    return channelConfiguration;
+                case 7: case 12: case 14:
+                    return 8;
+                case 11:
+                    return 7;
+                default:
+                    return 0; // defined by program config element
+            }
+        }
+
+        // Parses an audio specific config (ISO/IEC 14496-3, 1.6.2.1).
+        bool parseAudioSpecificConfig (const void* data, size_t size, AudioConfig& config)
+        {
+            BitReader bits (data, size);
+
+            int objectType = readObjectType (bits);
+            config.coreSampleRate = readSampleRate (bits);
+            const int channelConfiguration = (int) bits.read (4);
+            int extensionSampleRate = 0;
+
+            // Explicit hierarchical SBR/PS signalling.
+            if (objectType == 5 || objectType == 29)
+            {
+                extensionSampleRate = readSampleRate (bits);
+                objectType = readObjectType (bits);
+
+                if (objectType == 22)
+                    bits.read (4); // extensionChannelConfiguration
+            }
+
+            switch (objectType)
+            {
+                case 1: case 2: case 3: case 4: case 6: case 7:
+                case 17: case 19: case 20: case 21: case 22: case 23:
+                    break;
+                default:
+                    return false; // not a general audio (AAC) object type
+            }
+
+            // GASpecificConfig
+            config.frameLength = bits.read (1) ? 960 : 1024;
+
+            if (bits.read (1)) // dependsOnCoreCoder
+                bits.read (14);
+
+            const bool extensionFlag = bits.read (1) != 0;
+
+            // Backward compatible explicit SBR signalling follows the GASpecificConfig,
+            // which can only be skipped without a program config element.
+            if (channelConfiguration != 0 && extensionSampleRate == 0)
+            {
+                if (objectType == 6 || objectType == 20)
+                    bits.read (3); // layerNr
+
+                if (extensionFlag)
+                {
+                    if (objectType == 22)
+                        bits.read (16); // numOfSubFrame, layer_length
+
+                    if (objectType == 17 || objectType == 19 || objectType == 20 || objectType == 23)
+                        bits.read (3); // resilience flags
+
+                    bits.read (1); // extensionFlag3
+                }
+
+                if (bits.getRemaining() >= 16 && bits.read (11) == 0x2b7)
+                {
+                    if (readObjectType (bits) == 5 && bits.read (1) != 0)
+                        extensionSampleRate = readSampleRate (bits);
+                }
+            }
+
+            config.objectType = objectType;
+            config.numChannels = channelsFromConfiguration (channelConfiguration);
+            config.sampleRate = (extensionSampleRate > 0) ? extensionSampleRate : config.coreSampleRate;
+
+            return config.coreSampleRate > 0;
+        }
+
+        //============================================================================
+        // Track properties collected from the moov box.
+        struct Track
+        {
+            bool isAudio = false;
+            juce::uint32 timescale = 0;
+            juce::uint64 duration = 0; // sum of stts deltas in timescale units
+
+            int entryNumChannels = 0;
+            juce::MemoryBlock audioSpecificConfig;
+
+            juce::uint32 fixedSampleSize = 0;
+            std::vector<juce::uint32> sampleSizes;
+            juce::uint32 numSamples = 0;
+            std::vector<std::pair<juce::uint32, juce::uint32>> samplesPerChunk; // first chunk, samples
+            std::vector<juce::int64> chunkOffsets;
+        };
+
+        bool parseEsds (BoxReader& esds, Track& track)
+        {
+            esds.skip (4); // version, flags
+
+            if (esds.readByte() != 0x03) // ES_DescrTag
+                return false;
+
+            esds.readDescriptorLength();
+            esds.skip (2); // ES_ID
+
+            const juce::uint32 flags = esds.readByte();
+            if (flags & 0x80) esds.skip (2);                // dependsOn_ES_ID
+            if (flags & 0x40) esds.skip (esds.readByte());  // URLstring
+            if (flags & 0x20) esds.skip (2);                // OCR_ES_Id
+
+            if (esds.readByte() != 0x04) // DecoderConfigDescrTag
+                return false;
+
+            esds.readDescriptorLength();
+
+            switch (esds.readByte()) // objectTypeIndication
+            {
+                case 0x40: // MPEG-4 audio
+                case 0x66: case 0x67: case 0x68: // MPEG-2 AAC main, LC, SSR
+                    break;
+                default:
+                    return false;
+            }
+
+            esds.skip (12); // streamType, bufferSizeDB, maxBitrate, avgBitrate
+
+            if (esds.readByte() != 0x05) // DecSpecificInfoTag
+                return false;
+
+            const juce::uint32 length = esds.readDescriptorLength();
+
+            if (length == 0 || ! esds.canRead (length))
+                return false;
+
+            track.audioSpecificConfig.replaceAll (esds.getCurrent(), length);
+            return true;
+        }
+
+        bool parseSampleEntry (BoxReader& entry, Track& track)
+        {
+            entry.skip (8); // reserved, data_reference_index
+
+            const juce::uint32 version = entry.readShort();
+            entry.skip (6); // revision level, vendor
+            track.entryNumChannels = (int) entry.readShort();
+            entry.skip (10); // sample size, compression id, packet size, sample rate
+
+            if (version == 1) entry.skip (16);
+            else if (version == 2) entry.skip (36);
+
+            bool found = false;
+
+            const bool ok = entry.forEachBox ([&] (juce::uint32 type, BoxReader& child)
+            {
+                if (type == fourcc ("esds"))
+                    found = parseEsds (child, track);
+                else if (type == fourcc ("wave")) // QuickTime sound description extension
+                    return child.forEachBox ([&] (juce::uint32 t, BoxReader& c) { if (t == fourcc ("esds")) found = parseEsds (c, track); return true; });
+
+                return true;
+            });
+
+            return ok && found;
+        }
+
+        bool parseSampleTable (BoxReader& stbl, Track& track)
+        {
+            bool hasDescription = false, hasSizes = false, hasChunks = false, hasOffsets = false;
+
+            const bool ok = stbl.forEachBox ([&] (juce::uint32 type, BoxReader& box)
+            {
+                if (type == fourcc ("stsd"))
+                {
+                    box.skip (4);
+
+                    if (box.readInt() == 0)
+                        return false;
+
+                    const juce::uint32 entrySize = box.readInt();
+                    const juce::uint32 format = box.readInt();
+
+                    if (format != fourcc ("mp4a") || entrySize < 8 || ! box.canRead (entrySize - 8))
+                        return false;
+
+                    BoxReader entry (box.getCurrent(), entrySize - 8);
+                    hasDescription = parseSampleEntry (entry, track);
+                }
+                else if (type == fourcc ("stts"))
+                {
+                    box.skip (4);
+                    const juce::uint32 count = box.readInt();
+
+                    for (juce::uint32 i = 0; i < count && ! box.hasFailed(); ++i)
+                    {
+                        const juce::uint64 sampleCount = box.readInt();
+                        track.duration += sampleCount * box.readInt();
+                    }
+                }
+                else if (type == fourcc ("stsz"))
+                {
+                    box.skip (4);
+                    track.fixedSampleSize = box.readInt();
+                    track.numSamples = box.readInt();
+
+                    if (track.fixedSampleSize == 0)
+                    {
+                        if (! box.canRead ((size_t) track.numSamples * 4))
+                            return false;
+
+                        track.sampleSizes.resize (track.numSamples);
+
+                        for (auto& s : track.sampleSizes)
+                            s = box.readInt();
+                    }
+
+                    hasSizes = true;
+                }
+                else if (type == fourcc ("stsc"))
+                {
+                    box.skip (4);
+                    const juce::uint32 count = box.readInt();
+
+                    if (! box.canRead ((size_t) count * 12))
+                        return false;
+
+                    track.samplesPerChunk.resize (count);
+
+                    for (auto& e : track.samplesPerChunk)
+                    {
+                        e.first = box.readInt();
+                        e.second = box.readInt();
+                        box.skip (4); // sample description index
+                    }
+
+                    hasChunks = true;
+                }
+                else if (type == fourcc ("stco") || type == fourcc ("co64"))
+                {
+                    const bool is64Bit = (type == fourcc ("co64"));
+
+                    box.skip (4);
+                    const juce::uint32 count = box.readInt();
+
+                    if (! box.canRead ((size_t) count * (is64Bit ? 8 : 4)))
+                        return false;
+
+                    track.chunkOffsets.resize (count);
+
+                    for (auto& o : track.chunkOffsets)
+                        o = is64Bit ? (juce::int64) box.readInt64() : (juce::int64) box.readInt();
+
+                    hasOffsets = true;
+                }
+
+                return ! box.hasFailed();
+            });
+
+            return ok && hasDescription && hasSizes && hasChunks && hasOffsets;
+        }
+
+        bool parseTrack (BoxReader& trak, Track& track)
+        {
+            return trak.forEachBox ([&] (juce::uint32 type, BoxReader& mdia)
+            {
+                if (type != fourcc ("mdia"))
+                    return true;
+
+                bool hasSampleTable = false;
+
+                const bool ok = mdia.forEachBox ([&] (juce::uint32 t, BoxReader& box)
+                {
+                    if (t == fourcc ("hdlr"))
+                    {
+                        box.skip (8); // version, flags, pre_defined
+                        track.isAudio = box.readInt() == fourcc ("soun");
+                    }
+                    else if (t == fourcc ("mdhd"))
+                    {
+                        const juce::uint32 version = box.readByte();
+                        box.skip (3 + ((version == 1) ? 16 : 8));
+                        track.timescale = box.readInt();
+                    }
+                    else if (t == fourcc ("minf") && track.isAudio)
+                    {
+                        return box.forEachBox ([&] (juce::uint32 s, BoxReader& stbl)
+                        {
+                            if (s == fourcc ("stbl"))
+                                hasSampleTable = parseSampleTable (stbl, track);
+
+                            return true;
+                        });
+                    }
+
+                    return true;
+                });
+
+                if (! (ok && hasSampleTable))
+                    track.isAudio = false;
+
+                return true;
+            });
+        }
+
+        //============================================================================
+        // iTunes metadata items mapped to the shell property names of readMetadataFromFile().
+        const char* metadataKeyFromItem (juce::uint32 type) noexcept
+        {
+            switch (type)
+            {
+                case 0xa96e616d: return "PKEY_Title";                 // ©nam
+                case 0xa9415254: return "PKEY_Music_Artist";          // ©ART
+                case 0x61415254: return "PKEY_Music_AlbumArtist";     // aART
+                case 0xa9616c62: return "PKEY_Music_AlbumTitle";      // ©alb
+                case 0xa967656e: return "PKEY_Music_Genre";           // ©gen
+                case 0xa9646179: return "PKEY_Media_Year";            // ©day
+                case 0xa9636d74: return "PKEY_Comment";               // ©cmt
+                case 0xa9777274: return "PKEY_Music_Composer";        // ©wrt
+                case 0xa9746f6f: return "PKEY_Media_EncodingSettings"; // ©too
+                case 0x63707274: return "PKEY_Copyright";             // cprt
+                case 0x74726b6e: return "PKEY_Music_TrackNumber";     // trkn
+                default: return nullptr;
+            }
+        }
+
+        void parseMetadata (BoxReader& udta, juce::StringPairArray& metadata)
+        {
+            udta.forEachBox ([&] (juce::uint32 type, BoxReader& meta)
+            {
+                if (type != fourcc ("meta"))
+                    return true;
+
+                // ISO meta is a full box, QuickTime meta is not.
+                if (meta.getRemaining() >= 8 && juce::ByteOrder::bigEndianInt (meta.getCurrent() + 4) != fourcc ("hdlr"))
+                    meta.skip (4);
+
+                return meta.forEachBox ([&] (juce::uint32 t, BoxReader& ilst)
+                {
+                    if (t != fourcc ("ilst"))
+                        return true;
+
+                    return ilst.forEachBox ([&] (juce::uint32 item, BoxReader& value)
+                    {
+                        const char* key = metadataKeyFromItem (item);
+
+                        if (key != nullptr)
+                        {
+                            value.forEachBox ([&] (juce::uint32 d, BoxReader& data)
+                            {
+                                if (d != fourcc ("data"))
+                                    return true;
+
+                                const juce::uint32 dataType = data.readInt() & 0xffffff;
+                                data.skip (4); // locale
+
+                                if (data.hasFailed())
+                                    return true;
+
+                                if (item == fourcc ("trkn"))
+                                {
+                                    data.skip (2);
+                                    const juce::uint32 track = data.readShort();
+
+                                    if (track > 0 && ! data.hasFailed())
+                                        metadata.set (key, juce::String (track));
+                                }
+                                else if (dataType == 1) // UTF-8
+                                {
+                                    metadata.set (key, juce::String::fromUTF8 ((const char*) data.getCurrent(), (int) data.getRemaining()));
+                                }
+
+                                return true;
+                            });
+                        }
+
+                        return true;
+                    });
+                });
+            });
+        }
+    } // namespace
+
+    //==============================================================================
+    /* Portable MP4 and ADTS demuxer, builds MP4AudioIndex instances.  */
+    class MP4Demuxer final
+    {
+        public:
+
+        static MP4AudioIndex::Ptr parse (juce::InputStream& stream)
+        {
+            juce::uint8 header[10] = {};
+
+            if (! stream.setPosition (0) || stream.read (header, 10) != 10)
+                return nullptr;
+
+            if (isADTS (header) || (header[0] == 'I' && header[1] == 'D' && header[2] == '3'))
+                return parseADTS (stream);
+
+            return parseMP4 (stream);
+        }
+
+        private:
+
+        //==========================================================================
+        static bool isADTS (const juce::uint8* h) noexcept
+        {
+            // syncword 0xfff, layer 0
+            return h[0] == 0xff && (h[1] & 0xf6) == 0xf0;
+        }
+
+        static MP4AudioIndex::Ptr parseMP4 (juce::InputStream& stream)
+        {
+            const juce::int64 totalLength = stream.getTotalLength();
+            juce::int64 position = 0;
+            bool isFirstBox = true;
+
+            Track track;
+            juce::StringPairArray metadata;
+            bool hasTrack = false;
+
+            while (position + 8 <= totalLength)
+            {
+                juce::uint8 header[8];
+
+                if (! stream.setPosition (position) || stream.read (header, 8) != 8)
+                    return nullptr;
+
+                juce::int64 boxSize = (juce::int64) juce::ByteOrder::bigEndianInt (header);
+                const juce::uint32 type = juce::ByteOrder::bigEndianInt (header + 4);
+                juce::int64 headerSize = 8;
+
+                if (isFirstBox)
+                {
+                    switch (type)
+                    {
+                        case fourcc ("ftyp"): case fourcc ("moov"): case fourcc ("mdat"):
+                        case fourcc ("free"): case fourcc ("skip"): case fourcc ("wide"):
+                            break;
+                        default:
+                            return nullptr; // not an ISO base media file
+                    }
+
+                    isFirstBox = false;
+                }
+
+                // 64-bit largesize, used by recordings over 4 GB.
+                if (boxSize == 1)
+                {
+                    if (stream.read (header, 8) != 8)
+                        return nullptr;
+
+                    boxSize = (juce::int64) juce::ByteOrder::bigEndianInt64 (header);
+                    headerSize = 16;
+                }
+
+                if (boxSize == 0)
+                    boxSize = totalLength - position;
+
+                if (boxSize < headerSize)
+                    return nullptr;
+
+                if (type == fourcc ("moov") && ! hasTrack)
+                {
+                    if (boxSize > totalLength - position)
+                        return nullptr; // truncated or damaged, do not allocate the claimed size
+
+                    juce::MemoryBlock moov;
+
+                    if (stream.readIntoMemoryBlock (moov, (ssize_t) (boxSize - headerSize)) != (size_t) (boxSize - headerSize))
+                        return nullptr;
+
+                    BoxReader reader (moov.getData(), moov.getSize());
+
+                    reader.forEachBox ([&] (juce::uint32 t, BoxReader& child)
+                    {
+                        if (t == fourcc ("trak") && ! hasTrack)
+                        {
+                            Track candidate;
+
+                            if (parseTrack (child, candidate) && candidate.isAudio)
+                            {
+                                track = std::move (candidate);
+                                hasTrack = true;
+                            }
+                        }
+                        else if (t == fourcc ("udta"))
+                        {
+                            parseMetadata (child, metadata);
+                        }
+
+                        return true;
+                    });
+                }
+
+                position += boxSize;
+            }
+
+            if (! hasTrack)
+                return nullptr;
+
+            AudioConfig config;
+
+            if (! parseAudioSpecificConfig (track.audioSpecificConfig.getData(), track.audioSpecificConfig.getSize(), config))
+                return nullptr;
+
+            MP4AudioIndex::Ptr index (new MP4AudioIndex());
+            index->container = MP4AudioIndex::Container::mp4;
+            index->audioSpecificConfig = track.audioSpecificConfig;
+            index->metadataValues = metadata;
+
+            if (! initialiseFromConfig (*index, config, track.entryNumChannels))
+                return nullptr;
+
+            // Expand sample to chunk mapping into one offset per access unit.
+            std::vector<juce::int64> offsets;
+            std::vector<juce::uint32> sizes;
+
+            offsets.reserve (track.numSamples);
+            sizes.reserve (track.numSamples);
+
+            juce::uint32 sample = 0;
+
+            for (size_t e = 0; e < track.samplesPerChunk.size() && sample < track.numSamples; ++e)
+            {
+                const juce::uint32 firstChunk = track.samplesPerChunk[e].first;
+                const juce::uint32 lastChunk = (e + 1 < track.samplesPerChunk.size())
+                    ? track.samplesPerChunk[e + 1].first : (juce::uint32) track.chunkOffsets.size() + 1;
+
+                if (firstChunk == 0 || lastChunk < firstChunk || lastChunk - 1 > track.chunkOffsets.size())
+                    return nullptr;
+
+                for (juce::uint32 chunk = firstChunk; chunk < lastChunk && sample < track.numSamples; ++chunk)
+                {
+                    juce::int64 offset = track.chunkOffsets[chunk - 1];
+
+                    for (juce::uint32 i = 0; i < track.samplesPerChunk[e].second && sample < track.numSamples; ++i, ++sample)
+                    {
+                        const juce::uint32 size = (track.fixedSampleSize != 0) ? track.fixedSampleSize : track.sampleSizes[sample];
+
+                        // Stop at the first access unit beyond the end of a truncated file.
+                        if (offset + (juce::int64) size > totalLength)
+                        {
+                            sample = track.numSamples;
+                            break;
+                        }
+
+                        offsets.push_back (offset);
+                        sizes.push_back (size);
+                        index->maxFrameSize = juce::jmax (index->maxFrameSize, (int) size);
+                        offset += size;
+                    }
+                }
+            }
+
+            if (sizes.empty())
+                return nullptr;
+
+            index->buildSampleTable (offsets, sizes);
+
+            const juce::int64 numDecodedSamples = (juce::int64) index->getNumFrames() * index->samplesPerFrame;
+
+            if (track.timescale > 0 && track.duration > 0)
+                index->lengthInSamples = juce::jmin (numDecodedSamples,
+                        (juce::int64) ((double) track.duration * index->sampleRate / (double) track.timescale + 0.5));
+            else
+                index->lengthInSamples = numDecodedSamples;
+
+            return index;
+        }
+
+        //==========================================================================
+        static MP4AudioIndex::Ptr parseADTS (juce::InputStream& source)
+        {
+            juce::BufferedInputStream stream (&source, 65536, false);
+
+            juce::int64 position = 0;
+            juce::uint8 header[10] = {};
+
+            // Skip ID3v2 tag.
+            if (stream.setPosition (0) && stream.read (header, 10) == 10
+                && header[0] == 'I' && header[1] == 'D' && header[2] == '3')
+            {
+                position = 10 + (((juce::int64) (header[6] & 0x7f) << 21) | ((header[7] & 0x7f) << 14)
+                                 | ((header[8] & 0x7f) << 7) | (header[9] & 0x7f));
+
+                if (header[5] & 0x10) // footer present
+                    position += 10;
+            }
+
+            const juce::int64 totalLength = stream.getTotalLength();
+
+            MP4AudioIndex::Ptr index (new MP4AudioIndex());
+            index->container = MP4AudioIndex::Container::adts;
+
+            juce::uint8 first[3] = {};
+            std::vector<juce::int64> offsets;
+            std::vector<juce::uint32> sizes;
+
+            while (position + 7 <= totalLength)
+            {
+                if (! stream.setPosition (position) || stream.read (header, 7) != 7 || ! isADTS (header))
+                    break;
+
+                const bool protectionAbsent = (header[1] & 0x01) != 0;
+                const int frameLength = ((header[3] & 0x03) << 11) | (header[4] << 3) | (header[5] >> 5);
+                const int headerSize = protectionAbsent ? 7 : 9;
+
+                if (frameLength <= headerSize || (header[6] & 0x03) != 0) // one raw data block per frame
+                    break;
+
+                if (position + frameLength > totalLength)
+                    break; // truncated last frame
+
+                if (sizes.empty())
+                {
+                    first[0] = header[2] & 0xfd; // profile, sampling frequency index, channel configuration
+                    first[1] = header[3] & 0xc0;
+                }
+                else if ((header[2] & 0xfd) != first[0] || (header[3] & 0xc0) != first[1])
+                {
+                    break; // stream configuration changed
+                }
+
+                offsets.push_back (position + headerSize);
+                sizes.push_back ((juce::uint32) (frameLength - headerSize));
+                index->maxFrameSize = juce::jmax (index->maxFrameSize, frameLength - headerSize);
+
+                position += frameLength;
+            }
+
+            if (sizes.empty())
+                return nullptr;
+
+            index->buildSampleTable (offsets, sizes);
+
+            // Audio specific config from the ADTS fixed header.
+            const int objectType = ((first[0] >> 6) & 0x03) + 1;
+            const int samplingFrequencyIndex = (first[0] >> 2) & 0x0f;
+            const int channelConfiguration = ((first[0] & 0x01) << 2) | (first[1] >> 6);
+
+            const juce::uint8 asc[2] = {
+                (juce::uint8) ((objectType << 3) | (samplingFrequencyIndex >> 1)),
+                (juce::uint8) (((samplingFrequencyIndex & 0x01) << 7) | (channelConfiguration << 3))
+            };
+
+            index->audioSpecificConfig.replaceAll (asc, sizeof (asc));
+
+            AudioConfig config;
+
+            if (! parseAudioSpecificConfig (asc, sizeof (asc), config) || ! initialiseFromConfig (*index, config, 0))
+                return nullptr;
+
+            index->lengthInSamples = (juce::int64) index->getNumFrames() * index->samplesPerFrame;
+
+            return index;
+        }
+
+        //==========================================================================
+        static bool initialiseFromConfig (MP4AudioIndex& index, const AudioConfig& config, int entryNumChannels)
+        {
+            index.sampleRate = (double) config.sampleRate;
+            index.numChannels = (unsigned int) ((config.numChannels > 0) ? config.numChannels : entryNumChannels);
+            index.samplesPerFrame = config.frameLength * config.sampleRate / config.coreSampleRate;
+
+            return index.numChannels > 0 && index.samplesPerFrame > 0;
+        }
+    };
+
+    //==============================================================================
+    MP4AudioIndex::Ptr MP4AudioIndex::createFrom (juce::InputStream& stream)
+    {
+        return MP4Demuxer::parse (stream);
+    }
+
+    size_t MP4AudioIndex::getMemoryUsage() const noexcept
+    {
+        size_t size = sizeof (MP4AudioIndex) + audioSpecificConfig.getSize()
+            + (checkpointTable.size() + sizeTable.size() + deltaTable.size()) * sizeof (juce::uint64);
+
+        for (auto& key : metadataValues.getAllKeys())
+            size += (size_t) (key.length() + metadataValues[key].length()) * 2;
+
+        return size;
+    }
+
+    //==============================================================================
+    namespace {
+        int getNumBits (juce::uint64 value) noexcept
+        {
+            int numBits = 0;
+
+            for (; value != 0; value >>= 1)
+                ++numBits;
+
+            return numBits;
+        }
+
+        void pack (std::vector<juce::uint64>& words, int index, int bits, juce::uint64 value) noexcept
+        {
+            const juce::uint64 bitPosition = (juce::uint64) index * (juce::uint64) bits;
+            const size_t word = (size_t) (bitPosition >> 6);
+            const int shift = (int) (bitPosition & 63);
+
+            words[word] |= value << shift;
+
+            if (shift + bits > 64)
+                words[word + 1] |= value >> (64 - shift);
+        }
+    } // namespace
+
+    void MP4AudioIndex::buildSampleTable (const std::vector<juce::int64>& offsets, const std::vector<juce::uint32>& sizes)
+    {
+        jassert (offsets.size() == sizes.size() && ! sizes.empty());
+
+        const int numFrames = (int) sizes.size();
+        auto block = [] (int frame) { return (size_t) (frame >> SampleTable::checkpointShift); };
+
+        // Checkpoints hold the smallest offset of their block, MP4 chunks need not be in order.
+        checkpointTable.assign (SampleTable::getNumCheckpoints (numFrames), std::numeric_limits<juce::int64>::max());
+
+        for (int i = 0; i < numFrames; ++i)
+            checkpointTable[block (i)] = juce::jmin (checkpointTable[block (i)], offsets[(size_t) i]);
+
+        const juce::uint32 minSize = *std::min_element (sizes.begin(), sizes.end());
+        const juce::uint32 maxSize = *std::max_element (sizes.begin(), sizes.end());
+        juce::uint64 maxDelta = 0;
+
+        for (int i = 0; i < numFrames; ++i)
+            maxDelta = juce::jmax (maxDelta, (juce::uint64) (offsets[(size_t) i] - checkpointTable[block (i)]));
+
+        table.numFrames = numFrames;
+        table.minSize = minSize;
+        table.sizeBits = getNumBits (maxSize - minSize);
+        table.deltaBits = getNumBits (maxDelta);
+
+        sizeTable.assign (SampleTable::getNumWords (numFrames, table.sizeBits), 0);
+        deltaTable.assign (SampleTable::getNumWords (numFrames, table.deltaBits), 0);
+
+        for (int i = 0; i < numFrames; ++i)
+        {
+            if (table.sizeBits > 0)
+                pack (sizeTable, i, table.sizeBits, sizes[(size_t) i] - minSize);
+
+            if (table.deltaBits > 0)
+                pack (deltaTable, i, table.deltaBits, (juce::uint64) (offsets[(size_t) i] - checkpointTable[block (i)]));
+        }
+
+        table.checkpoints = checkpointTable.data();
+        table.packedSizes = sizeTable.data();
+        table.packedDeltas = deltaTable.data();
+    }
+
+    //==============================================================================
+    namespace {
+        // Sidecar file layout (native byte order, 8 byte aligned sections):
+        // header, audio specific config, metadata ("key\0value\0" pairs),
+        // then the compact sample table: checkpoints (int64), packed frame sizes
+        // and packed offset deltas (uint64 words).
+        struct SidecarHeader
+        {
+            char magic[8];
+            juce::uint32 version;
+            juce::uint32 container;
+            juce::int64 sourceSize;
+            juce::int64 sourceModificationTime;
+            double sampleRate;
+            juce::uint32 numChannels;
+            juce::int32 samplesPerFrame;
+            juce::int64 lengthInSamples;
+            juce::int32 numFrames;
+            juce::int32 maxFrameSize;
+            juce::uint32 configSize;
+            juce::uint32 metadataSize;
+            juce::uint32 minFrameSize;
+            juce::int32 sizeBits;
+            juce::int32 deltaBits;
+            juce::int32 reserved;
+        };
+
+        static_assert (sizeof (SidecarHeader) % 8 == 0, "Sidecar sections must stay 8 byte aligned");
+
+        constexpr char sidecarMagic[8] = { 'M', 'O', 'L', 'E', 'I', 'D', 'X', '\0' };
+        constexpr juce::uint32 sidecarVersion = 2;
+
+        size_t alignSidecar (size_t size) noexcept { return (size + 7) & ~(size_t) 7; }
+    } // namespace
+
+    MP4AudioIndex::Ptr MP4AudioIndex::createFromSidecar (const juce::File& sidecarFile, const juce::File& sourceFile)
+    {
+        if (! sidecarFile.existsAsFile())
+            return nullptr;
+
+        auto mapped = std::make_unique<juce::MemoryMappedFile> (sidecarFile, juce::MemoryMappedFile::readOnly);
+        const size_t mappedSize = mapped->getSize();
+
+        if (mapped->getData() == nullptr || mappedSize < sizeof (SidecarHeader))
+            return nullptr;
+
+        const auto* data = static_cast<const char*> (mapped->getData());
+        const auto* header = reinterpret_cast<const SidecarHeader*> (data);
+
+        if (memcmp (header->magic, sidecarMagic, sizeof (sidecarMagic)) != 0
+            || header->version != sidecarVersion
+            || header->sourceSize != sourceFile.getSize()
+            || header->sourceModificationTime != sourceFile.getLastModificationTime().toMilliseconds()
+            || header->numFrames <= 0 || header->samplesPerFrame <= 0 || header->numChannels == 0
+            || header->sizeBits < 0 || header->sizeBits > 32 || header->deltaBits < 0 || header->deltaBits > 63
+            || header->container > (juce::uint32) Container::adts)
+            return nullptr;
+
+        const size_t configOffset = sizeof (SidecarHeader);
+        const size_t metadataOffset = alignSidecar (configOffset + header->configSize);
+        const size_t checkpointsOffset = alignSidecar (metadataOffset + header->metadataSize);
+        const size_t sizesOffset = checkpointsOffset + SampleTable::getNumCheckpoints (header->numFrames) * sizeof (juce::int64);
+        const size_t deltasOffset = sizesOffset + SampleTable::getNumWords (header->numFrames, header->sizeBits) * sizeof (juce::uint64);
+        const size_t endOffset = deltasOffset + SampleTable::getNumWords (header->numFrames, header->deltaBits) * sizeof (juce::uint64);
+
+        if (endOffset > mappedSize)
+            return nullptr;
+
+        Ptr index (new MP4AudioIndex());
+        index->container = (Container) header->container;
+        index->sampleRate = header->sampleRate;
+        index->numChannels = header->numChannels;
+        index->samplesPerFrame = header->samplesPerFrame;
+        index->lengthInSamples = header->lengthInSamples;
+        index->maxFrameSize = header->maxFrameSize;
+        index->audioSpecificConfig.replaceAll (data + configOffset, header->configSize);
+
+        // Metadata key and value pairs.
+        for (size_t pos = metadataOffset, end = metadataOffset + header->metadataSize; pos < end;)
+        {
+            const char* key = data + pos;
+            const size_t keyLength = strnlen (key, end - pos);
+            const char* value = key + keyLength + 1;
+
+            if (pos + keyLength + 1 >= end)
+                break;
+
+            const size_t valueLength = strnlen (value, end - pos - keyLength - 1);
+            index->metadataValues.set (juce::String::fromUTF8 (key, (int) keyLength), juce::String::fromUTF8 (value, (int) valueLength));
+
+            pos += keyLength + valueLength + 2;
+        }
+
+        index->table.checkpoints = reinterpret_cast<const juce::int64*> (data + checkpointsOffset);
+        index->table.packedSizes = reinterpret_cast<const juce::uint64*> (data + sizesOffset);
+        index->table.packedDeltas = reinterpret_cast<const juce::uint64*> (data + deltasOffset);
+        index->table.numFrames = header->numFrames;
+        index->table.minSize = header->minFrameSize;
+        index->table.sizeBits = header->sizeBits;
+        index->table.deltaBits = header->deltaBits;
+        index->sidecar = std::move (mapped);
+
+        return index;
+    }
+
+    bool MP4AudioIndex::writeSidecar (const juce::File& sidecarFile, const juce::File& sourceFile) const
+    {
+        juce::MemoryOutputStream metadata;
+
+        for (auto& key : metadataValues.getAllKeys())
+        {
+            metadata << key;
+            metadata.writeByte (0);
+            metadata << metadataValues[key];
+            metadata.writeByte (0);
+        }
+
+        SidecarHeader header = {};
+        memcpy (header.magic, sidecarMagic, sizeof (sidecarMagic));
+        header.version = sidecarVersion;
+        header.container = (juce::uint32) container;
+        header.sourceSize = sourceFile.getSize();
+        header.sourceModificationTime = sourceFile.getLastModificationTime().toMilliseconds();
+        header.sampleRate = sampleRate;
+        header.numChannels = numChannels;
+        header.samplesPerFrame = samplesPerFrame;
+        header.lengthInSamples = lengthInSamples;
+        header.numFrames = table.numFrames;
+        header.maxFrameSize = maxFrameSize;
+        header.configSize = (juce::uint32) audioSpecificConfig.getSize();
+        header.metadataSize = (juce::uint32) metadata.getDataSize();
+        header.minFrameSize = table.minSize;
+        header.sizeBits = table.sizeBits;
+        header.deltaBits = table.deltaBits;
+
+        auto writePadding = [] (juce::OutputStream& out, size_t size)
+        {
+            return out.writeRepeatedByte (0, alignSidecar (size) - size);
+        };
+
+        juce::TemporaryFile temp (sidecarFile);
+        bool ok = false;
+
+        if (auto out = temp.getFile().createOutputStream())
+        {
+            ok = out->write (&header, sizeof (header))
+              && out->write (audioSpecificConfig.getData(), audioSpecificConfig.getSize())
+              && writePadding (*out, sizeof (header) + audioSpecificConfig.getSize())
+              && out->write (metadata.getData(), metadata.getDataSize())
+              && writePadding (*out, metadata.getDataSize())
+              && out->write (table.checkpoints, SampleTable::getNumCheckpoints (table.numFrames) * sizeof (juce::int64))
+              && out->write (table.packedSizes, SampleTable::getNumWords (table.numFrames, table.sizeBits) * sizeof (juce::uint64))
+              && out->write (table.packedDeltas, SampleTable::getNumWords (table.numFrames, table.deltaBits) * sizeof (juce::uint64));
+
+            out->flush();
+            ok = ok && out->getStatus().wasOk();
+        }
+
+        return ok && temp.overwriteTargetFileWithTemporary();
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,188 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Parsed container index of an AAC stream.
+     *
+     * The index is built once by the portable demuxer (MP4, M4A, 3GP and raw
+     * ADTS) and holds everything needed to decode the stream without parsing
+     * the container again: stream properties, audio specific config, metadata
+     * and the sample table (file offset and size of every access unit).
+     *
+     * An index is immutable and reference counted, so it can be shared by any
+     * number of readers on any number of threads. Each reader only adds its
+     * own decoder and input stream (see MP4AudioFormat::createReaderFor()).
+     */
+    class MP4AudioIndex final : public juce::ReferenceCountedObject
+    {
+        //==========================================================================
+        public:
+            using Ptr = juce::ReferenceCountedObjectPtr<MP4AudioIndex>;
+
+            /** Container format of the indexed stream. */
+            enum class Container
+            {
+                mp4,    /**< ISO base media file format (MP4, M4A, 3GP). */
+                adts    /**< Raw AAC with ADTS headers. */
+            };
+
+            /** Parses the stream and returns a new index, or nullptr if the stream
+             *  does not contain AAC audio in a supported container.
+             *
+             *  The stream position is undefined afterwards.
+             */
+            static Ptr createFrom (juce::InputStream& stream);
+
+            /** Maps an index sidecar file written by writeSidecar().
+             *
+             * The sidecar is validated against the size and modification time of
+             * the source file, its sample table is used directly from the mapping.
+             *
+             * @param sidecarFile Sidecar file to map.
+             * @param sourceFile File the sidecar was written for.
+             * @return Index or nullptr if the sidecar is missing, outdated or invalid.
+             */
+            static Ptr createFromSidecar (const juce::File& sidecarFile, const juce::File& sourceFile);
+
+            /** Writes the index to a memory-mappable sidecar file.
+             *
+             * The file is written to a temporary file first and then renamed, so
+             * concurrent readers never see a partial sidecar.
+             *
+             * @param sidecarFile File to write.
+             * @param sourceFile File the index was created from.
+             * @return True on success.
+             */
+            bool writeSidecar (const juce::File& sidecarFile, const juce::File& sourceFile) const;
+
+            /** Returns the container format. */
+            Container getContainer() const noexcept                     { return container; }
+
+            /** Returns the decoded sample rate (including SBR, if signalled). */
+            double getSampleRate() const noexcept                       { return sampleRate; }
+
+            /** Returns the number of channels. */
+            unsigned int getNumChannels() const noexcept                { return numChannels; }
+
+            /** Returns the number of decoded samples per access unit (960, 1024 or 2048). */
+            int getSamplesPerFrame() const noexcept                     { return samplesPerFrame; }
+
+            /** Returns the stream length in decoded samples. */
+            juce::int64 getLengthInSamples() const noexcept             { return lengthInSamples; }
+
+            /** Returns the number of access units. */
+            int getNumFrames() const noexcept                           { return table.numFrames; }
+
+            /** Returns the file offset of an access unit. */
+            juce::int64 getFrameOffset (int frame) const noexcept       { return table.getOffset (frame); }
+
+            /** Returns the size in bytes of an access unit. */
+            int getFrameSize (int frame) const noexcept                 { return table.getSize (frame); }
+
+            /** Returns the size in bytes of the largest access unit. */
+            int getMaxFrameSize() const noexcept                        { return maxFrameSize; }
+
+            /** Returns the MPEG-4 audio specific config of the stream. */
+            const juce::MemoryBlock& getAudioSpecificConfig() const noexcept { return audioSpecificConfig; }
+
+            /** Returns metadata values (see [Metadata Properties for Media Files](markdown/metadata.md)). */
+            const juce::StringPairArray& getMetadataValues() const noexcept  { return metadataValues; }
+
+            /** Returns the approximate number of bytes used by the index. */
+            size_t getMemoryUsage() const noexcept;
+
+        //==========================================================================
+        private:
+            friend class MP4Demuxer;
+
+            MP4AudioIndex() = default;
+
+            Container container = Container::mp4;
+            double sampleRate = 0;
+            unsigned int numChannels = 0;
+            int samplesPerFrame = 1024;
+            juce::int64 lengthInSamples = 0;
+            int maxFrameSize = 0;
+
+            juce::MemoryBlock audioSpecificConfig;
+            juce::StringPairArray metadataValues;
+
+            //==========================================================================
+            // Compact sample table. Frame sizes are bit-packed relative to the smallest
+            // frame, frame offsets are bit-packed deltas to a checkpoint every 64 frames,
+            // so both lookups are O(1). Durations are not stored, AAC access units have
+            // a fixed number of samples.
+            struct SampleTable
+            {
+                static constexpr int checkpointShift = 6;
+
+                const juce::int64* checkpoints = nullptr;
+                const juce::uint64* packedSizes = nullptr;
+                const juce::uint64* packedDeltas = nullptr;
+                int numFrames = 0;
+                juce::uint32 minSize = 0;
+                int sizeBits = 0;
+                int deltaBits = 0;
+
+                static juce::uint64 unpack (const juce::uint64* words, int index, int bits) noexcept
+                {
+                    if (bits == 0)
+                        return 0;
+
+                    const juce::uint64 bitPosition = (juce::uint64) index * (juce::uint64) bits;
+                    const size_t word = (size_t) (bitPosition >> 6);
+                    const int shift = (int) (bitPosition & 63);
+
+                    juce::uint64 value = words[word] >> shift;
+
+                    if (shift + bits > 64)
+                        value |= words[word + 1] << (64 - shift);
+
+                    return value & (~(juce::uint64) 0 >> (64 - bits));
+                }
+
+                juce::int64 getOffset (int frame) const noexcept
+                {
+                    return checkpoints[frame >> checkpointShift] + (juce::int64) unpack (packedDeltas, frame, deltaBits);
+                }
+
+                int getSize (int frame) const noexcept
+                {
+                    return (int) (minSize + (juce::uint32) unpack (packedSizes, frame, sizeBits));
+                }
+
+                static size_t getNumCheckpoints (int numFrames) noexcept
+                {
+                    return (size_t) ((numFrames + (1 << checkpointShift) - 1) >> checkpointShift);
+                }
+
+                static size_t getNumWords (int numFrames, int bits) noexcept
+                {
+                    return ((size_t) numFrames * (size_t) bits + 63) / 64 + 1; // one word of padding for unpack()
+                }
+            };
+
+            // Points into the owned tables or into a mapped sidecar.
+            SampleTable table;
+
+            std::vector<juce::int64> checkpointTable;
+            std::vector<juce::uint64> sizeTable;
+            std::vector<juce::uint64> deltaTable;
+            std::unique_ptr<juce::MemoryMappedFile> sidecar;
+
+            void buildSampleTable (const std::vector<juce::int64>& offsets, const std::vector<juce::uint32>& sizes);
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4AudioIndex)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
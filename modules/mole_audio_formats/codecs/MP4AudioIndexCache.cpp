@@ -0,0 +1,182 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    namespace {
+        // About 25 minutes of 44.1 kHz AAC, smaller sample tables are parsed quickly.
+        constexpr int sidecarMinNumFrames = 65536;
+    }
+
+    //==============================================================================
+    MP4AudioIndexCache& MP4AudioIndexCache::getInstance()
+    {
+        static MP4AudioIndexCache instance;
+        return instance;
+    }
+
+    //==============================================================================
+    MP4AudioIndex::Ptr MP4AudioIndexCache::findIndexFor (const juce::File& file)
+    {
+        const juce::String path = file.getFullPathName();
+        const juce::int64 fileSize = file.getSize();
+        const juce::int64 modificationTime = file.getLastModificationTime().toMilliseconds();
+
+        const juce::ScopedLock sl (lock);
+
+        auto it = entryMap.find (path);
+
+        if (it == entryMap.end())
+            return nullptr;
+
+        auto entry = it->second;
+
+        // File changed on disk.
+        if (entry->fileSize != fileSize || entry->modificationTime != modificationTime)
+        {
+            memoryUsage -= entry->memoryUsage;
+            entries.erase (entry);
+            entryMap.erase (it);
+            return nullptr;
+        }
+
+        entries.splice (entries.begin(), entries, entry);
+        return entry->index;
+    }
+
+    MP4AudioIndex::Ptr MP4AudioIndexCache::getIndexFor (const juce::File& file, juce::InputStream& stream)
+    {
+        if (auto index = findIndexFor (file))
+            return index;
+
+        // Parse without holding the lock, other files can be opened meanwhile.
+        Entry entry;
+        entry.path = file.getFullPathName();
+        entry.fileSize = file.getSize();
+        entry.modificationTime = file.getLastModificationTime().toMilliseconds();
+
+        const juce::File sidecarFile = getSidecarFileFor (file, ".moleidx");
+
+        if (sidecarFile != juce::File())
+            entry.index = MP4AudioIndex::createFromSidecar (sidecarFile, file);
+
+        if (entry.index == nullptr)
+        {
+            entry.index = MP4AudioIndex::createFrom (stream);
+
+            if (entry.index == nullptr)
+                return nullptr;
+
+            // Persist indexes that needed a scan of the whole file or have large sample tables.
+            if (sidecarFile != juce::File()
+                && (entry.index->getContainer() == MP4AudioIndex::Container::adts || entry.index->getNumFrames() >= sidecarMinNumFrames))
+            {
+                sidecarFile.getParentDirectory().createDirectory();
+
+                if (! entry.index->writeSidecar (sidecarFile, file))
+                    DBGSTR("Writing index sidecar failed.");
+            }
+        }
+
+        entry.memoryUsage = entry.index->getMemoryUsage();
+
+        MP4AudioIndex::Ptr index = entry.index;
+        insert (std::move (entry));
+
+        return index;
+    }
+
+    //==============================================================================
+    void MP4AudioIndexCache::setMemoryBudget (size_t numBytes)
+    {
+        const juce::ScopedLock sl (lock);
+
+        memoryBudget = numBytes;
+        evict();
+    }
+
+    size_t MP4AudioIndexCache::getMemoryBudget() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return memoryBudget;
+    }
+
+    size_t MP4AudioIndexCache::getMemoryUsage() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return memoryUsage;
+    }
+
+    void MP4AudioIndexCache::setSidecarDirectory (const juce::File& directory)
+    {
+        const juce::ScopedLock sl (lock);
+        sidecarDirectory = directory;
+    }
+
+    juce::File MP4AudioIndexCache::getSidecarDirectory() const
+    {
+        const juce::ScopedLock sl (lock);
+        return sidecarDirectory;
+    }
+
+    juce::File MP4AudioIndexCache::getSidecarFileFor (const juce::File& file, const juce::String& extension) const
+    {
+        const juce::ScopedLock sl (lock);
+
+        if (sidecarDirectory == juce::File())
+            return {};
+
+        return sidecarDirectory.getChildFile (juce::String::toHexString (file.getFullPathName().toLowerCase().hashCode64()) + extension);
+    }
+
+    void MP4AudioIndexCache::clear()
+    {
+        const juce::ScopedLock sl (lock);
+
+        entryMap.clear();
+        entries.clear();
+        memoryUsage = 0;
+    }
+
+    //==============================================================================
+    void MP4AudioIndexCache::insert (Entry&& entry)
+    {
+        const juce::ScopedLock sl (lock);
+
+        if (entry.memoryUsage > memoryBudget)
+            return;
+
+        // Replace an entry added by another thread, or an outdated one.
+        auto it = entryMap.find (entry.path);
+
+        if (it != entryMap.end())
+        {
+            memoryUsage -= it->second->memoryUsage;
+            entries.erase (it->second);
+            entryMap.erase (it);
+        }
+
+        memoryUsage += entry.memoryUsage;
+        entries.push_front (std::move (entry));
+        entryMap[entries.front().path] = entries.begin();
+
+        evict();
+    }
+
+    void MP4AudioIndexCache::evict()
+    {
+        while (memoryUsage > memoryBudget && ! entries.empty())
+        {
+            memoryUsage -= entries.back().memoryUsage;
+            entryMap.erase (entries.back().path);
+            entries.pop_back();
+        }
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
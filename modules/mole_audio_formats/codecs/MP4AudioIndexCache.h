@@ -0,0 +1,101 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Process-wide LRU cache of MP4AudioIndex instances.
+     *
+     * Entries are keyed by file identity (full path, size and modification
+     * time), so a file that changes on disk is parsed again. The least
+     * recently used entries are dropped when the memory budget is exceeded;
+     * readers that still use a dropped index keep it alive.
+     *
+     * With a sidecar directory, indexes that are expensive to build (raw ADTS
+     * needs a scan of the whole file, very long MP4 recordings have large
+     * sample tables) are also written to disk after the first parse and mapped
+     * on later opens, in this or any other process.
+     *
+     * MP4AudioFormat checks the cache before parsing a file.
+     */
+    class MP4AudioIndexCache final
+    {
+        //==========================================================================
+        public:
+            /** Returns the process-wide cache. */
+            static MP4AudioIndexCache& getInstance();
+
+            /** Returns the cached index of a file, or parses and caches it.
+             *
+             * @param file File to index.
+             * @param stream Open stream of the file, used on a cache miss.
+             * @return Index or nullptr if the file cannot be indexed.
+             */
+            MP4AudioIndex::Ptr getIndexFor (const juce::File& file, juce::InputStream& stream);
+
+            /** Returns the cached index of a file, or nullptr. */
+            MP4AudioIndex::Ptr findIndexFor (const juce::File& file);
+
+            /** Sets the memory budget in bytes (0 disables caching, default 64 MB). */
+            void setMemoryBudget (size_t numBytes);
+
+            /** Returns the memory budget in bytes. */
+            size_t getMemoryBudget() const noexcept;
+
+            /** Returns the memory used by cached indexes in bytes. */
+            size_t getMemoryUsage() const noexcept;
+
+            /** Sets the directory for index sidecar files (a default File disables sidecars). */
+            void setSidecarDirectory (const juce::File& directory);
+
+            /** Returns the directory for index sidecar files. */
+            juce::File getSidecarDirectory() const;
+
+            /** Returns the sidecar file of a source file in the sidecar directory.
+             *
+             * @param file Source file.
+             * @param extension Extension of the kind of sidecar, e.g. ".moleidx" for indexes.
+             * @return Sidecar file, or a default File if there is no sidecar directory.
+             */
+            juce::File getSidecarFileFor (const juce::File& file, const juce::String& extension) const;
+
+            /** Removes all entries. */
+            void clear();
+
+        //==========================================================================
+        private:
+            MP4AudioIndexCache() = default;
+
+            struct Entry
+            {
+                juce::String path;
+                juce::int64 fileSize = 0;
+                juce::int64 modificationTime = 0;
+                MP4AudioIndex::Ptr index;
+                size_t memoryUsage = 0;
+            };
+
+            using EntryList = std::list<Entry>;
+
+            juce::CriticalSection lock;
+            EntryList entries; // most recently used first
+            std::map<juce::String, EntryList::iterator> entryMap;
+            size_t memoryBudget = 64 * 1024 * 1024;
+            size_t memoryUsage = 0;
+            juce::File sidecarDirectory;
+
+            void insert (Entry&& entry);
+            void evict();
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4AudioIndexCache)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,115 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Options of readers created by MP4AudioFormat.
+     *
+     * The default options decode on the thread that calls readSamples().
+     */
+    class MP4AudioReaderOptions
+    {
+        //==========================================================================
+        public:
+            /** Decodes ahead on a background scheduler (nullptr disables decode-ahead). */
+            [[nodiscard]] MP4AudioReaderOptions withScheduler (MP4DecodeScheduler* x) const { return juce::withMember (*this, &MP4AudioReaderOptions::scheduler, x); }
+
+            /** Sets the priority class of the decode-ahead jobs. */
+            [[nodiscard]] MP4AudioReaderOptions withPriority (MP4DecodeScheduler::Priority x) const { return juce::withMember (*this, &MP4AudioReaderOptions::priority, x); }
+
+            /** Sets the number of access units decoded ahead of the read position. */
+            [[nodiscard]] MP4AudioReaderOptions withDecodeAhead (int x) const { return juce::withMember (*this, &MP4AudioReaderOptions::decodeAhead, x); }
+
+            /** Decodes on the scheduler only, readSamples() is safe on the audio thread (see MP4RealtimeReader).
+             *  Uses MP4DecodeScheduler::getInstance() if no scheduler is set. Read on the audio thread only,
+             *  readMaxLevels() needs a level pyramid.
+             */
+            [[nodiscard]] MP4AudioReaderOptions withRealtimeMode (bool x) const { return juce::withMember (*this, &MP4AudioReaderOptions::realtimeMode, x); }
+
+            /** Looks up access units in a decoded frame cache before decoding them (nullptr disables the cache). */
+            [[nodiscard]] MP4AudioReaderOptions withFrameCache (MP4FrameCache::Ptr x) const { return juce::withMember (*this, &MP4AudioReaderOptions::frameCache, x); }
+
+            /** Sets the number of access units decoded at once when reading backward (0 always decodes forward). */
+            [[nodiscard]] MP4AudioReaderOptions withReverseWindow (int x) const { return juce::withMember (*this, &MP4AudioReaderOptions::reverseWindow, x); }
+
+            /** Resamples to this sample rate while decoding, e.g. the device sample rate (0 reads at the decoded sample rate).
+             *  Lengths and positions of the reader are in this sample rate.
+             */
+            [[nodiscard]] MP4AudioReaderOptions withOutputSampleRate (double x) const { return juce::withMember (*this, &MP4AudioReaderOptions::outputSampleRate, x); }
+
+            /** Downmixes to 2 (stereo) or 1 (mono) channels while decoding, 0 reads all channels of the stream.
+             *  5.1 streams are mixed to stereo by the decoder where it supports it, which costs less than decoding all channels.
+             */
+            [[nodiscard]] MP4AudioReaderOptions withOutputNumChannels (int x) const { return juce::withMember (*this, &MP4AudioReaderOptions::outputNumChannels, x); }
+
+            /** Answers readMaxLevels() from a level pyramid of the stream (nullptr builds one while the whole stream is read).
+             *  Readers ignore a pyramid whose sample rate, number of channels or length differ from theirs.
+             */
+            [[nodiscard]] MP4AudioReaderOptions withLevelPyramid (MP4LevelPyramid::Ptr x) const { return juce::withMember (*this, &MP4AudioReaderOptions::levelPyramid, x); }
+
+            /** Passes the samples that are read to analysis taps, e.g. loudness, true-peak and checksum (see MP4AnalysisTap).
+             *  Each sample is passed once, in stream order; reads that skip ahead pause the taps. Ignored in real-time mode.
+             */
+            [[nodiscard]] MP4AudioReaderOptions withAnalysisTaps (juce::Array<MP4AnalysisTap::Ptr> x) const { return juce::withMember (*this, &MP4AudioReaderOptions::analysisTaps, x); }
+
+            /** Sets the quality of the sample rate conversion. */
+            [[nodiscard]] MP4AudioReaderOptions withResamplerQuality (MP4Resampler::Quality x) const { return juce::withMember (*this, &MP4AudioReaderOptions::resamplerQuality, x); }
+
+            /** Returns the decode-ahead scheduler, or nullptr. */
+            MP4DecodeScheduler* getScheduler() const noexcept                   { return scheduler; }
+
+            /** Returns the priority class of the decode-ahead jobs. */
+            MP4DecodeScheduler::Priority getPriority() const noexcept           { return priority; }
+
+            /** Returns the number of access units decoded ahead of the read position. */
+            int getDecodeAhead() const noexcept                                 { return decodeAhead; }
+
+            /** Returns true if readers decode on the scheduler only. */
+            bool isRealtimeMode() const noexcept                                { return realtimeMode; }
+
+            /** Returns the number of access units decoded at once when reading backward. */
+            int getReverseWindow() const noexcept                               { return reverseWindow; }
+
+            /** Returns the decoded frame cache, or nullptr. */
+            MP4FrameCache::Ptr getFrameCache() const noexcept                   { return frameCache; }
+
+            /** Returns the sample rate readers resample to, 0 for the decoded sample rate. */
+            double getOutputSampleRate() const noexcept                         { return outputSampleRate; }
+
+            /** Returns the number of channels readers downmix to, 0 for all channels. */
+            int getOutputNumChannels() const noexcept                           { return outputNumChannels; }
+
+            /** Returns the level pyramid, or nullptr. */
+            MP4LevelPyramid::Ptr getLevelPyramid() const noexcept               { return levelPyramid; }
+
+            /** Returns the analysis taps. */
+            const juce::Array<MP4AnalysisTap::Ptr>& getAnalysisTaps() const noexcept { return analysisTaps; }
+
+            /** Returns the quality of the sample rate conversion. */
+            MP4Resampler::Quality getResamplerQuality() const noexcept          { return resamplerQuality; }
+
+        //==========================================================================
+        private:
+            MP4DecodeScheduler* scheduler = nullptr;
+            MP4DecodeScheduler::Priority priority = MP4DecodeScheduler::Priority::interactive;
+            int decodeAhead = 16; // about 0.4 seconds at 44.1 kHz
+            bool realtimeMode = false;
+            MP4FrameCache::Ptr frameCache;
+            int reverseWindow = 32; // about 0.75 seconds at 44.1 kHz
+            double outputSampleRate = 0;
+            int outputNumChannels = 0;
+            MP4LevelPyramid::Ptr levelPyramid;
+            juce::Array<MP4AnalysisTap::Ptr> analysisTaps;
+            MP4Resampler::Quality resamplerQuality = MP4Resampler::Quality::balanced;
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,54 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Options of writers created by MP4AudioFormat, in addition to the
+     *  AudioFormatWriterOptions.
+     *
+     * The encoder takes 16-bit samples. Writers with 24 or 32 (float) bits per
+     * sample round their input to 16 bits, by default without dither.
+     *
+     * The encoder also takes 44100 or 48000 Hz only. With an output sample
+     * rate, writers accept any input sample rate and resample in front of the
+     * encoder (see MP4Resampler).
+     */
+    class MP4AudioWriterOptions
+    {
+        //==========================================================================
+        public:
+            /** Adds TPDF dither when 24-bit or float input is rounded to 16 bits. */
+            [[nodiscard]] MP4AudioWriterOptions withDither (bool x) const { return juce::withMember (*this, &MP4AudioWriterOptions::dither, x); }
+
+            /** Sets the sample rate of the encoded audio, 44100 or 48000 Hz, or 0 to encode at the input sample rate. */
+            [[nodiscard]] MP4AudioWriterOptions withOutputSampleRate (double x) const { return juce::withMember (*this, &MP4AudioWriterOptions::outputSampleRate, x); }
+
+            /** Sets the quality of the sample rate conversion. */
+            [[nodiscard]] MP4AudioWriterOptions withResamplerQuality (MP4Resampler::Quality x) const { return juce::withMember (*this, &MP4AudioWriterOptions::resamplerQuality, x); }
+
+            /** Returns true if the input is dithered. */
+            bool isDitherEnabled() const noexcept                               { return dither; }
+
+            /** Returns the sample rate of the encoded audio, 0 for the input sample rate. */
+            double getOutputSampleRate() const noexcept                         { return outputSampleRate; }
+
+            /** Returns the quality of the sample rate conversion. */
+            MP4Resampler::Quality getResamplerQuality() const noexcept          { return resamplerQuality; }
+
+        //==========================================================================
+        private:
+            bool dither = false;
+            double outputSampleRate = 0;
+            MP4Resampler::Quality resamplerQuality = MP4Resampler::Quality::balanced;
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,208 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    using namespace mole::WindowsMediaFoundation;
+
+    //==============================================================================
+    class MP4BatchTranscoder::Job final : public MP4DecodeScheduler::Job
+    {
+        public:
+            struct Progress
+            {
+                std::atomic<int> numRemaining { 0 };
+                juce::WaitableEvent finished;
+                juce::CriticalSection callbackLock;
+            };
+
+            Job (MP4BatchTranscoder& transcoder, const juce::File& inputFile, const juce::File& outputFile)
+                : owner (transcoder), input (inputFile), output (outputFile)
+            {
+            }
+
+            /** Transcodes the whole file in one run, Media Foundation objects stay on one thread.  */
+            bool run() override
+            {
+                result = owner.transcode (input, output);
+
+                if (owner.onFileFinished != nullptr)
+                {
+                    const juce::ScopedLock sl (progress->callbackLock);
+                    owner.onFileFinished (result);
+                }
+
+                if (--progress->numRemaining == 0)
+                    progress->finished.signal();
+
+                return false;
+            }
+
+            MP4BatchTranscoder& owner;
+            const juce::File input;
+            const juce::File output;
+            Progress* progress = nullptr;
+            Result result;
+    };
+
+    //==============================================================================
+    MP4BatchTranscoder::MP4BatchTranscoder (MP4DecodeScheduler* s)
+        : ownedScheduler ((s == nullptr) ? std::make_unique<MP4DecodeScheduler> (juce::SystemStats::getNumCpus()) : nullptr),
+          scheduler ((s != nullptr) ? *s : *ownedScheduler)
+    {
+        formatManager.registerBasicFormats();
+        formatManager.registerFormat (new MP4AudioFormat(), false);
+    }
+
+    MP4BatchTranscoder::~MP4BatchTranscoder()
+    {
+    }
+
+    //==============================================================================
+    bool MP4BatchTranscoder::addFile (const juce::File& input, const juce::File& output)
+    {
+        // Two jobs writing the same output would overwrite each other's file.
+        if (! outputPaths.insert (output.getFullPathName().toLowerCase()).second)
+        {
+            DBGSTR("Output file already in the batch: " + output.getFullPathName());
+            return false;
+        }
+
+        // Created here, jobs of the same directory would race to create it.
+        output.getParentDirectory().createDirectory();
+
+        jobs.add (new Job (*this, input, output));
+
+        return true;
+    }
+
+    int MP4BatchTranscoder::addDirectory (const juce::File& inputDirectory, const juce::File& outputDirectory, const juce::String& wildcard)
+    {
+        int numAdded = 0;
+
+        for (const auto& entry : juce::RangedDirectoryIterator (inputDirectory, true, wildcard, juce::File::findFiles))
+        {
+            const juce::File& file = entry.getFile();
+
+            // An output tree inside the input tree would be added again.
+            if (file.isAChildOf (outputDirectory))
+                continue;
+
+            if (addFile (file, outputDirectory.getChildFile (file.getRelativePathFrom (inputDirectory)).withFileExtension ("mp4")))
+                ++numAdded;
+        }
+
+        return numAdded;
+    }
+
+    //==============================================================================
+    bool MP4BatchTranscoder::run()
+    {
+        statistics = {};
+
+        // Keeps Media Foundation started between the files.
+        COMLibrary library;
+        MFPlatform platform;
+
+        HRESULT hr = library.Initialize();
+        if (SUCCEEDED (hr)) hr = platform.Initialize();
+        if (FAILED (hr)) DBGAPI(hr);
+
+        const double startTime = juce::Time::getMillisecondCounterHiRes();
+
+        Job::Progress progress;
+        progress.numRemaining = jobs.size();
+
+        for (auto* job : jobs)
+        {
+            job->progress = &progress;
+            scheduler.schedule (*job, MP4DecodeScheduler::Priority::offline);
+        }
+
+        if (! jobs.isEmpty())
+            progress.finished.wait();
+
+        // Wait for the workers to let go of the jobs.
+        for (auto* job : jobs)
+            scheduler.remove (*job);
+
+        statistics.elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+        for (auto* job : jobs)
+        {
+            ++statistics.numFiles;
+            statistics.audioSeconds += job->result.audioSeconds;
+
+            if (! job->result.succeeded)
+                ++statistics.numFailed;
+        }
+
+        jobs.clear();
+        outputPaths.clear();
+
+        return statistics.numFailed == 0;
+    }
+
+    //==============================================================================
+    MP4BatchTranscoder::Result MP4BatchTranscoder::transcode (const juce::File& input, const juce::File& output)
+    {
+        Result result;
+        result.input = input;
+        result.output = output;
+
+        const double startTime = juce::Time::getMillisecondCounterHiRes();
+
+        std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor (input));
+        std::unique_ptr<juce::AudioFormatWriter> writer;
+
+        // Written next to the output and renamed when complete.
+        juce::TemporaryFile temporary (output);
+
+        if (reader == nullptr)
+        {
+            result.error = "Unsupported input file.";
+        }
+        else
+        {
+            result.audioSeconds = (double) reader->lengthInSamples / reader->sampleRate;
+
+            std::unique_ptr<juce::OutputStream> stream (temporary.getFile().createOutputStream());
+
+            // Other sample rates are resampled to the encoder sample rate of the same family.
+            MP4AudioFormat format;
+            format.setWriterOptions (MP4AudioWriterOptions{}
+                    .withOutputSampleRate ((std::fmod (reader->sampleRate, 11025.0) == 0.0) ? 44100.0 : 48000.0));
+
+            if (stream != nullptr)
+                writer = format.createWriterFor (stream,
+                        juce::AudioFormatWriterOptions{}
+                        .withSampleRate (reader->sampleRate)
+                        .withNumChannels ((int) reader->numChannels)
+                        .withBitsPerSample (16)
+                        .withQualityOptionIndex (qualityOptionIndex));
+
+            if (writer == nullptr || writer->getSampleRate() == 0)
+                result.error = "Unsupported sample rate or number of channels.";
+        }
+
+        if (result.error.isEmpty() && ! writer->writeFromAudioReader (*reader, 0, -1))
+            result.error = "Transcoding failed.";
+
+        writer.reset(); // finalizes the file
+
+        if (result.error.isEmpty() && ! temporary.overwriteTargetFileWithTemporary())
+            result.error = "Replacing the output file failed.";
+
+        result.succeeded = result.error.isEmpty();
+        result.elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+        return result;
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,112 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Transcodes many files to MP4 in one process.
+     *
+     * Each file is an offline job on a MP4DecodeScheduler, whose workers
+     * steal jobs from each other, so long and short files balance out over
+     * all cores. The process keeps Media Foundation started and the format
+     * manager and MP4 index cache warm for the whole batch, instead of paying
+     * for them once per file.
+     *
+     * Outputs are written to a temporary file next to the target and renamed
+     * when complete, so a failed or interrupted transcode never leaves a
+     * truncated MP4 file behind.
+     */
+    class MP4BatchTranscoder final
+    {
+        //==========================================================================
+        public:
+            /** Outcome of one file. */
+            struct Result
+            {
+                juce::File input;                   /**< Source file. */
+                juce::File output;                  /**< MP4 file. */
+                bool succeeded = false;             /**< True if the output file was written. */
+                juce::String error;                 /**< Reason of a failure. */
+                double audioSeconds = 0.0;          /**< Duration of the audio. */
+                double elapsedSeconds = 0.0;        /**< Time spent transcoding. */
+            };
+
+            /** Throughput of a batch. */
+            struct Statistics
+            {
+                int numFiles = 0;                   /**< Files transcoded or failed. */
+                int numFailed = 0;                  /**< Files that failed. */
+                double audioSeconds = 0.0;          /**< Duration of the audio of all files. */
+                double elapsedSeconds = 0.0;        /**< Wall clock time of the batch. */
+            };
+
+            //==========================================================================
+            /** Creates a transcoder.
+             *
+             * @param scheduler Scheduler that runs the files, nullptr creates one with a worker per CPU.
+             *                  Long offline jobs would hold up the readers of the process-wide scheduler.
+             */
+            explicit MP4BatchTranscoder (MP4DecodeScheduler* scheduler = nullptr);
+
+            /** Destructor. */
+            ~MP4BatchTranscoder();
+
+            /** Sets the quality option index, 0-7 (see MP4AudioFormat::getQualityOptions()). */
+            void setQualityOptionIndex (int index) noexcept     { qualityOptionIndex = index; }
+
+            /** Adds a file to the batch.
+             *
+             * @return False if another file of the batch already has this output, the file is not added.
+             */
+            bool addFile (const juce::File& input, const juce::File& output);
+
+            /** Adds the audio files of a directory tree, the outputs mirror the tree with the extension .mp4.
+             *
+             * Files that differ only in their extension, e.g. song.wav and song.flac,
+             * would have the same output; only the first one is added.
+             *
+             * @param inputDirectory Directory to search.
+             * @param outputDirectory Root of the output tree.
+             * @param wildcard Files to add, semicolon separated, e.g. "*.wav;*.flac".
+             * @return Number of files added.
+             */
+            int addDirectory (const juce::File& inputDirectory, const juce::File& outputDirectory, const juce::String& wildcard);
+
+            /** Called when a file is done, on a scheduler thread; calls do not overlap. */
+            std::function<void (const Result& result)> onFileFinished;
+
+            /** Transcodes all added files, returns when they are done.
+             *
+             * @return True if all files succeeded.
+             */
+            bool run();
+
+            /** Returns the throughput of the last run(). */
+            Statistics getStatistics() const noexcept           { return statistics; }
+
+        //==========================================================================
+        private:
+            class Job;
+
+            std::unique_ptr<MP4DecodeScheduler> ownedScheduler;
+            MP4DecodeScheduler& scheduler;
+            juce::AudioFormatManager formatManager;
+            juce::OwnedArray<Job> jobs;
+            std::set<juce::String> outputPaths;     // of the jobs, lower case like Windows file names
+            int qualityOptionIndex = 4;
+            Statistics statistics;
+
+            Result transcode (const juce::File& input, const juce::File& output);
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4BatchTranscoder)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
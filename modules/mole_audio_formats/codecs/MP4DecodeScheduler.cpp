@@ -0,0 +1,305 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    //==============================================================================
+    class MP4DecodeScheduler::Worker final : public juce::Thread
+    {
+        public:
+            Worker (MP4DecodeScheduler& owner, int workerIndex)
+                : juce::Thread ("MP4 decode " + juce::String (workerIndex)), scheduler (owner), index (workerIndex)
+            {
+                wakeUpEvent = ::CreateEvent (nullptr, FALSE, FALSE, nullptr);
+            }
+
+            ~Worker() override
+            {
+                if (wakeUpEvent != nullptr)
+                    ::CloseHandle (wakeUpEvent);
+            }
+
+            void run() override
+            {
+                // Jobs call Media Foundation decoders that were created on other threads.
+                Windows::COMLibrary library;
+                Windows::MFPlatform platform;
+
+                if (SUCCEEDED (library.InitializeMTA()) && SUCCEEDED (platform.Initialize()))
+                    scheduler.run (index);
+            }
+
+            MP4DecodeScheduler& scheduler;
+            const int index;
+
+            juce::CriticalSection lock;
+            std::deque<Job*> queues[numPriorities];
+            HANDLE wakeUpEvent = nullptr; // auto-reset
+            std::atomic<bool> isIdle { false };
+    };
+
+    //==============================================================================
+    MP4DecodeScheduler::MP4DecodeScheduler (int numWorkers)
+    {
+        audioThreadEvent = ::CreateEvent (nullptr, FALSE, FALSE, nullptr);
+
+        for (int i = 0; i < juce::jmax (1, numWorkers); ++i)
+            workers.add (new Worker (*this, i));
+
+        for (auto* worker : workers)
+            worker->startThread (juce::Thread::Priority::high);
+    }
+
+    MP4DecodeScheduler::~MP4DecodeScheduler()
+    {
+        for (auto* worker : workers)
+        {
+            worker->signalThreadShouldExit();
+            ::SetEvent (worker->wakeUpEvent);
+        }
+
+        for (auto* worker : workers)
+            worker->stopThread (-1);
+
+        workers.clear();
+
+        if (audioThreadEvent != nullptr)
+            ::CloseHandle (audioThreadEvent);
+    }
+
+    MP4DecodeScheduler& MP4DecodeScheduler::getInstance()
+    {
+        static MP4DecodeScheduler instance (juce::SystemStats::getNumCpus() - 1);
+        return instance;
+    }
+
+    int MP4DecodeScheduler::getNumWorkers() const noexcept
+    {
+        return workers.size();
+    }
+
+    //==============================================================================
+    bool MP4DecodeScheduler::Job::setQueued() noexcept
+    {
+        int current = state.load();
+
+        for (;;)
+        {
+            if (current == queued || current == runningAndQueued)
+                return false;
+
+            const int newState = (current == idle) ? queued : runningAndQueued;
+
+            if (state.compare_exchange_weak (current, newState))
+                return current == idle; // a running job is queued again by its worker
+        }
+    }
+
+    void MP4DecodeScheduler::schedule (Job& job, Priority priority)
+    {
+        if (job.removed)
+            return;
+
+        job.priority = (int) priority;
+
+        if (job.setQueued())
+            push (job);
+    }
+
+    void MP4DecodeScheduler::scheduleFromAudioThread (Job& job, Priority priority) noexcept
+    {
+        if (job.removed)
+            return;
+
+        job.priority = (int) priority;
+
+        if (job.setQueued())
+        {
+            Job* head = pendingJobs.load();
+
+            do
+            {
+                job.nextPending = head;
+            }
+            while (! pendingJobs.compare_exchange_weak (head, &job));
+
+            // A non-empty list was signalled when it became non-empty, the worker takes all of it.
+            if (head == nullptr)
+                ::SetEvent (audioThreadEvent);
+        }
+    }
+
+    void MP4DecodeScheduler::remove (Job& job)
+    {
+        job.removed = true;
+
+        for (auto* worker : workers)
+        {
+            const juce::ScopedLock sl (worker->lock);
+
+            for (auto& queue : worker->queues)
+            {
+                auto it = std::find (queue.begin(), queue.end(), &job);
+
+                if (it != queue.end())
+                {
+                    queue.erase (it);
+                    --numQueuedJobs;
+                    job.state = Job::idle;
+                }
+            }
+        }
+
+        // Wait for a worker that runs the job or takes it from the list of pending jobs.
+        while (job.state.load() != Job::idle)
+            juce::Thread::yield();
+
+        job.removed = false;
+    }
+
+    //==============================================================================
+    void MP4DecodeScheduler::push (Job& job)
+    {
+        int workerIndex = job.worker;
+
+        if (workerIndex < 0)
+            workerIndex = (int) ((unsigned int) nextWorker++ % (unsigned int) workers.size());
+
+        {
+            auto* worker = workers.getUnchecked (workerIndex);
+            const juce::ScopedLock sl (worker->lock);
+
+            if (job.removed)
+            {
+                job.state = Job::idle;
+                return;
+            }
+
+            worker->queues[job.priority].push_back (&job);
+            ++numQueuedJobs;
+        }
+
+        wakeUp (workerIndex);
+    }
+
+    void MP4DecodeScheduler::pushPendingJobs()
+    {
+        for (Job* job = pendingJobs.exchange (nullptr); job != nullptr;)
+        {
+            Job* next = job->nextPending;
+            push (*job);
+            job = next;
+        }
+    }
+
+    MP4DecodeScheduler::Job* MP4DecodeScheduler::pop (int workerIndex)
+    {
+        const int numWorkers = workers.size();
+
+        for (int priority = 0; priority < numPriorities; ++priority)
+        {
+            // Own queue first (oldest job), then steal from the others (newest job).
+            for (int i = 0; i < numWorkers; ++i)
+            {
+                auto* worker = workers.getUnchecked ((workerIndex + i) % numWorkers);
+                const juce::ScopedLock sl (worker->lock);
+
+                auto& queue = worker->queues[priority];
+
+                while (! queue.empty())
+                {
+                    Job* job = (i == 0) ? queue.front() : queue.back();
+
+                    if (i == 0)
+                        queue.pop_front();
+                    else
+                        queue.pop_back();
+
+                    --numQueuedJobs;
+
+                    if (job->removed)
+                    {
+                        job->state = Job::idle;
+                        continue;
+                    }
+
+                    job->state = Job::running;
+                    return job;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    void MP4DecodeScheduler::run (int workerIndex)
+    {
+        auto* worker = workers.getUnchecked (workerIndex);
+
+        while (! worker->threadShouldExit())
+        {
+            if (pendingJobs.load() != nullptr)
+                pushPendingJobs();
+
+            if (Job* job = pop (workerIndex))
+            {
+                job->worker = workerIndex;
+
+                const bool hasMoreWork = job->run();
+
+                if (job->removed)
+                {
+                    job->state = Job::idle;
+                    continue;
+                }
+
+                int state = Job::running;
+
+                if (hasMoreWork || ! job->state.compare_exchange_strong (state, Job::idle))
+                {
+                    job->state = Job::queued;
+                    push (*job);
+                }
+
+                continue;
+            }
+
+            // Checked after the idle flag is set, so a job pushed meanwhile wakes this worker.
+            worker->isIdle = true;
+
+            if (numQueuedJobs.load() == 0 && pendingJobs.load() == nullptr)
+            {
+                const HANDLE events[] = { worker->wakeUpEvent, audioThreadEvent };
+                ::WaitForMultipleObjects (2, events, FALSE, 100);
+            }
+
+            worker->isIdle = false;
+        }
+    }
+
+    void MP4DecodeScheduler::wakeUp (int workerIndex)
+    {
+        if (workers.getUnchecked (workerIndex)->isIdle)
+        {
+            ::SetEvent (workers.getUnchecked (workerIndex)->wakeUpEvent);
+            return;
+        }
+
+        // The worker is busy, let an idle one steal the job.
+        for (auto* worker : workers)
+        {
+            if (worker->isIdle)
+            {
+                ::SetEvent (worker->wakeUpEvent);
+                return;
+            }
+        }
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,134 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Background decode scheduler shared by MP4 readers.
+     *
+     * A fixed number of worker threads runs the decode-ahead jobs of any
+     * number of readers. Each worker has its own queue per priority class and
+     * steals from the other workers when its queues are empty; a job goes back
+     * to the worker that ran it last. Workers always take the highest priority
+     * class first, so real-time playback is not starved by offline work.
+     *
+     * Readers opt in with MP4AudioReaderOptions::withScheduler(). The scheduler
+     * must outlive the readers that use it.
+     */
+    class MP4DecodeScheduler final
+    {
+        //==========================================================================
+        public:
+            /** Priority classes, in the order workers take them. */
+            enum class Priority
+            {
+                realtime,       /**< Real-time playback. */
+                interactive,    /**< Interactive scrubbing and previews. */
+                offline         /**< Batch processing. */
+            };
+
+            //==========================================================================
+            /** Background work, usually the decode-ahead of one reader.
+             *
+             * A job runs on one worker at a time. Scheduling a job that is
+             * queued does nothing, scheduling a running job queues it again
+             * after it returns.
+             */
+            class Job
+            {
+                public:
+                    Job() = default;
+                    virtual ~Job() = default;
+
+                    /** Does a short slice of work.
+                     *
+                     * @return True if the job has more work and should be queued again.
+                     */
+                    virtual bool run() = 0;
+
+                private:
+                    friend class MP4DecodeScheduler;
+
+                    enum State { idle, queued, running, runningAndQueued };
+
+                    std::atomic<int> state { idle };
+                    std::atomic<int> priority { (int) Priority::offline };
+                    std::atomic<int> worker { -1 }; // worker that ran the job last
+                    std::atomic<bool> removed { false };
+                    Job* nextPending = nullptr; // link in the lock-free list of jobs scheduled from audio threads
+
+                    bool setQueued() noexcept;
+
+                    JUCE_DECLARE_NON_COPYABLE (Job)
+            };
+
+            //==========================================================================
+            /** Starts the worker threads.
+             *
+             * @param numWorkers Number of worker threads (at least one).
+             */
+            explicit MP4DecodeScheduler (int numWorkers);
+
+            /** Stops the worker threads, queued jobs are not run. */
+            ~MP4DecodeScheduler();
+
+            /** Returns the process-wide scheduler (one worker less than CPUs). */
+            static MP4DecodeScheduler& getInstance();
+
+            /** Returns the number of worker threads. */
+            int getNumWorkers() const noexcept;
+
+            /** Queues a job.
+             *
+             * @param job Job to run.
+             * @param priority Priority class, replaces the one of an earlier call.
+             */
+            void schedule (Job& job, Priority priority);
+
+            /** Queues a job without locks or allocations.
+             *
+             * For audio threads: the job is passed to the workers through a
+             * lock-free list. Adding to an empty list sets an auto-reset event
+             * (SetEvent() does not block) that wakes one idle worker, which
+             * moves the list to the queues. Idle workers do not poll.
+             *
+             * @param job Job to run.
+             * @param priority Priority class, replaces the one of an earlier call.
+             */
+            void scheduleFromAudioThread (Job& job, Priority priority) noexcept;
+
+            /** Removes a job from the queues and waits until it is not running.
+             *  The job can be scheduled again afterwards.
+             */
+            void remove (Job& job);
+
+        //==========================================================================
+        private:
+            class Worker;
+
+            static constexpr int numPriorities = 3;
+
+            juce::OwnedArray<Worker> workers;
+            std::atomic<int> nextWorker { 0 };
+            std::atomic<int> numQueuedJobs { 0 };
+            std::atomic<Job*> pendingJobs { nullptr };
+            void* audioThreadEvent = nullptr; // auto-reset event HANDLE, set when the list of pending jobs becomes non-empty
+
+            void push (Job& job);
+            void pushPendingJobs();
+            Job* pop (int workerIndex);
+            void run (int workerIndex);
+            void wakeUp (int workerIndex);
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4DecodeScheduler)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,205 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    namespace {
+        // All cache files of a decoded file start with the hash of its path.
+        juce::String getCacheFilePrefixFor (const juce::File& file)
+        {
+            return juce::String::toHexString (file.getFullPathName().toLowerCase().hashCode64()) + "-";
+        }
+    }
+
+    //==============================================================================
+    MP4DecodedAudioCache& MP4DecodedAudioCache::getInstance()
+    {
+        static MP4DecodedAudioCache instance;
+        return instance;
+    }
+
+    //==============================================================================
+    juce::File MP4DecodedAudioCache::findDecodedFileFor (const juce::File& file)
+    {
+        const juce::File cacheFile = getCacheFileFor (file);
+
+        if (cacheFile == juce::File() || ! cacheFile.existsAsFile())
+            return {};
+
+        // Last access times are not maintained by all file systems, but the LRU order relies on them.
+        cacheFile.setLastAccessTime (juce::Time::getCurrentTime());
+        return cacheFile;
+    }
+
+    juce::File MP4DecodedAudioCache::getDecodedFileFor (const juce::File& file, juce::AudioFormatReader& reader)
+    {
+        juce::File cacheFile = findDecodedFileFor (file);
+
+        if (cacheFile != juce::File())
+            return cacheFile;
+
+        cacheFile = getCacheFileFor (file);
+
+        if (cacheFile == juce::File() || reader.sampleRate <= 0 || reader.numChannels == 0 || reader.lengthInSamples <= 0)
+            return {};
+
+        cacheFile.getParentDirectory().createDirectory();
+
+        // Decode into a temporary file, other threads and processes only see complete cache files.
+        juce::TemporaryFile temporaryFile (cacheFile);
+
+        {
+            std::unique_ptr<juce::OutputStream> stream (temporaryFile.getFile().createOutputStream());
+
+            if (stream == nullptr)
+                return {};
+
+            juce::WavAudioFormat wavFormat;
+
+            std::unique_ptr<juce::AudioFormatWriter> writer (
+                    wavFormat.createWriterFor (stream,
+                        juce::AudioFormatWriterOptions{}
+                        .withSampleRate (reader.sampleRate)
+                        .withNumChannels ((int) reader.numChannels)
+                        .withBitsPerSample (getBitsPerSample())));
+
+            if (writer == nullptr || ! writer->writeFromAudioReader (reader, 0, -1))
+            {
+                DBGSTR("Decoding into the cache failed.");
+                return {};
+            }
+        }
+
+        // A cache file that was completed meanwhile cannot be replaced while it is mapped.
+        if (! temporaryFile.overwriteTargetFileWithTemporary() && ! cacheFile.existsAsFile())
+            return {};
+
+        removeOutdatedFiles (file, cacheFile);
+        evict (cacheFile);
+
+        return cacheFile;
+    }
+
+    //==============================================================================
+    void MP4DecodedAudioCache::setDirectory (const juce::File& newDirectory)
+    {
+        const juce::ScopedLock sl (lock);
+        directory = newDirectory;
+    }
+
+    juce::File MP4DecodedAudioCache::getDirectory() const
+    {
+        const juce::ScopedLock sl (lock);
+        return directory;
+    }
+
+    void MP4DecodedAudioCache::setDiskBudget (juce::int64 numBytes)
+    {
+        {
+            const juce::ScopedLock sl (lock);
+            diskBudget = numBytes;
+        }
+
+        evict ({});
+    }
+
+    juce::int64 MP4DecodedAudioCache::getDiskBudget() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return diskBudget;
+    }
+
+    juce::int64 MP4DecodedAudioCache::getDiskUsage() const
+    {
+        juce::int64 numBytes = 0;
+
+        for (const auto& cacheFile : getDirectory().findChildFiles (juce::File::findFiles, false, "*.wav"))
+            numBytes += cacheFile.getSize();
+
+        return numBytes;
+    }
+
+    void MP4DecodedAudioCache::setBitsPerSample (int newBitsPerSample)
+    {
+        jassert (newBitsPerSample == 16 || newBitsPerSample == 24 || newBitsPerSample == 32);
+
+        const juce::ScopedLock sl (lock);
+        bitsPerSample = newBitsPerSample;
+    }
+
+    int MP4DecodedAudioCache::getBitsPerSample() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return bitsPerSample;
+    }
+
+    void MP4DecodedAudioCache::clear()
+    {
+        for (const auto& cacheFile : getDirectory().findChildFiles (juce::File::findFiles, false, "*.wav"))
+            cacheFile.deleteFile(); // fails for mapped files
+    }
+
+    //==============================================================================
+    juce::File MP4DecodedAudioCache::getCacheFileFor (const juce::File& file) const
+    {
+        const juce::ScopedLock sl (lock);
+
+        if (directory == juce::File())
+            return {};
+
+        const juce::String identity = juce::String (file.getSize())
+            + ":" + juce::String (file.getLastModificationTime().toMilliseconds())
+            + ":" + juce::String (bitsPerSample);
+
+        return directory.getChildFile (getCacheFilePrefixFor (file) + juce::String::toHexString (identity.hashCode64()) + ".wav");
+    }
+
+    void MP4DecodedAudioCache::removeOutdatedFiles (const juce::File& file, const juce::File& cacheFile) const
+    {
+        // Cache files of older versions of the file, or with another sample format.
+        for (const auto& outdatedFile : cacheFile.getParentDirectory().findChildFiles (juce::File::findFiles, false, getCacheFilePrefixFor (file) + "*.wav"))
+        {
+            if (outdatedFile != cacheFile)
+                outdatedFile.deleteFile();
+        }
+    }
+
+    void MP4DecodedAudioCache::evict (const juce::File& cacheFile) const
+    {
+        const juce::int64 budget = getDiskBudget();
+
+        auto cacheFiles = getDirectory().findChildFiles (juce::File::findFiles, false, "*.wav");
+
+        juce::int64 numBytes = 0;
+
+        for (const auto& f : cacheFiles)
+            numBytes += f.getSize();
+
+        if (numBytes <= budget)
+            return;
+
+        // Least recently used first.
+        std::sort (cacheFiles.begin(), cacheFiles.end(), [] (const juce::File& a, const juce::File& b)
+        {
+            return a.getLastAccessTime() < b.getLastAccessTime();
+        });
+
+        for (const auto& f : cacheFiles)
+        {
+            if (numBytes <= budget)
+                break;
+
+            const juce::int64 size = f.getSize();
+
+            if (f != cacheFile && f.deleteFile()) // fails for mapped files
+                numBytes -= size;
+        }
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
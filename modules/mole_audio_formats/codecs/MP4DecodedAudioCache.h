@@ -0,0 +1,86 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Process-wide disk cache of decoded audio files.
+     *
+     * Once a cache directory is set, MP4AudioFormat::createMemoryMappedReader()
+     * decodes a file into a WAV file in the directory on the first call and
+     * maps that WAV file on later calls, in this or any other process. Files
+     * that are read many times (stems in a session) are decoded once and then
+     * read like WAV files, the operating system shares the mapped pages.
+     *
+     * Cache files are named after the path, size and modification time of the
+     * decoded file, so a file that changes on disk is decoded again. The least
+     * recently used cache files are deleted when the disk budget is exceeded;
+     * files that are still mapped are kept.
+     */
+    class MP4DecodedAudioCache final
+    {
+        //==========================================================================
+        public:
+            /** Returns the process-wide cache. */
+            static MP4DecodedAudioCache& getInstance();
+
+            /** Returns the cache file of a file, or a default File if it is not decoded yet. */
+            juce::File findDecodedFileFor (const juce::File& file);
+
+            /** Returns the cache file of a file, or decodes it into the cache.
+             *
+             * @param file Decoded file.
+             * @param reader Reader of the file, used on a cache miss.
+             * @return Cache file or a default File if caching is disabled or decoding failed.
+             */
+            juce::File getDecodedFileFor (const juce::File& file, juce::AudioFormatReader& reader);
+
+            /** Sets the cache directory (a default File disables the cache). */
+            void setDirectory (const juce::File& directory);
+
+            /** Returns the cache directory. */
+            juce::File getDirectory() const;
+
+            /** Sets the disk budget in bytes (default 8 GB). */
+            void setDiskBudget (juce::int64 numBytes);
+
+            /** Returns the disk budget in bytes. */
+            juce::int64 getDiskBudget() const noexcept;
+
+            /** Returns the size of all cache files in bytes. */
+            juce::int64 getDiskUsage() const;
+
+            /** Sets the sample format of new cache files: 16 or 24 bit integer, 32 bit floating point (default). */
+            void setBitsPerSample (int bitsPerSample);
+
+            /** Returns the sample format of new cache files. */
+            int getBitsPerSample() const noexcept;
+
+            /** Deletes all cache files that are not mapped. */
+            void clear();
+
+        //==========================================================================
+        private:
+            MP4DecodedAudioCache() = default;
+
+            juce::CriticalSection lock;
+            juce::File directory;
+            juce::int64 diskBudget = (juce::int64) 8 * 1024 * 1024 * 1024;
+            int bitsPerSample = 32;
+
+            juce::File getCacheFileFor (const juce::File& file) const;
+            void removeOutdatedFiles (const juce::File& file, const juce::File& cacheFile) const;
+            void evict (const juce::File& cacheFile) const;
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4DecodedAudioCache)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
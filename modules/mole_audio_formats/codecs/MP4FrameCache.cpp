@@ -0,0 +1,138 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    //==============================================================================
+    MP4FrameCache::MP4FrameCache (size_t budget) : memoryBudget (budget)
+    {
+    }
+
+    //==============================================================================
+    bool MP4FrameCache::read (const MP4AudioIndex::Ptr& index, int frame, int numChannels, int numSamples, float* dest)
+    {
+        const size_t numValues = (size_t) numChannels * (size_t) numSamples;
+        const juce::ScopedLock sl (lock);
+
+        auto it = entryMap.find ({ index.get(), frame, numChannels });
+
+        if (it == entryMap.end() || it->second->numValues != numValues)
+        {
+            ++numMisses;
+            return false;
+        }
+
+        entries.splice (entries.begin(), entries, it->second);
+        memcpy (dest, it->second->samples.get(), numValues * sizeof (float));
+
+        ++numHits;
+        return true;
+    }
+
+    void MP4FrameCache::add (const MP4AudioIndex::Ptr& index, int frame, int numChannels, int numSamples, const float* samples)
+    {
+        const size_t numValues = (size_t) numChannels * (size_t) numSamples;
+        const size_t size = numValues * sizeof (float);
+        const Key key { index.get(), frame, numChannels };
+
+        const juce::ScopedLock sl (lock);
+
+        if (size > memoryBudget)
+            return;
+
+        auto it = entryMap.find (key);
+
+        if (it != entryMap.end())
+        {
+            memoryUsage -= it->second->numValues * sizeof (float);
+            entries.erase (it->second);
+            entryMap.erase (it);
+        }
+
+        // Reuse the memory of the least recently used entry if it has to go anyway.
+        Entry entry;
+
+        if (memoryUsage + size > memoryBudget && ! entries.empty() && entries.back().numValues == numValues)
+        {
+            entry.samples = std::move (entries.back().samples);
+            memoryUsage -= size;
+            entryMap.erase (entries.back().key);
+            entries.pop_back();
+        }
+        else
+        {
+            entry.samples.malloc (numValues);
+        }
+
+        entry.key = key;
+        entry.index = index;
+        entry.numValues = numValues;
+        memcpy (entry.samples.get(), samples, size);
+
+        memoryUsage += size;
+        entries.push_front (std::move (entry));
+        entryMap[key] = entries.begin();
+
+        evict();
+    }
+
+    //==============================================================================
+    void MP4FrameCache::setMemoryBudget (size_t numBytes)
+    {
+        const juce::ScopedLock sl (lock);
+
+        memoryBudget = numBytes;
+        evict();
+    }
+
+    size_t MP4FrameCache::getMemoryBudget() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return memoryBudget;
+    }
+
+    size_t MP4FrameCache::getMemoryUsage() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return memoryUsage;
+    }
+
+    juce::int64 MP4FrameCache::getNumHits() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return numHits;
+    }
+
+    juce::int64 MP4FrameCache::getNumMisses() const noexcept
+    {
+        const juce::ScopedLock sl (lock);
+        return numMisses;
+    }
+
+    void MP4FrameCache::clear()
+    {
+        const juce::ScopedLock sl (lock);
+
+        entryMap.clear();
+        entries.clear();
+        memoryUsage = 0;
+    }
+
+    //==============================================================================
+    void MP4FrameCache::evict()
+    {
+        while (memoryUsage > memoryBudget && ! entries.empty())
+        {
+            memoryUsage -= entries.back().numValues * sizeof (float);
+            entryMap.erase (entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
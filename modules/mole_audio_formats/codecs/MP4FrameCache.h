@@ -0,0 +1,107 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** LRU cache of decoded access units.
+     *
+     * Readers with a cache in their options (MP4AudioReaderOptions::withFrameCache())
+     * look up every access unit before decoding it and add the ones they
+     * decode, so looping and scrubbing over the same region decode it once.
+     * Entries are keyed by index and access unit, one cache can be shared by
+     * all readers of any number of files. The least recently used entries are
+     * dropped when the memory budget is exceeded.
+     *
+     * All methods are thread-safe.
+     */
+    class MP4FrameCache final : public juce::ReferenceCountedObject
+    {
+        //==========================================================================
+        public:
+            using Ptr = juce::ReferenceCountedObjectPtr<MP4FrameCache>;
+
+            /** Creates a cache.
+             *
+             * @param memoryBudget Memory budget in bytes.
+             */
+            explicit MP4FrameCache (size_t memoryBudget = 32 * 1024 * 1024);
+
+            /** Copies a cached access unit.
+             *
+             * @param index Index of the stream.
+             * @param frame Access unit.
+             * @param numChannels Number of interleaved channels.
+             * @param numSamples Number of samples per channel.
+             * @param dest Destination of numChannels * numSamples interleaved samples.
+             * @return True if the access unit was cached.
+             */
+            bool read (const MP4AudioIndex::Ptr& index, int frame, int numChannels, int numSamples, float* dest);
+
+            /** Adds a decoded access unit, replaces an existing entry. */
+            void add (const MP4AudioIndex::Ptr& index, int frame, int numChannels, int numSamples, const float* samples);
+
+            /** Sets the memory budget in bytes (0 disables caching). */
+            void setMemoryBudget (size_t numBytes);
+
+            /** Returns the memory budget in bytes. */
+            size_t getMemoryBudget() const noexcept;
+
+            /** Returns the memory used by cached access units in bytes. */
+            size_t getMemoryUsage() const noexcept;
+
+            /** Returns the number of successful reads. */
+            juce::int64 getNumHits() const noexcept;
+
+            /** Returns the number of reads of access units that were not cached. */
+            juce::int64 getNumMisses() const noexcept;
+
+            /** Removes all entries. */
+            void clear();
+
+        //==========================================================================
+        private:
+            struct Key
+            {
+                const MP4AudioIndex* index;
+                int frame;
+                int numChannels;
+
+                bool operator< (const Key& other) const noexcept
+                {
+                    return std::tie (index, frame, numChannels) < std::tie (other.index, other.frame, other.numChannels);
+                }
+            };
+
+            struct Entry
+            {
+                Key key;
+                MP4AudioIndex::Ptr index; // keeps the key address unique
+                juce::HeapBlock<float> samples;
+                size_t numValues = 0;
+            };
+
+            using EntryList = std::list<Entry>;
+
+            juce::CriticalSection lock;
+            EntryList entries; // most recently used first
+            std::map<Key, EntryList::iterator> entryMap;
+            size_t memoryBudget;
+            size_t memoryUsage = 0;
+            juce::int64 numHits = 0;
+            juce::int64 numMisses = 0;
+
+            void evict();
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4FrameCache)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,368 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    //==============================================================================
+    namespace {
+        // Level sidecar file layout (native byte order): header, then the blocks
+        // of each level from level 0 up, one block per channel in each.
+        struct LevelSidecarHeader
+        {
+            char magic[8];
+            juce::uint32 version;
+            juce::uint32 numChannels;
+            juce::int64 sourceSize;
+            juce::int64 sourceModificationTime;
+            double sampleRate;
+            juce::int64 lengthInSamples;
+            juce::int32 samplesPerBlock;
+            juce::int32 numLevels;
+        };
+
+        static_assert (sizeof (LevelSidecarHeader) % 8 == 0, "Level sidecar blocks must stay aligned");
+
+        constexpr char levelSidecarMagic[8] = { 'M', 'O', 'L', 'E', 'L', 'V', 'L', '\0' };
+        constexpr juce::uint32 levelSidecarVersion = 1;
+    } // namespace
+
+    //==============================================================================
+    MP4LevelPyramid::Builder::Builder (double sampleRate, unsigned int numChannels, juce::int64 lengthInSamples, int samplesPerBlock)
+    {
+        if (lengthInSamples <= 0 || numChannels == 0 || samplesPerBlock <= 0
+            || (lengthInSamples + samplesPerBlock - 1) / samplesPerBlock > std::numeric_limits<int>::max() / 2)
+            return;
+
+        pyramid = new MP4LevelPyramid();
+        pyramid->sampleRate = sampleRate;
+        pyramid->numChannels = numChannels;
+        pyramid->lengthInSamples = lengthInSamples;
+        pyramid->samplesPerBlock = samplesPerBlock;
+
+        lows.resize (numChannels);
+        highs.resize (numChannels);
+        sums.resize (numChannels);
+    }
+
+    void MP4LevelPyramid::Builder::addSamples (const float* const* channels, int numSamples)
+    {
+        if (pyramid == nullptr)
+            return;
+
+        const int blockSize = pyramid->samplesPerBlock;
+        numSamples = (int) juce::jmin ((juce::int64) numSamples, pyramid->lengthInSamples - position);
+
+        for (int offset = 0; offset < numSamples;)
+        {
+            const int numInBlock = juce::jmin (blockSize - blockPosition, numSamples - offset);
+
+            for (size_t ch = 0; ch < lows.size(); ++ch)
+            {
+                const float* samples = channels[ch] + offset;
+                const auto range = juce::FloatVectorOperations::findMinAndMax (samples, numInBlock);
+                double sum = 0;
+
+                for (int i = 0; i < numInBlock; ++i)
+                    sum += (double) samples[i] * samples[i];
+
+                lows[ch] = (blockPosition == 0) ? range.getStart() : juce::jmin (lows[ch], range.getStart());
+                highs[ch] = (blockPosition == 0) ? range.getEnd() : juce::jmax (highs[ch], range.getEnd());
+                sums[ch] = (blockPosition == 0) ? sum : sums[ch] + sum;
+            }
+
+            offset += numInBlock;
+            position += numInBlock;
+            blockPosition += numInBlock;
+
+            if (blockPosition == blockSize || position == pyramid->lengthInSamples)
+                addBlock();
+        }
+    }
+
+    /* Adds the levels of the block being added to level 0. */
+    void MP4LevelPyramid::Builder::addBlock()
+    {
+        for (size_t ch = 0; ch < lows.size(); ++ch)
+        {
+            // Rounded outward, so the waveform never looks quieter than the audio.
+            Block block;
+            block.low = (juce::int16) std::floor (juce::jlimit (-1.0f, 1.0f, lows[ch]) * 32767.0f);
+            block.high = (juce::int16) std::ceil (juce::jlimit (-1.0f, 1.0f, highs[ch]) * 32767.0f);
+            block.rms = (juce::uint16) juce::roundToInt (juce::jmin (1.0, std::sqrt (sums[ch] / blockPosition)) * 65535.0);
+
+            pyramid->table.push_back (block);
+        }
+
+        blockPosition = 0;
+    }
+
+    MP4LevelPyramid::Ptr MP4LevelPyramid::Builder::finish()
+    {
+        if (pyramid == nullptr || position != pyramid->lengthInSamples)
+            return nullptr;
+
+        // Level 0 takes three quarters of the table, the levels above the rest.
+        pyramid->table.reserve (pyramid->table.size() + pyramid->table.size() / 3 + 32 * (size_t) pyramid->numChannels);
+        pyramid->addLevels();
+
+        Ptr finished (pyramid);
+        pyramid = nullptr;
+
+        return finished;
+    }
+
+    //==============================================================================
+    MP4LevelPyramid::Ptr MP4LevelPyramid::createFrom (juce::AudioFormatReader& reader, int blockSize)
+    {
+        if (reader.lengthInSamples <= 0 || reader.numChannels == 0 || blockSize <= 0)
+            return nullptr;
+
+        Builder builder (reader.sampleRate, reader.numChannels, reader.lengthInSamples, blockSize);
+        juce::AudioBuffer<float> buffer ((int) reader.numChannels, 65536);
+
+        for (juce::int64 position = 0; position < reader.lengthInSamples; position += buffer.getNumSamples())
+        {
+            const int numToRead = (int) juce::jmin ((juce::int64) buffer.getNumSamples(), reader.lengthInSamples - position);
+
+            if (! reader.read (&buffer, 0, numToRead, position, true, true))
+                return nullptr;
+
+            builder.addSamples (buffer.getArrayOfReadPointers(), numToRead);
+        }
+
+        return builder.finish();
+    }
+
+    /* Combines every four blocks of the top level into a new level until a level has a single block. */
+    void MP4LevelPyramid::addLevels()
+    {
+        const size_t numChannelsInBlock = numChannels;
+        std::vector<size_t> offsets { 0 };
+
+        levelNumBlocks.assign (1, (int) (table.size() / numChannelsInBlock));
+
+        while (levelNumBlocks.back() > 1)
+        {
+            const int numBelow = levelNumBlocks.back();
+            const int numBlocks = (numBelow + (1 << levelShift) - 1) >> levelShift;
+            const size_t below = offsets.back();
+            const size_t offset = table.size();
+
+            table.resize (offset + (size_t) numBlocks * numChannelsInBlock);
+
+            for (int b = 0; b < numBlocks; ++b)
+            {
+                const int first = b << levelShift;
+                const int last = juce::jmin (numBelow, first + (1 << levelShift));
+
+                for (size_t ch = 0; ch < numChannelsInBlock; ++ch)
+                {
+                    Block combined = table[below + (size_t) first * numChannelsInBlock + ch];
+                    double sum = (double) combined.rms * combined.rms;
+
+                    for (int i = first + 1; i < last; ++i)
+                    {
+                        const Block& block = table[below + (size_t) i * numChannelsInBlock + ch];
+                        combined.low = juce::jmin (combined.low, block.low);
+                        combined.high = juce::jmax (combined.high, block.high);
+                        sum += (double) block.rms * block.rms;
+                    }
+
+                    combined.rms = (juce::uint16) juce::roundToInt (std::sqrt (sum / (last - first)));
+                    table[offset + (size_t) b * numChannelsInBlock + ch] = combined;
+                }
+            }
+
+            offsets.push_back (offset);
+            levelNumBlocks.push_back (numBlocks);
+        }
+
+        // The table does not grow any more, the level pointers stay valid.
+        levels.clear();
+
+        for (size_t offset : offsets)
+            levels.push_back (table.data() + offset);
+    }
+
+    //==============================================================================
+    MP4LevelPyramid::Ptr MP4LevelPyramid::createFromSidecar (const juce::File& sidecarFile, const juce::File& sourceFile)
+    {
+        if (! sidecarFile.existsAsFile())
+            return nullptr;
+
+        auto mapped = std::make_unique<juce::MemoryMappedFile> (sidecarFile, juce::MemoryMappedFile::readOnly);
+        const size_t mappedSize = mapped->getSize();
+
+        if (mapped->getData() == nullptr || mappedSize < sizeof (LevelSidecarHeader))
+            return nullptr;
+
+        const auto* data = static_cast<const char*> (mapped->getData());
+        const auto* header = reinterpret_cast<const LevelSidecarHeader*> (data);
+
+        if (memcmp (header->magic, levelSidecarMagic, sizeof (levelSidecarMagic)) != 0
+            || header->version != levelSidecarVersion
+            || header->sourceSize != sourceFile.getSize()
+            || header->sourceModificationTime != sourceFile.getLastModificationTime().toMilliseconds()
+            || header->numChannels == 0 || header->samplesPerBlock <= 0 || header->lengthInSamples <= 0
+            || header->numLevels <= 0 || header->numLevels > 32)
+            return nullptr;
+
+        Ptr pyramid (new MP4LevelPyramid());
+        pyramid->sampleRate = header->sampleRate;
+        pyramid->numChannels = header->numChannels;
+        pyramid->lengthInSamples = header->lengthInSamples;
+        pyramid->samplesPerBlock = header->samplesPerBlock;
+
+        // The number of blocks of each level follows from the length, as in addLevels().
+        juce::int64 numBlocks = (header->lengthInSamples + header->samplesPerBlock - 1) / header->samplesPerBlock;
+        size_t offset = sizeof (LevelSidecarHeader);
+
+        for (int level = 0; level < header->numLevels; ++level)
+        {
+            if (numBlocks > std::numeric_limits<int>::max() / 2)
+                return nullptr;
+
+            pyramid->levels.push_back (reinterpret_cast<const Block*> (data + offset));
+            pyramid->levelNumBlocks.push_back ((int) numBlocks);
+
+            offset += (size_t) numBlocks * header->numChannels * sizeof (Block);
+            numBlocks = (numBlocks + (1 << levelShift) - 1) >> levelShift;
+        }
+
+        if (offset > mappedSize || pyramid->levelNumBlocks.back() != 1)
+            return nullptr;
+
+        pyramid->sidecar = std::move (mapped);
+
+        return pyramid;
+    }
+
+    bool MP4LevelPyramid::writeSidecar (const juce::File& sidecarFile, const juce::File& sourceFile) const
+    {
+        LevelSidecarHeader header = {};
+        memcpy (header.magic, levelSidecarMagic, sizeof (levelSidecarMagic));
+        header.version = levelSidecarVersion;
+        header.numChannels = numChannels;
+        header.sourceSize = sourceFile.getSize();
+        header.sourceModificationTime = sourceFile.getLastModificationTime().toMilliseconds();
+        header.sampleRate = sampleRate;
+        header.lengthInSamples = lengthInSamples;
+        header.samplesPerBlock = samplesPerBlock;
+        header.numLevels = (juce::int32) levels.size();
+
+        juce::TemporaryFile temp (sidecarFile);
+        bool ok = false;
+
+        if (auto out = temp.getFile().createOutputStream())
+        {
+            ok = out->write (&header, sizeof (header));
+
+            for (size_t level = 0; level < levels.size() && ok; ++level)
+                ok = out->write (levels[level], (size_t) levelNumBlocks[level] * numChannels * sizeof (Block));
+
+            out->flush();
+            ok = ok && out->getStatus().wasOk();
+        }
+
+        return ok && temp.overwriteTargetFileWithTemporary();
+    }
+
+    //==============================================================================
+    /* Calls function (blocks, numLevel0Blocks) for the blocks that cover a range, blocks points to the
+       ones of all channels. Whole blocks of a level are taken where they fit inside the range, the
+       blocks before and after them come from the levels below, down to level 0 at the ends. */
+    template <typename Function>
+    void MP4LevelPyramid::forEachBlock (juce::int64 startSample, juce::int64 numSamples, Function&& function) const noexcept
+    {
+        startSample = juce::jmax ((juce::int64) 0, startSample);
+        numSamples = juce::jmin (numSamples, lengthInSamples - startSample);
+
+        if (numSamples <= 0 || levels.empty())
+            return;
+
+        // Level 0 blocks that touch the range.
+        juce::int64 first = startSample / samplesPerBlock;
+        juce::int64 end = juce::jmin ((juce::int64) levelNumBlocks[0], (startSample + numSamples - 1) / samplesPerBlock + 1);
+        const juce::int64 mask = (1 << levelShift) - 1;
+
+        for (size_t level = 0; first < end; ++level)
+        {
+            const auto take = [&] (juce::int64 block)
+            {
+                function (levels[level] + (size_t) block * numChannels, (juce::int64) 1 << (level * levelShift));
+            };
+
+            if (level + 1 == levels.size())
+            {
+                for (; first < end; ++first)
+                    take (first);
+
+                break;
+            }
+
+            // Blocks up to the next whole block of the level above, at both ends.
+            for (; first < end && (first & mask) != 0; ++first)
+                take (first);
+
+            for (; first < end && (end & mask) != 0 && end != levelNumBlocks[level]; --end)
+                take (end - 1);
+
+            if (first >= end)
+                break;
+
+            first >>= levelShift;
+            end = (end + mask) >> levelShift;
+        }
+    }
+
+    void MP4LevelPyramid::readMaxLevels (juce::int64 startSample, juce::int64 numSamples,
+                                         juce::Range<float>* results, int numChannelsToRead) const noexcept
+    {
+        for (int ch = 0; ch < numChannelsToRead; ++ch)
+        {
+            results[ch] = juce::Range<float>();
+
+            if (ch >= (int) numChannels)
+                continue;
+
+            int low = 0, high = 0;
+            bool found = false;
+
+            forEachBlock (startSample, numSamples, [&] (const Block* blocks, juce::int64)
+            {
+                low = found ? juce::jmin (low, (int) blocks[ch].low) : blocks[ch].low;
+                high = found ? juce::jmax (high, (int) blocks[ch].high) : blocks[ch].high;
+                found = true;
+            });
+
+            if (found)
+                results[ch] = juce::Range<float> ((float) low / 32767.0f, (float) high / 32767.0f);
+        }
+    }
+
+    float MP4LevelPyramid::getRMSLevel (int channel, juce::int64 startSample, juce::int64 numSamples) const noexcept
+    {
+        if (! juce::isPositiveAndBelow (channel, (int) numChannels))
+            return 0.0f;
+
+        double sum = 0;
+        juce::int64 numBlocks = 0;
+
+        // Blocks of the levels above stand for this many blocks of level 0.
+        forEachBlock (startSample, numSamples, [&] (const Block* blocks, juce::int64 numLevel0Blocks)
+        {
+            const double rms = blocks[channel].rms / 65535.0;
+            sum += rms * rms * (double) numLevel0Blocks;
+            numBlocks += numLevel0Blocks;
+        });
+
+        return (numBlocks > 0) ? (float) std::sqrt (sum / (double) numBlocks) : 0.0f;
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,182 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Multi-resolution min, max and RMS levels of a stream, for waveforms.
+     *
+     * Level 0 holds the levels of every block of samples (256 by default),
+     * each level above combines four blocks of the one below, up to a single
+     * block for the whole stream. readMaxLevels() covers a range with blocks
+     * of the coarsest levels that fit inside it and finer ones towards its
+     * ends, at most six blocks per level, so drawing a waveform costs
+     * O(pixels) at any zoom, without decoding.
+     *
+     * Levels are stored as 16-bit values, 6 bytes per block and channel, and
+     * about a third more for the levels above level 0: a stereo hour at 48 kHz
+     * takes about 10 MB. A pyramid is built once, from the samples of a read
+     * from start to end (see Builder), and can be written to a memory-mappable
+     * sidecar file, which is mapped on later opens. Readers without a pyramid
+     * build one while they read the whole stream and write its sidecar (see
+     * MP4AudioFormat::getLevelPyramidFor()).
+     *
+     * A pyramid is immutable and reference counted, any number of readers on
+     * any number of threads can share it (see MP4AudioReaderOptions::withLevelPyramid()).
+     */
+    class MP4LevelPyramid final : public juce::ReferenceCountedObject
+    {
+        //==========================================================================
+        public:
+            using Ptr = juce::ReferenceCountedObjectPtr<MP4LevelPyramid>;
+
+            //==========================================================================
+            /** Builds a pyramid from the samples of a stream, in stream order.
+             *
+             * Samples can be added in blocks of any size, e.g. as a reader reads
+             * them, the levels above level 0 are added once the last sample is.
+             */
+            class Builder final
+            {
+                public:
+                    /** Creates a builder for a stream.
+                     *
+                     * @param sampleRate Sample rate of the stream.
+                     * @param numChannels Number of channels of the stream.
+                     * @param lengthInSamples Stream length in samples.
+                     * @param samplesPerBlock Samples per block of level 0.
+                     */
+                    Builder (double sampleRate, unsigned int numChannels, juce::int64 lengthInSamples, int samplesPerBlock = 256);
+
+                    /** Adds the next samples of the stream, samples beyond its length are left out.
+                     *
+                     * @param channels One channel per channel of the stream.
+                     * @param numSamples Number of samples per channel.
+                     */
+                    void addSamples (const float* const* channels, int numSamples);
+
+                    /** Returns the number of samples added. */
+                    juce::int64 getNumSamples() const noexcept          { return position; }
+
+                    /** Returns the pyramid once every sample of the stream was added.
+                     *
+                     * @return Pyramid, or nullptr if samples are missing or the stream is empty.
+                     */
+                    Ptr finish();
+
+                private:
+                    Ptr pyramid;
+                    juce::int64 position = 0;
+                    int blockPosition = 0; // samples in the block being added
+
+                    // Levels of the block being added, per channel.
+                    std::vector<float> lows, highs;
+                    std::vector<double> sums; // sum of squares
+
+                    void addBlock();
+
+                    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Builder)
+            };
+
+            /** Builds a pyramid by reading the whole stream.
+             *
+             * @param reader Reader of the stream, read from start to end with a Builder.
+             * @param samplesPerBlock Samples per block of level 0.
+             * @return Pyramid or nullptr if the stream is empty or cannot be read.
+             */
+            static Ptr createFrom (juce::AudioFormatReader& reader, int samplesPerBlock = 256);
+
+            /** Maps a sidecar file written by writeSidecar().
+             *
+             * The sidecar is validated against the size and modification time of
+             * the source file, its levels are used directly from the mapping.
+             *
+             * @param sidecarFile Sidecar file to map.
+             * @param sourceFile File the sidecar was written for.
+             * @return Pyramid or nullptr if the sidecar is missing, outdated or invalid.
+             */
+            static Ptr createFromSidecar (const juce::File& sidecarFile, const juce::File& sourceFile);
+
+            /** Writes the pyramid to a memory-mappable sidecar file.
+             *
+             * The file is written to a temporary file first and then renamed, so
+             * concurrent readers never see a partial sidecar.
+             *
+             * @param sidecarFile File to write.
+             * @param sourceFile File the pyramid was created from.
+             * @return True on success.
+             */
+            bool writeSidecar (const juce::File& sidecarFile, const juce::File& sourceFile) const;
+
+            /** Returns the lowest and highest sample of each channel in a range.
+             *
+             * The range is only widened to whole blocks of level 0, so the result
+             * includes less than a block of audio at either end.
+             *
+             * @param startSample First sample of the range.
+             * @param numSamples Number of samples in the range.
+             * @param results One range per channel, channels beyond the stream get empty ranges.
+             * @param numChannelsToRead Number of results.
+             */
+            void readMaxLevels (juce::int64 startSample, juce::int64 numSamples, juce::Range<float>* results, int numChannelsToRead) const noexcept;
+
+            /** Returns the RMS level of a channel in a range, widened to whole blocks of level 0 like readMaxLevels(). */
+            float getRMSLevel (int channel, juce::int64 startSample, juce::int64 numSamples) const noexcept;
+
+            /** Returns the sample rate of the stream. */
+            double getSampleRate() const noexcept                       { return sampleRate; }
+
+            /** Returns the number of channels. */
+            unsigned int getNumChannels() const noexcept                { return numChannels; }
+
+            /** Returns the stream length in samples. */
+            juce::int64 getLengthInSamples() const noexcept             { return lengthInSamples; }
+
+            /** Returns the number of samples per block of level 0. */
+            int getSamplesPerBlock() const noexcept                     { return samplesPerBlock; }
+
+            /** Returns the number of levels. */
+            int getNumLevels() const noexcept                           { return (int) levels.size(); }
+
+        //==========================================================================
+        private:
+            MP4LevelPyramid() = default;
+
+            // Levels of one block and channel, low and high in 1/32767, RMS in 1/65535.
+            struct Block
+            {
+                juce::int16 low;
+                juce::int16 high;
+                juce::uint16 rms;
+            };
+
+            static constexpr int levelShift = 2; // four blocks per block of the level above
+
+            double sampleRate = 0;
+            unsigned int numChannels = 0;
+            juce::int64 lengthInSamples = 0;
+            int samplesPerBlock = 256;
+
+            // Blocks of each level (block-major, one per channel), in the owned table or a mapped sidecar.
+            std::vector<const Block*> levels;
+            std::vector<int> levelNumBlocks;
+
+            std::vector<Block> table;
+            std::unique_ptr<juce::MemoryMappedFile> sidecar;
+
+            template <typename Function>
+            void forEachBlock (juce::int64 startSample, juce::int64 numSamples, Function&& function) const noexcept;
+            void addLevels();
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4LevelPyramid)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
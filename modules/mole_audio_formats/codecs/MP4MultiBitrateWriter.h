@@ -0,0 +1,423 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    namespace WindowsMediaFoundation {
+
+        using namespace Windows;
+
+        //=============================================================================
+        /** One stream of a MP4MultiBitrateWriter, encoded on its own thread.
+         *
+         * The thread joins the multithreaded apartment, creates the sink writer
+         * and writes the queued samples to it. The AAC encoder transform is
+         * synchronous and runs inside WriteSample(), so one thread per stream
+         * is what lets the streams encode side by side.
+         */
+        class MultiBitrateStream final : private juce::Thread
+        {
+            static constexpr size_t maxNumQueued = 16; // Write() waits for the encoder beyond this
+
+            juce::OutputStream* const stream;
+            const double sampleRate;
+            const int numChannels;
+            const UINT32 bytesPerSecond;
+
+            IMFSinkWriter* sinkWriter = nullptr;
+            DWORD streamIndex = 0;
+
+            juce::CriticalSection lock;
+            std::deque<IMFSample*> queue; // nullptr flushes the stream
+            bool isEnding = false;
+            bool shouldFinalize = false;
+            HRESULT result = S_OK;
+
+            juce::WaitableEvent started, sampleQueued, sampleTaken;
+
+            //=============================================================================
+            public:
+
+            MultiBitrateStream (juce::OutputStream* outputStream, double rate, int channels, UINT32 bytes)
+                : juce::Thread ("MP4 multi-bitrate stream"),
+                  stream (outputStream), sampleRate (rate), numChannels (channels), bytesPerSecond (bytes)
+            {
+            }
+
+            ~MultiBitrateStream() override
+            {
+                Finish (false);
+                SafeRelease (&sinkWriter);
+            }
+
+            /** Starts the thread, returns when it created the sink writer.  */
+            HRESULT Start()
+            {
+                if (! startThread())
+                    return E_FAIL;
+
+                started.wait();
+
+                return GetResult();
+            }
+
+            /** Queues a sample, waits while the encoder is too far behind.  */
+            HRESULT Write (IMFSample* sample)
+            {
+                for (;;)
+                {
+                    {
+                        const juce::ScopedLock sl (lock);
+
+                        if (FAILED (result) || isEnding)
+                            return FAILED (result) ? result : E_UNEXPECTED;
+
+                        if (queue.size() < maxNumQueued)
+                        {
+                            if (sample != nullptr)
+                                sample->AddRef();
+
+                            queue.push_back (sample);
+                            break;
+                        }
+                    }
+
+                    sampleTaken.wait (100);
+                }
+
+                sampleQueued.signal();
+
+                return S_OK;
+            }
+
+            /** Flushes the stream after the samples queued so far.  */
+            HRESULT Flush() { return Write (nullptr); }
+
+            /** Writes the queued samples, optionally finalizes the file, and stops the thread.  */
+            HRESULT Finish (bool finalize)
+            {
+                {
+                    const juce::ScopedLock sl (lock);
+
+                    if (! isEnding)
+                    {
+                        isEnding = true;
+                        shouldFinalize = finalize;
+                    }
+                }
+
+                sampleQueued.signal();
+                waitForThreadToExit (-1);
+
+                return GetResult();
+            }
+
+            /** Hands the sink writer over after Finish(), e.g. to an AsyncFinalizer.  */
+            IMFSinkWriter* ReleaseSinkWriter() noexcept
+            {
+                auto* writer = sinkWriter;
+                sinkWriter = nullptr;
+                return writer;
+            }
+
+            HRESULT GetResult()
+            {
+                const juce::ScopedLock sl (lock);
+                return result;
+            }
+
+            //=============================================================================
+            private:
+
+            void run() override
+            {
+                COMLibrary library;
+                MFPlatform platform;
+
+                HRESULT hr = library.InitializeMTA();
+                if (SUCCEEDED (hr)) hr = platform.Initialize();
+                if (SUCCEEDED (hr)) hr = MP4AudioFormatWriter::createSinkWriter (stream, sampleRate, numChannels, bytesPerSecond,
+                                                                                 &sinkWriter, &streamIndex);
+                SetResult (hr);
+                started.signal();
+
+                for (;;)
+                {
+                    IMFSample* sample = nullptr;
+                    bool hasSample = false, ending = false, finalize = false;
+
+                    {
+                        const juce::ScopedLock sl (lock);
+
+                        if (! queue.empty())
+                        {
+                            sample = queue.front();
+                            queue.pop_front();
+                            hasSample = true;
+                        }
+
+                        ending = isEnding;
+                        finalize = shouldFinalize;
+                    }
+
+                    if (hasSample)
+                    {
+                        sampleTaken.signal();
+
+                        // After a failure the queued samples are only released.
+                        if (SUCCEEDED (hr))
+                        {
+                            hr = (sample != nullptr) ? sinkWriter->WriteSample (streamIndex, sample) : sinkWriter->Flush (streamIndex);
+                            SetResult (hr);
+                        }
+
+                        SafeRelease (&sample);
+                        continue;
+                    }
+
+                    if (ending)
+                    {
+                        if (SUCCEEDED (hr) && finalize)
+                        {
+                            hr = sinkWriter->Finalize();
+                            SetResult (hr);
+                        }
+
+                        break;
+                    }
+
+                    sampleQueued.wait();
+                }
+
+                if (FAILED (hr))
+                    DBGAPI(hr);
+            }
+
+            void SetResult (HRESULT hr)
+            {
+                const juce::ScopedLock sl (lock);
+                result = hr;
+            }
+
+            JUCE_DECLARE_NON_COPYABLE (MultiBitrateStream)
+        };
+
+        //=============================================================================
+        /** Writes the same audio to several MP4 files, each at its own bit rate.
+         *
+         * The samples are converted to 16-bit PCM once per write() and the same
+         * Media Foundation sample is queued to every stream. Each stream has a
+         * thread that owns its sink writer and runs its encoder, so the streams
+         * are encoded in parallel; write() only waits for a stream that is 16
+         * samples behind.
+         *
+         * Requirements for audio format writer options are the ones of
+         * MP4AudioFormatWriter, the quality index is replaced per stream. The
+         * input is resampled once for all streams.
+         */
+        class MP4MultiBitrateWriter : public juce::AudioFormatWriter
+        {
+            COMLibrary library;
+            MFPlatform platform;
+
+            juce::OwnedArray<juce::OutputStream> streams;
+            juce::OwnedArray<MultiBitrateStream> encoders; // one per stream, deleted before the streams
+            juce::int64 numSamplesWritten = 0;
+
+            Dither dither;
+            const double encoderSampleRate = 0;
+            const bool useDither = false;
+
+            std::unique_ptr<ResamplingStage> resampling; // once for all streams
+
+            //=============================================================================
+            public:
+
+            MP4MultiBitrateWriter() = delete;
+
+            /** Starts a thread per stream, which creates the sink writer of the stream.
+             *
+             * @param outputStreams One stream per quality option, owned by the writer.
+             * @param options Sample rate, number of channels and bits per sample.
+             * @param qualityOptionIndices Quality option index of each stream (see MP4AudioFormat::getQualityOptions()).
+             * @param writerOptions Dither and sample rate conversion.
+             */
+            MP4MultiBitrateWriter (std::vector<std::unique_ptr<juce::OutputStream>>& outputStreams,
+                                   const juce::AudioFormatWriterOptions& options, const juce::Array<int>& qualityOptionIndices,
+                                   const MP4AudioWriterOptions& writerOptions = {})
+                : juce::AudioFormatWriter (nullptr, "MP4 file",
+                        options.getSampleRate(), options.getNumChannels(), options.getBitsPerSample()),
+                  encoderSampleRate ((writerOptions.getOutputSampleRate() > 0) ? writerOptions.getOutputSampleRate() : sampleRate),
+                  useDither (writerOptions.isDitherEnabled() && (bitsPerSample > 16 || encoderSampleRate != sampleRate))
+            {
+                usesFloatingPointData = (bitsPerSample == 32);
+
+                for (auto& stream : outputStreams)
+                    streams.add (stream.release());
+
+                HRESULT hr = (streams.size() > 0 && streams.size() == qualityOptionIndices.size()) ? S_OK : E_INVALIDARG;
+
+                if (SUCCEEDED (hr)) hr = library.Initialize();
+                if (SUCCEEDED (hr)) hr = platform.Initialize();
+
+                for (int i = 0; i < streams.size() && SUCCEEDED (hr); ++i)
+                {
+                    auto* encoder = encoders.add (new MultiBitrateStream (streams[i], encoderSampleRate, (int) numChannels,
+                            MP4AudioFormatWriter::getBytesPerSecond (qualityOptionIndices[i], (int) numChannels)));
+
+                    hr = encoder->Start();
+                }
+
+                if (SUCCEEDED (hr) && encoderSampleRate != sampleRate)
+                    resampling = std::make_unique<ResamplingStage> (sampleRate, encoderSampleRate, (int) numChannels,
+                                                                    writerOptions.getResamplerQuality());
+
+                if (FAILED (hr))
+                {
+                    DBGAPI(hr);
+
+                    sampleRate = 0;
+                    numChannels = 0;
+                    bitsPerSample = 0;
+
+                    encoders.clear();
+                }
+            }
+
+            ~MP4MultiBitrateWriter() override
+            {
+                if (resampling != nullptr && ! encoders.isEmpty())
+                {
+                    HRESULT hr = drainResampler();
+                    if (FAILED (hr)) DBGAPI(hr);
+                }
+
+                for (auto* encoder : encoders)
+                    encoder->Finish (true);
+
+                encoders.clear();
+            }
+
+            /** Completes the files on a background thread (see MP4AudioFormatWriter::finalizeAsync()).  */
+            void finalizeAsync (std::function<void (bool)> onFinished)
+            {
+                if (encoders.isEmpty())
+                {
+                    if (onFinished) onFinished (false);
+                    return;
+                }
+
+                if (resampling != nullptr)
+                {
+                    HRESULT hr = drainResampler();
+                    if (FAILED (hr)) DBGAPI(hr);
+                }
+
+                auto finalizer = std::make_unique<AsyncFinalizer> (std::move (onFinished));
+
+                // The encoders write their queued samples first, a failed stream fails the finalizer.
+                for (auto* encoder : encoders)
+                {
+                    const HRESULT hr = encoder->Finish (false);
+                    IMFSinkWriter* sinkWriter = encoder->ReleaseSinkWriter();
+
+                    if (FAILED (hr))
+                        SafeRelease (&sinkWriter);
+
+                    finalizer->AddSinkWriter (sinkWriter);
+                }
+
+                encoders.clear();
+
+                while (! streams.isEmpty())
+                    finalizer->AddStream (streams.removeAndReturn (0));
+
+                AsyncFinalizer::Start (std::move (finalizer));
+            }
+
+            //=============================================================================
+            bool flush() override
+            {
+                bool ok = ! encoders.isEmpty();
+
+                for (auto* encoder : encoders)
+                    ok = SUCCEEDED (encoder->Flush()) && ok;
+
+                return ok;
+            }
+
+            /** Returns the throughput of the sample rate conversion (see MP4AudioFormatWriter::getResamplerStatistics()).  */
+            MP4Resampler::Statistics getResamplerStatistics() const noexcept
+            {
+                return (resampling != nullptr) ? resampling->GetStatistics() : MP4Resampler::Statistics();
+            }
+
+            //=============================================================================
+            bool write (const int** samplesToWrite, int numSamples) override
+            {
+                HRESULT hr = encoders.isEmpty() ? E_UNEXPECTED : S_OK;
+
+                if (SUCCEEDED (hr))
+                {
+                    if (resampling != nullptr)
+                        hr = resampling->Process (samplesToWrite, numSamples, usesFloatingPointData,
+                                [this] (const int** resampled, int numResampled) { return writeSamples (resampled, numResampled, true); });
+                    else
+                        hr = writeSamples (samplesToWrite, numSamples, usesFloatingPointData);
+                }
+
+                if (FAILED (hr))
+                {
+                    DBGAPI(hr);
+                    return false;
+                }
+
+                return true;
+            }
+
+            //=============================================================================
+            private:
+
+            /** Converts samples at the encoder sample rate to 16 bits once and queues them to every stream.  */
+            HRESULT writeSamples (const int** samplesToWrite, int numSamples, bool isFloatingPoint)
+            {
+                const LONGLONG sampleTime = getTime (numSamplesWritten);
+                const LONGLONG duration = getTime (numSamplesWritten + numSamples) - sampleTime;
+
+                IMFSample* sample = nullptr;
+
+                // Converted once, the encoders only read the sample.
+                HRESULT hr = MP4AudioFormatWriter::createSample (samplesToWrite, (int) numChannels, numSamples,
+                        isFloatingPoint, useDither ? &dither : nullptr, sampleTime, duration, &sample);
+
+                for (int i = 0; i < encoders.size() && SUCCEEDED (hr); ++i)
+                    hr = encoders.getUnchecked (i)->Write (sample);
+
+                if (SUCCEEDED (hr)) numSamplesWritten += numSamples;
+
+                SafeRelease (&sample);
+
+                return hr;
+            }
+
+            /** Writes the samples still in the resampler, do not write afterwards.  */
+            HRESULT drainResampler()
+            {
+                return resampling->Drain ([this] (const int** resampled, int numResampled) { return writeSamples (resampled, numResampled, true); });
+            }
+
+            /** Returns the presentation time of a sample in 100 ns time units.  */
+            LONGLONG getTime (juce::int64 sampleNumber) const noexcept
+            {
+                return (LONGLONG) (sampleNumber * 10000000 / (juce::int64) encoderSampleRate);
+            }
+        };
+    } // namespace WindowsMediaFoundation
+
+#endif // JUCE_WINDOWS
+} // namespace mole
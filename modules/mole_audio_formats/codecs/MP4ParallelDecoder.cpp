@@ -0,0 +1,178 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    namespace {
+        // Segments are long enough that the pre-roll at the seams costs little.
+        constexpr int minFramesPerSegment = 128;
+
+        // Access units decoded per job run, the scheduler runs jobs of higher priority in between.
+        constexpr int framesPerRun = 32;
+    }
+
+    //==============================================================================
+    class MP4ParallelDecoder::Segment final : public MP4DecodeScheduler::Job
+    {
+        public:
+            struct Progress
+            {
+                std::atomic<int> numRemaining { 0 };
+                std::atomic<bool> hasError { false };
+                juce::WaitableEvent finished;
+            };
+
+            Segment (MP4ParallelDecoder& owner, std::unique_ptr<juce::AudioFormatReader>& segmentReader, juce::AudioBuffer<float>& dest,
+                     int startSampleInDest, juce::int64 startSampleInFile, int numSamplesToDecode, int samplesPerRun, Progress& segmentProgress)
+                : decoder (owner), reader (segmentReader), start (startSampleInFile), numSamples (numSamplesToDecode),
+                  numSamplesPerRun (samplesPerRun), progress (segmentProgress)
+            {
+                for (int ch = 0; ch < decoder.getNumChannels(); ++ch)
+                    channels.push_back (dest.getWritePointer (ch, startSampleInDest));
+
+                destChannels.resize (channels.size());
+            }
+
+            bool run() override
+            {
+                // Created on the worker, in its multithreaded apartment (see MP4DecodeScheduler).
+                if (reader == nullptr && ! progress.hasError)
+                    reader.reset (decoder.createReader());
+
+                const int n = juce::jmin (numSamplesPerRun, numSamples - numDecoded);
+
+                for (size_t ch = 0; ch < channels.size(); ++ch)
+                    destChannels[ch] = channels[ch] + numDecoded;
+
+                if (progress.hasError || reader == nullptr
+                    || ! reader->read (destChannels.data(), (int) destChannels.size(), start + numDecoded, n))
+                {
+                    progress.hasError = true;
+                    numDecoded = numSamples;
+                }
+                else
+                {
+                    numDecoded += n;
+                }
+
+                if (numDecoded < numSamples)
+                    return true;
+
+                if (--progress.numRemaining == 0)
+                    progress.finished.signal();
+
+                return false;
+            }
+
+        private:
+            MP4ParallelDecoder& decoder;
+            std::unique_ptr<juce::AudioFormatReader>& reader;
+            const juce::int64 start;
+            const int numSamples;
+            const int numSamplesPerRun;
+            Progress& progress;
+
+            std::vector<float*> channels;
+            std::vector<float*> destChannels;
+            int numDecoded = 0;
+    };
+
+    //==============================================================================
+    MP4ParallelDecoder::MP4ParallelDecoder (const juce::File& fileToDecode, MP4DecodeScheduler* s)
+        : file (fileToDecode), scheduler ((s != nullptr) ? *s : MP4DecodeScheduler::getInstance())
+    {
+        std::unique_ptr<juce::FileInputStream> stream (file.createInputStream());
+
+        if (stream == nullptr)
+            return;
+
+        index = MP4AudioIndexCache::getInstance().getIndexFor (file, *stream);
+
+        if (index == nullptr)
+            return;
+
+        // Only for the format, the segments decode with readers created on the workers.
+        if (std::unique_ptr<juce::AudioFormatReader> reader { createReader() })
+        {
+            sampleRate = reader->sampleRate;
+            numChannels = (int) reader->numChannels;
+            lengthInSamples = reader->lengthInSamples;
+
+            // Implicitly signalled SBR doubles the decoded sample rate.
+            samplesPerFrame = juce::roundToInt (index->getSamplesPerFrame() * reader->sampleRate / index->getSampleRate());
+        }
+    }
+
+    MP4ParallelDecoder::~MP4ParallelDecoder()
+    {
+    }
+
+    /* Creates a reader of the file that decodes on the calling thread, whatever the options of the format are. */
+    juce::AudioFormatReader* MP4ParallelDecoder::createReader() const
+    {
+        std::unique_ptr<juce::FileInputStream> stream (file.createInputStream());
+
+        return (stream != nullptr) ? MP4AudioFormat().createReaderFor (stream.release(), index, MP4AudioReaderOptions(), true) : nullptr;
+    }
+
+    //==============================================================================
+    bool MP4ParallelDecoder::read (juce::AudioBuffer<float>& dest, int startSampleInDest, juce::int64 startSampleInFile, int numSamples)
+    {
+        if (! isValid() || numSamples <= 0)
+            return false;
+
+        jassert (dest.getNumChannels() >= getNumChannels() && startSampleInDest + numSamples <= dest.getNumSamples());
+
+        const juce::int64 numFramesInRange = numSamples / samplesPerFrame + 1;
+        const int maxNumSegments = 2 * (scheduler.getNumWorkers() + 1); // room for load balancing
+        const int numSegments = (int) juce::jlimit ((juce::int64) 1, (juce::int64) maxNumSegments, numFramesInRange / minFramesPerSegment);
+
+        // Kept for later reads, each is created by the first segment that uses it.
+        if ((int) readers.size() < numSegments)
+            readers.resize ((size_t) numSegments);
+
+        Segment::Progress progress;
+        juce::OwnedArray<Segment> segments;
+
+        // Segments start at access unit boundaries, each reader pre-rolls before its first one.
+        juce::int64 segmentStart = startSampleInFile;
+        const juce::int64 end = startSampleInFile + numSamples;
+
+        for (int i = 0; i < numSegments; ++i)
+        {
+            juce::int64 segmentEnd = end;
+
+            if (i < numSegments - 1)
+            {
+                segmentEnd = startSampleInFile + (juce::int64) numSamples * (i + 1) / numSegments;
+                segmentEnd = juce::jmax (segmentStart, segmentEnd - segmentEnd % samplesPerFrame);
+            }
+
+            if (segmentEnd > segmentStart)
+                segments.add (new Segment (*this, readers[(size_t) i], dest, startSampleInDest + (int) (segmentStart - startSampleInFile),
+                                           segmentStart, (int) (segmentEnd - segmentStart), framesPerRun * samplesPerFrame, progress));
+
+            segmentStart = segmentEnd;
+        }
+
+        progress.numRemaining = segments.size();
+
+        for (auto* segment : segments)
+            scheduler.schedule (*segment, MP4DecodeScheduler::Priority::offline);
+
+        progress.finished.wait();
+
+        // Wait for the workers to let go of the jobs.
+        for (auto* segment : segments)
+            scheduler.remove (*segment);
+
+        return ! progress.hasError;
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,81 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Decodes long ranges of an MP4 or ADTS file on several threads.
+     *
+     * The range is split into segments at access unit boundaries. Each segment
+     * is decoded by its own reader, with the usual pre-roll before its first
+     * access unit, as offline jobs on a MP4DecodeScheduler. The readers are
+     * created on the workers, in their multithreaded COM apartment, and kept
+     * for later reads. The decoded samples are the same as the ones of a
+     * single reader.
+     *
+     * Meant for offline work on whole files (loudness scans, fingerprinting,
+     * transcoding); for streaming use the readers of MP4AudioFormat.
+     */
+    class MP4ParallelDecoder final
+    {
+        //==========================================================================
+        public:
+            /** Opens a file.
+             *
+             * @param file MP4 or ADTS file with AAC audio.
+             * @param scheduler Scheduler that decodes the segments, nullptr uses MP4DecodeScheduler::getInstance().
+             */
+            explicit MP4ParallelDecoder (const juce::File& file, MP4DecodeScheduler* scheduler = nullptr);
+
+            /** Destructor. */
+            ~MP4ParallelDecoder();
+
+            /** Returns true if the file was opened. */
+            bool isValid() const noexcept                   { return numChannels > 0; }
+
+            /** Returns the sample rate of the decoded samples. */
+            double getSampleRate() const noexcept           { return sampleRate; }
+
+            /** Returns the number of channels. */
+            int getNumChannels() const noexcept             { return numChannels; }
+
+            /** Returns the number of samples per channel. */
+            juce::int64 getLengthInSamples() const noexcept { return lengthInSamples; }
+
+            /** Decodes a range of samples, returns when all segments are decoded.
+             *
+             * @param dest Buffer with at least getNumChannels() channels.
+             * @param startSampleInDest Sample offset in the buffer.
+             * @param startSampleInFile First sample to decode.
+             * @param numSamples Number of samples per channel.
+             * @return False if the file is not open or decoding failed.
+             */
+            bool read (juce::AudioBuffer<float>& dest, int startSampleInDest, juce::int64 startSampleInFile, int numSamples);
+
+        //==========================================================================
+        private:
+            class Segment;
+
+            juce::File file;
+            MP4AudioIndex::Ptr index;
+            MP4DecodeScheduler& scheduler;
+            std::vector<std::unique_ptr<juce::AudioFormatReader>> readers; // one per segment, created on the workers
+            double sampleRate = 0;
+            int numChannels = 0;
+            juce::int64 lengthInSamples = 0;
+            int samplesPerFrame = 0;
+
+            juce::AudioFormatReader* createReader() const;
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4ParallelDecoder)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
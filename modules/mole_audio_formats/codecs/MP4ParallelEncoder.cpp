@@ -0,0 +1,455 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    using namespace mole::WindowsMediaFoundation;
+
+    namespace {
+        constexpr int samplesPerUnit = 1024; // AAC-LC access unit
+
+        // Segments are long enough that the overlap at the seams costs little.
+        constexpr int minUnitsPerSegment = 1024;
+
+        // Access units encoded before and after a segment, longer than the encoder delay.
+        constexpr int overlapUnits = 8;
+
+        // Longest lead-in of a segment encoded again after a failed check at its seam,
+        // before it is encoded from the input start of the segment before it.
+        constexpr int maxLeadInUnits = 64;
+
+        // Largest relative difference between the written and the target bit rate.
+        constexpr double maxBitRateError = 0.01;
+
+        // Size of the decoder input buffer per channel in bits (ISO/IEC 14496-3, 4.5.3).
+        constexpr int decoderBufferBitsPerChannel = 6144;
+
+        // Access units encoded per job run, the scheduler runs jobs of higher priority in between.
+        constexpr int unitsPerRun = 32;
+
+        /* Returns the window sequence and shape of the first channel element of a raw
+           AAC access unit as (sequence << 1) | shape, -1 if there is none. Leading data
+           stream and fill elements are skipped; of a 5.1 stream, the centre channel
+           element is read. */
+        int getWindowOf (const void* unit, size_t size)
+        {
+            const auto* data = static_cast<const juce::uint8*> (unit);
+            const size_t numBits = size * 8;
+            size_t bit = 0;
+
+            // Reads past the end leave bit beyond numBits.
+            const auto read = [&] (int n)
+            {
+                int value = 0;
+
+                if (bit + (size_t) n > numBits)
+                {
+                    bit = numBits + 1;
+                    return value;
+                }
+
+                for (; n > 0; --n, ++bit)
+                    value = (value << 1) | ((data[bit >> 3] >> (7 - (bit & 7))) & 1);
+
+                return value;
+            };
+
+            while (bit < numBits)
+            {
+                const int id = read (3);
+
+                if (id == 0 || id == 3)         // single channel or LFE element
+                {
+                    read (4 + 8);               // element_instance_tag, global_gain
+                }
+                else if (id == 1)               // channel pair element
+                {
+                    read (4);                   // element_instance_tag
+                    if (read (1) == 0)          // common_window
+                        read (8);               // global_gain of the first channel
+                }
+                else if (id == 4)               // data stream element
+                {
+                    read (4);
+                    const bool byteAlign = read (1) != 0;
+                    int count = read (8);
+                    if (count == 255) count += read (8);
+                    if (byteAlign) bit = (bit + 7) & ~(size_t) 7;
+                    bit += (size_t) count * 8;
+                    continue;
+                }
+                else if (id == 6)               // fill element
+                {
+                    int count = read (4);
+                    if (count == 15) count += read (8) - 1;
+                    bit += (size_t) count * 8;
+                    continue;
+                }
+                else
+                {
+                    return -1;
+                }
+
+                const int reserved = read (1);
+                const int sequence = read (2);
+                const int shape = read (1);
+
+                return (bit <= numBits && reserved == 0) ? (sequence << 1) | shape : -1;
+            }
+
+            return -1;
+        }
+    }
+
+    //==============================================================================
+    class MP4ParallelEncoder::Segment final : public MP4DecodeScheduler::Job
+    {
+        public:
+            struct Shared
+            {
+                Shared (const ReaderFactory& factory, double rate, UINT32 bytes)
+                    : createReader (factory), sampleRate (rate), bytesPerSecond (bytes) {}
+
+                const ReaderFactory& createReader;
+                const double sampleRate;
+                const UINT32 bytesPerSecond;
+                std::atomic<bool> hasError { false };
+                juce::WaitableEvent segmentFinished;
+            };
+
+            Segment (Shared& s, std::unique_ptr<juce::AudioFormatReader>& segmentReader, int channels,
+                     juce::int64 start, juce::int64 end, int first, int num)
+                : shared (s), reader (segmentReader), numChannels (channels), inputStart (start), inputEnd (end),
+                  position (start), firstUnit (first), numUnits (num)
+            {
+            }
+
+            bool run() override
+            {
+                HRESULT hr = shared.hasError ? E_ABORT : S_OK;
+
+                // The reader and the encoder are created and used on the worker threads, which joined the MTA.
+                if (SUCCEEDED (hr) && reader == nullptr)
+                {
+                    reader = shared.createReader();
+                    hr = (reader != nullptr) ? S_OK : E_FAIL;
+                }
+
+                if (SUCCEEDED (hr) && block.getNumSamples() == 0)
+                {
+                    block.setSize (numChannels, unitsPerRun * samplesPerUnit);
+                    pcm.malloc ((size_t) block.getNumSamples() * (size_t) numChannels);
+
+                    hr = encoder.Initialize (shared.sampleRate, numChannels, shared.bytesPerSecond, unitsPerRun * samplesPerUnit);
+                }
+
+                const int n = (int) juce::jmin ((juce::int64) block.getNumSamples(), inputEnd - position);
+
+                if (SUCCEEDED (hr) && ! reader->read (block.getArrayOfWritePointers(), numChannels, position, n))
+                    hr = E_FAIL;
+
+                if (SUCCEEDED (hr))
+                {
+                    juce::AudioFormatWriter::WriteHelper
+                        <juce::AudioData::Int16, juce::AudioData::Float32, juce::AudioData::LittleEndian>
+                        ::write (pcm.get(), numChannels, reinterpret_cast<const int* const*> (block.getArrayOfReadPointers()), n);
+
+                    hr = encoder.Encode (pcm.get(), n, units);
+                }
+
+                if (SUCCEEDED (hr))
+                {
+                    position += n;
+
+                    if (position < inputEnd)
+                        return true;
+
+                    hr = encoder.Drain (units);
+                }
+
+                if (FAILED (hr))
+                {
+                    if (hr != E_ABORT) DBGAPI(hr);
+                    shared.hasError = true;
+                }
+
+                block.setSize (0, 0);
+                pcm.free();
+
+                finished = true;
+                shared.segmentFinished.signal();
+
+                return false;
+            }
+
+            bool isFinished() const noexcept { return finished; }
+
+            /** Returns the first input sample of the encoder, lead-in included.  */
+            juce::int64 getInputStart() const noexcept { return inputStart; }
+
+            /** Returns the access units of the segment itself, without the overlap.  */
+            int getFirstUnit() const noexcept { return firstUnit; }
+            int getEndUnit() const noexcept   { return (numUnits < 0) ? units.GetNumUnits() : juce::jmin (units.GetNumUnits(), firstUnit + numUnits); }
+
+            const AACAccessUnits& getUnits() const noexcept { return units; }
+
+            void releaseUnits() { units.Clear(); }
+
+        private:
+            Shared& shared;
+            std::unique_ptr<juce::AudioFormatReader>& reader; // of the segment index, kept when the segment is encoded again
+            const int numChannels;
+            const juce::int64 inputStart;
+            const juce::int64 inputEnd;
+            juce::int64 position;
+            const int firstUnit;
+            const int numUnits; // -1 keeps all access units up to the end of the stream
+
+            AACEncoder encoder;
+            AACAccessUnits units;
+            juce::AudioBuffer<float> block;
+            juce::HeapBlock<juce::int16> pcm;
+            std::atomic<bool> finished { false };
+    };
+
+    //==============================================================================
+    MP4ParallelEncoder::MP4ParallelEncoder (MP4DecodeScheduler* s)
+        : scheduler ((s != nullptr) ? *s : MP4DecodeScheduler::getInstance())
+    {
+    }
+
+    //==============================================================================
+    bool MP4ParallelEncoder::write (ReaderFactory createReader, juce::OutputStream& stream, const juce::AudioFormatWriterOptions& options,
+                                    juce::int64 startSample, juce::int64 numSamples)
+    {
+        const double sampleRate = options.getSampleRate();
+        const int numChannels = options.getChannelLayout().has_value() ? options.getChannelLayout().value().size() : options.getNumChannels();
+
+        if ((sampleRate != 44100 && sampleRate != 48000) || (numChannels != 1 && numChannels != 2 && numChannels != 6))
+        {
+            DBGSTR("The specified sample rate or number of channels is not supported.");
+            return false;
+        }
+
+        statistics = {};
+
+        COMLibrary library;
+        MFPlatform platform;
+
+        HRESULT hr = library.Initialize();
+        if (SUCCEEDED (hr)) hr = platform.Initialize();
+
+        if (SUCCEEDED (hr))
+        {
+            // Only for the length, the segments read with readers created on the workers.
+            std::unique_ptr<juce::AudioFormatReader> reader (createReader != nullptr ? createReader() : nullptr);
+
+            if (reader == nullptr || reader->sampleRate != sampleRate || (int) reader->numChannels != numChannels)
+                return false;
+
+            if (numSamples < 0)
+                numSamples = reader->lengthInSamples - startSample;
+        }
+
+        if (numSamples <= 0)
+            return false;
+
+        const juce::int64 numUnits = (numSamples + samplesPerUnit - 1) / samplesPerUnit;
+        const int maxNumSegments = 2 * (scheduler.getNumWorkers() + 1); // room for load balancing
+        const int numSegments = (int) juce::jlimit ((juce::int64) 1, (juce::int64) maxNumSegments, numUnits / minUnitsPerSegment);
+        const UINT32 bytesPerSecond = MP4AudioFormatWriter::getBytesPerSecond (options.getQualityOptionIndex(), numChannels);
+
+        // Segments start at access unit boundaries, so their access units line up with the ones of a single encoder.
+        std::vector<juce::int64> unitStarts;
+
+        for (int i = 0; i <= numSegments; ++i)
+            unitStarts.push_back (numUnits * i / numSegments);
+
+        Segment::Shared shared (createReader, sampleRate, bytesPerSecond);
+        std::vector<std::unique_ptr<juce::AudioFormatReader>> readers ((size_t) numSegments); // one per segment, created on the workers
+        juce::OwnedArray<Segment> segments;
+
+        const auto createSegment = [&] (int i, int leadInUnits)
+        {
+            const bool isLast = (i == numSegments - 1);
+            const juce::int64 unitStart = unitStarts[(size_t) i];
+            const juce::int64 unitEnd = unitStarts[(size_t) i + 1];
+            const int firstUnit = (int) juce::jmin ((juce::int64) leadInUnits, unitStart);
+
+            const juce::int64 inputStart = startSample + (unitStart - firstUnit) * samplesPerUnit;
+            const juce::int64 inputEnd = isLast ? startSample + numSamples
+                                                : juce::jmin (startSample + numSamples, startSample + (unitEnd + overlapUnits) * samplesPerUnit);
+
+            return new Segment (shared, readers[(size_t) i], numChannels, inputStart, inputEnd, firstUnit, isLast ? -1 : (int) (unitEnd - unitStart));
+        };
+
+        if (SUCCEEDED (hr))
+        {
+            for (int i = 0; i < numSegments; ++i)
+                scheduler.schedule (*segments.add (createSegment (i, overlapUnits)), MP4DecodeScheduler::Priority::offline);
+        }
+
+        // Write the access units in order, while later segments are still being encoded.
+        // The output type comes from an encoder of this thread, the ones of the segments live on the workers.
+        MP4AccessUnitWriter writer;
+
+        if (SUCCEEDED (hr))
+        {
+            AACEncoder formatEncoder;
+            IMFMediaType* mediaType = nullptr;
+
+            hr = formatEncoder.Initialize (sampleRate, numChannels, bytesPerSecond, samplesPerUnit);
+            if (SUCCEEDED (hr)) hr = formatEncoder.GetOutputType (&mediaType);
+            if (SUCCEEDED (hr)) hr = writer.Initialize (&stream, mediaType);
+
+            SafeRelease (&mediaType);
+        }
+
+        const auto waitFor = [&] (const Segment& segment)
+        {
+            while (! segment.isFinished())
+                shared.segmentFinished.wait();
+
+            return shared.hasError ? E_FAIL : S_OK;
+        };
+
+        // Decoder buffer of a CBR stream: it gains the mean bits of an access unit per access unit.
+        const double meanBitsPerUnit = bytesPerSecond * 8.0 * samplesPerUnit / sampleRate;
+        const double bufferBits = (double) decoderBufferBitsPerChannel * numChannels;
+        double bufferFullness = bufferBits;
+
+        // Returns the number of access units of a segment the decoder buffer does not hold, from its fullness at the seam.
+        const auto countUnderflows = [&] (const Segment& segment)
+        {
+            const auto& units = segment.getUnits();
+            double fullness = bufferFullness;
+            int numUnderflows = 0;
+
+            for (int unit = segment.getFirstUnit(); unit < segment.getEndUnit(); ++unit)
+            {
+                const double bits = (double) units.GetSize (unit) * 8;
+
+                if (bits > fullness)
+                    ++numUnderflows;
+
+                fullness = juce::jmin (bufferBits, juce::jmax (0.0, fullness - bits) + meanBitsPerUnit);
+            }
+
+            return numUnderflows;
+        };
+
+        int lastWindow = -1;
+        juce::int64 numBytes = 0, numWrittenUnits = 0;
+
+        for (int i = 0; i < segments.size() && SUCCEEDED (hr); ++i)
+        {
+            hr = waitFor (*segments.getUnchecked (i));
+
+            if (SUCCEEDED (hr) && i > 0)
+                ++statistics.numSeams;
+
+            for (bool reencoded = false; SUCCEEDED (hr);)
+            {
+                auto* segment = segments.getUnchecked (i);
+                const int leadIn = segment->getFirstUnit();
+                const auto& units = segment->getUnits();
+                const int window = (leadIn > 0 && leadIn <= units.GetNumUnits())
+                                    ? getWindowOf (units.GetData (leadIn - 1), units.GetSize (leadIn - 1)) : -1;
+
+                const bool isSeamless = (i == 0) || (window >= 0 && window == lastWindow);
+                const int numUnderflows = isSeamless ? countUnderflows (*segment) : 0;
+
+                if (isSeamless && numUnderflows == 0)
+                    break;
+
+                // Double the lead-in up to the longest one, then start where the encoder of the segment
+                // before started: both encoders then run the same input from the same state up to the seam.
+                const int sequentialLeadIn = (i > 0) ? (int) (unitStarts[(size_t) i] - (segments.getUnchecked (i - 1)->getInputStart() - startSample) / samplesPerUnit) : 0;
+                const int nextLeadIn = juce::jmin ((leadIn < maxLeadInUnits) ? juce::jmin (leadIn * 2, maxLeadInUnits) : sequentialLeadIn, sequentialLeadIn);
+
+                if (nextLeadIn <= leadIn)
+                {
+                    if (! isSeamless)
+                        ++statistics.numMismatchedSeams;
+
+                    statistics.numReservoirUnderflows += numUnderflows;
+                    hr = E_FAIL;
+                    break;
+                }
+
+                if (! reencoded)
+                {
+                    ++statistics.numReencodedSeams;
+                    reencoded = true;
+                }
+
+                if (nextLeadIn == sequentialLeadIn)
+                    ++statistics.numSequentialSeams;
+
+                scheduler.remove (*segment);
+                segment = segments.set (i, createSegment (i, nextLeadIn), true);
+                scheduler.schedule (*segment, MP4DecodeScheduler::Priority::offline);
+
+                hr = waitFor (*segment);
+            }
+
+            auto* segment = segments.getUnchecked (i);
+            const auto& units = segment->getUnits();
+
+            for (int unit = segment->getFirstUnit(); unit < segment->getEndUnit() && SUCCEEDED (hr); ++unit)
+            {
+                const size_t size = units.GetSize (unit);
+
+                bufferFullness = juce::jmin (bufferBits, juce::jmax (0.0, bufferFullness - (double) size * 8) + meanBitsPerUnit);
+                numBytes += (juce::int64) size;
+                ++numWrittenUnits;
+
+                hr = writer.Write (units.GetData (unit), size);
+            }
+
+            if (SUCCEEDED (hr) && segment->getEndUnit() > segment->getFirstUnit())
+            {
+                const int last = segment->getEndUnit() - 1;
+                lastWindow = getWindowOf (units.GetData (last), units.GetSize (last));
+            }
+
+            segment->releaseUnits();
+        }
+
+        statistics.targetBitsPerSecond = bytesPerSecond * 8.0;
+
+        if (numWrittenUnits > 0)
+            statistics.bitsPerSecond = (double) numBytes * 8.0 * sampleRate / ((double) numWrittenUnits * samplesPerUnit);
+
+        // The stream is left unfinalized if the bit rate is off the target.
+        if (SUCCEEDED (hr) && std::abs (statistics.getBitRateError()) > maxBitRateError)
+        {
+            DBGSTR("The bit rate is more than 1% off the target.");
+            hr = E_FAIL;
+        }
+
+        if (SUCCEEDED (hr)) hr = writer.Finalize();
+
+        if (FAILED (hr))
+        {
+            DBGAPI(hr);
+            shared.hasError = true;
+        }
+
+        // Wait for the workers to let go of the jobs, then delete their readers.
+        for (auto* segment : segments)
+            scheduler.remove (*segment);
+
+        segments.clear();
+        readers.clear();
+
+        return SUCCEEDED (hr);
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,105 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Encodes audio of known length to MP4 on several threads.
+     *
+     * The input is split into segments at access unit boundaries. Each segment
+     * is encoded by its own AAC encoder, as offline jobs on a
+     * MP4DecodeScheduler. An encoder starts a few access units before its
+     * segment (the lead-in) and stops a few after it; only the access units
+     * of the segment itself are kept. The access units are written to the
+     * file in order, with the bit rate of the quality option.
+     *
+     * An access unit only cancels the MDCT alias of the one before it if its
+     * window sequence and shape follow on from it. At each seam the window of
+     * the last access unit kept from one segment is compared with the one the
+     * next encoder produced for the same input. The access units are also
+     * checked against the buffer of a CBR decoder, since the bit reservoir of
+     * each encoder starts empty. A segment that fails either check is encoded
+     * again with a longer lead-in, and at last from the input start of the
+     * segment before it, so both encoders run the same input from the same
+     * state up to the seam. If that fails as well, or the written bit rate is
+     * more than 1% off the target, write() fails; see getStatistics().
+     *
+     * Each segment reads the input with its own reader, created on the worker
+     * by a factory, so compressed input is decoded in parallel as well.
+     *
+     * Use it instead of AudioFormatWriter::writeFromAudioReader() for offline
+     * transcoding of long files.
+     */
+    class MP4ParallelEncoder final
+    {
+        //==========================================================================
+        public:
+            /** Creates a reader of the input, called on the scheduler threads, which joined the MTA. */
+            using ReaderFactory = std::function<std::unique_ptr<juce::AudioFormatReader>()>;
+
+            /** Creates an encoder.
+             *
+             * @param scheduler Scheduler that encodes the segments, nullptr uses MP4DecodeScheduler::getInstance().
+             */
+            explicit MP4ParallelEncoder (MP4DecodeScheduler* scheduler = nullptr);
+
+            /** Encodes a range of the input to a stream.
+             *
+             * The factory is called once on the calling thread for the length of
+             * the input, and once per segment on the scheduler threads, which
+             * read and encode their segments there. The readers are deleted
+             * before write() returns.
+             *
+             * @param createReader Creates readers of the input, with the sample rate and number of channels of the options.
+             * @param stream Output stream, not owned.
+             * @param options Sample rate (44100 or 48000), number of channels (1, 2 or 6) and quality option index
+             *                (see MP4AudioFormat::getQualityOptions()); the input is converted to 16 bits per sample.
+             * @param startSample First sample of the input.
+             * @param numSamples Number of samples, -1 encodes to the end of the input.
+             * @return False if the options are not supported, encoding failed, or a seam, the decoder buffer or
+             *         the bit rate failed its check; the stream is not finalized then.
+             */
+            bool write (ReaderFactory createReader, juce::OutputStream& stream, const juce::AudioFormatWriterOptions& options,
+                        juce::int64 startSample = 0, juce::int64 numSamples = -1);
+
+            //==========================================================================
+            /** Seam and bit rate checks of the last write(). */
+            struct Statistics
+            {
+                int numSeams = 0;                   /**< Seams between segments. */
+                int numReencodedSeams = 0;          /**< Seams encoded again with a longer lead-in. */
+                int numSequentialSeams = 0;         /**< Seams encoded again from the input start of the segment before. */
+                int numMismatchedSeams = 0;         /**< Seams whose windows still differ, write() failed. */
+                int numReservoirUnderflows = 0;     /**< Access units still larger than a CBR decoder buffer holds at that point, write() failed. */
+                double targetBitsPerSecond = 0;     /**< Bit rate of the quality option. */
+                double bitsPerSecond = 0;           /**< Bit rate of the access units. */
+
+                /** Returns the relative bit rate error, e.g. 0.01 for 1% above the target. */
+                double getBitRateError() const noexcept
+                {
+                    return (targetBitsPerSecond > 0) ? bitsPerSecond / targetBitsPerSecond - 1.0 : 0.0;
+                }
+            };
+
+            /** Returns the statistics of the last write(). */
+            const Statistics& getStatistics() const noexcept        { return statistics; }
+
+        //==========================================================================
+        private:
+            class Segment;
+
+            MP4DecodeScheduler& scheduler;
+            Statistics statistics;
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4ParallelEncoder)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,52 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Status interface of MP4 readers in real-time mode.
+     *
+     * A reader created with MP4AudioReaderOptions::withRealtimeMode() decodes
+     * on the scheduler only. Its readSamples() copies decoded samples from a
+     * lock-free ring and never blocks, locks or allocates, so it can be called
+     * on the audio thread. Samples that are not decoded yet are cleared and
+     * reported as an underrun; readSamples() then returns false.
+     *
+     * The ring has a single consumer: read on the audio thread only. Reads on
+     * other threads, e.g. to draw a waveform or export, race the audio thread
+     * and get underruns; give them their own reader without real-time mode.
+     * readMaxLevels() is only answered from a level pyramid (see
+     * MP4AudioReaderOptions::withLevelPyramid()), without one it asserts and
+     * returns empty ranges instead of decoding.
+     *
+     * Get the interface with a dynamic_cast of the AudioFormatReader. All
+     * methods must be called on the thread that reads.
+     */
+    class MP4RealtimeReader
+    {
+        //==========================================================================
+        public:
+            virtual ~MP4RealtimeReader() = default;
+
+            /** Returns true if the last read missed samples. */
+            virtual bool hasUnderrun() const noexcept = 0;
+
+            /** Returns the number of reads that missed samples. */
+            virtual int getNumUnderruns() const noexcept = 0;
+
+            /** Returns true if the samples of a range are decoded. */
+            virtual bool isReady (juce::int64 startSampleInFile, int numSamples) const noexcept = 0;
+
+            /** Moves the decode-ahead to a position, call it ahead of a seek to avoid an underrun. */
+            virtual void prepareToRead (juce::int64 startSampleInFile) noexcept = 0;
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
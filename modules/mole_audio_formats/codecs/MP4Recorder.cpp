@@ -0,0 +1,187 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    //==============================================================================
+    /** Keeps the background thread in the multithreaded apartment and Media Foundation started while the writer lives.  */
+    class MP4Recorder::Apartment final
+    {
+        public:
+            Apartment()
+            {
+                if (SUCCEEDED (library.InitializeMTA()))
+                    platform.Initialize();
+            }
+
+        private:
+            Windows::COMLibrary library;
+            Windows::MFPlatform platform;
+    };
+
+    //==============================================================================
+    MP4Recorder::MP4Recorder (WriterFactory createWriter, int numChannels, juce::TimeSliceThread& backgroundThread, int numSamplesToBuffer)
+        : writerFactory (std::move (createWriter)), thread (backgroundThread),
+          fifo (juce::jmax (4096, numSamplesToBuffer)),
+          buffer (numChannels, fifo.getTotalSize())
+    {
+        jassert (writerFactory != nullptr && numChannels > 0);
+
+        thread.addTimeSliceClient (this);
+    }
+
+    MP4Recorder::~MP4Recorder()
+    {
+        // The writer is completed and deleted on the thread that created it.
+        stopping = true;
+        thread.moveToFrontOfQueue (this);
+
+        while (! closed.wait (100))
+        {
+            if (! thread.isThreadRunning())
+            {
+                jassertfalse; // the background thread must run until the recorder is deleted
+                break;
+            }
+        }
+
+        thread.removeTimeSliceClient (this);
+
+        if (! isClosed)
+        {
+            while (writePendingData() > 0)
+            {
+            }
+
+            writer.reset();
+
+            // The COM state belonged to the stopped thread, uninitializing it here would unbalance this thread.
+            juce::ignoreUnused (apartment.release());
+        }
+    }
+
+    /* Joins the multithreaded apartment on the background thread and creates the writer there. */
+    void MP4Recorder::openWriter()
+    {
+        isOpen = true;
+        apartment = std::make_unique<Apartment>();
+        writer = writerFactory();
+
+        if (writer == nullptr || (int) writer->getNumChannels() != buffer.getNumChannels())
+        {
+            jassertfalse; // the writer must have the number of channels of the recorder
+            writer.reset();
+            writeError = true;
+        }
+    }
+
+    /* Writes the samples still in the FIFO, completes the file and leaves the apartment, on the background thread. */
+    void MP4Recorder::closeWriter()
+    {
+        while (writePendingData() > 0)
+        {
+        }
+
+        writer.reset();
+        apartment.reset();
+
+        isClosed = true;
+        closed.signal();
+    }
+
+    //==============================================================================
+    bool MP4Recorder::write (const float* const* data, int numSamples) noexcept
+    {
+        if (numSamples <= 0)
+            return true;
+
+        if (numSamples > fifo.getFreeSpace())
+        {
+            ++numOverflows;
+            numSamplesDropped += numSamples;
+            return false;
+        }
+
+        {
+            const auto scope = fifo.write (numSamples);
+
+            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            {
+                if (scope.blockSize1 > 0) buffer.copyFrom (ch, scope.startIndex1, data[ch], scope.blockSize1);
+                if (scope.blockSize2 > 0) buffer.copyFrom (ch, scope.startIndex2, data[ch] + scope.blockSize1, scope.blockSize2);
+            }
+        }
+
+        const int numBuffered = fifo.getNumReady();
+        int maxBuffered = maxNumSamplesBuffered.load();
+
+        while (numBuffered > maxBuffered && ! maxNumSamplesBuffered.compare_exchange_weak (maxBuffered, numBuffered))
+        {
+        }
+
+        return true;
+    }
+
+    //==============================================================================
+    MP4Recorder::Statistics MP4Recorder::getStatistics() const noexcept
+    {
+        Statistics statistics;
+        statistics.numOverflows = numOverflows;
+        statistics.numSamplesDropped = numSamplesDropped;
+        statistics.maxNumSamplesBuffered = maxNumSamplesBuffered;
+        statistics.fifoSize = fifo.getTotalSize() - 1; // one slot stays empty
+        return statistics;
+    }
+
+    void MP4Recorder::resetStatistics() noexcept
+    {
+        numOverflows = 0;
+        numSamplesDropped = 0;
+        maxNumSamplesBuffered = 0;
+    }
+
+    //==============================================================================
+    int MP4Recorder::useTimeSlice()
+    {
+        if (isClosed)
+            return 100; // until the destructor removes the recorder
+
+        if (! isOpen)
+            openWriter();
+
+        if (stopping)
+        {
+            closeWriter();
+            return 100;
+        }
+
+        // Wait a little when the FIFO is empty, the writer collects AAC frames anyway.
+        return (writePendingData() > 0) ? 0 : 10;
+    }
+
+    int MP4Recorder::writePendingData()
+    {
+        const int numToDo = fifo.getNumReady();
+
+        if (numToDo <= 0)
+            return 0;
+
+        const auto scope = fifo.read (numToDo);
+
+        // Without a writer the samples are only taken out of the FIFO.
+        if (writer != nullptr && ! writeError && scope.blockSize1 > 0)
+            writeError = ! writer->writeFromAudioSampleBuffer (buffer, scope.startIndex1, scope.blockSize1);
+
+        if (writer != nullptr && ! writeError && scope.blockSize2 > 0)
+            writeError = ! writer->writeFromAudioSampleBuffer (buffer, scope.startIndex2, scope.blockSize2);
+
+        return numToDo;
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
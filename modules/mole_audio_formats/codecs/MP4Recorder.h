@@ -0,0 +1,108 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Records from an audio callback to a writer on a background thread.
+     *
+     * The same idea as AudioFormatWriter::ThreadedWriter: write() copies the
+     * samples into a lock-free FIFO and returns, a TimeSliceThread passes them
+     * to the writer, where encoding and IMFSinkWriter::WriteSample() may
+     * block. Samples that do not fit into the FIFO are dropped and counted,
+     * so the audio thread never waits.
+     *
+     * The writer lives on the background thread: the recorder joins the
+     * multithreaded COM apartment and starts Media Foundation there, then
+     * creates the writer with a factory on the first time slice. The
+     * destructor has the background thread complete and delete the writer.
+     *
+     * Many recorders can share one TimeSliceThread; for dozens of 5.1 streams,
+     * spread them over a few threads so the encoders keep up.
+     */
+    class MP4Recorder final : private juce::TimeSliceClient
+    {
+        //==========================================================================
+        public:
+            /** Overflow statistics. */
+            struct Statistics
+            {
+                int numOverflows = 0;               /**< Calls of write() that dropped their samples. */
+                juce::int64 numSamplesDropped = 0;  /**< Samples per channel dropped. */
+                int maxNumSamplesBuffered = 0;      /**< Highest FIFO fill level, compare with the FIFO size. */
+                int fifoSize = 0;                   /**< Capacity of the FIFO in samples per channel. */
+            };
+
+            //==========================================================================
+            /** Creates a writer, called on the background thread. */
+            using WriterFactory = std::function<std::unique_ptr<juce::AudioFormatWriter>()>;
+
+            /** Creates a recorder.
+             *
+             * @param createWriter Creates the writer, e.g. with MP4AudioFormat::createWriterFor(), on the background thread.
+             * @param numChannels Number of channels of the writer.
+             * @param backgroundThread Thread that writes, must run until the recorder is deleted.
+             * @param numSamplesToBuffer Size of the FIFO in samples per channel.
+             */
+            MP4Recorder (WriterFactory createWriter, int numChannels, juce::TimeSliceThread& backgroundThread, int numSamplesToBuffer);
+
+            /** Writes the samples still in the FIFO and deletes the writer on the background thread, which completes the file. */
+            ~MP4Recorder() override;
+
+            /** Queues samples, call it from the audio thread.
+             *
+             * Does not lock, allocate or wait.
+             *
+             * @param data One channel per channel of the writer.
+             * @param numSamples Number of samples per channel.
+             * @return False if the FIFO was full and the samples were dropped.
+             */
+            bool write (const float* const* data, int numSamples) noexcept;
+
+            /** Returns the overflow statistics, from any thread. */
+            Statistics getStatistics() const noexcept;
+
+            /** Resets the overflow statistics. */
+            void resetStatistics() noexcept;
+
+            /** Returns true if the writer could not be created or failed, the samples after the failure are lost. */
+            bool hasWriteError() const noexcept                 { return writeError; }
+
+        //==========================================================================
+        private:
+            class Apartment;
+
+            WriterFactory writerFactory;
+            std::unique_ptr<Apartment> apartment;   // COM and Media Foundation of the background thread
+            std::unique_ptr<juce::AudioFormatWriter> writer;
+            juce::TimeSliceThread& thread;
+            juce::AbstractFifo fifo;
+            juce::AudioBuffer<float> buffer;
+
+            std::atomic<int> numOverflows { 0 };
+            std::atomic<juce::int64> numSamplesDropped { 0 };
+            std::atomic<int> maxNumSamplesBuffered { 0 };
+            std::atomic<bool> writeError { false };
+
+            bool isOpen = false;                    // background thread only
+            std::atomic<bool> stopping { false };
+            std::atomic<bool> isClosed { false };
+            juce::WaitableEvent closed;
+
+            int useTimeSlice() override;
+            int writePendingData();
+            void openWriter();
+            void closeWriter();
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4Recorder)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,270 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    /* Returns the modified Bessel function of the first kind of order zero, for the Kaiser window. */
+    static double besselI0 (double x)
+    {
+        double sum = 1.0, term = 1.0;
+
+        for (int k = 1; k < 50 && term > sum * 1.0e-12; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    /* Returns the dot product of the samples and a filter phase, numTaps is a multiple of 4.
+     * Four independent sums have no dependency between neighbouring taps, so the loop vectorizes. */
+    static float dotProduct (const float* samples, const float* taps, int numTaps) noexcept
+    {
+        float sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+
+        for (int i = 0; i < numTaps; i += 4)
+        {
+            sum0 += samples[i] * taps[i];
+            sum1 += samples[i + 1] * taps[i + 1];
+            sum2 += samples[i + 2] * taps[i + 2];
+            sum3 += samples[i + 3] * taps[i + 3];
+        }
+
+        return (sum0 + sum1) + (sum2 + sum3);
+    }
+
+    //==============================================================================
+    MP4Resampler::MP4Resampler (double inputSampleRate, double outputSampleRate, int channels, Quality quality)
+        : numChannels (juce::jmax (0, channels))
+    {
+        const juce::int64 inputRate = juce::jmax (1, juce::roundToInt (inputSampleRate));
+        const juce::int64 outputRate = juce::jmax (1, juce::roundToInt (outputSampleRate));
+        const juce::int64 divisor = std::gcd (inputRate, outputRate);
+
+        upFactor = outputRate / divisor;
+        downFactor = inputRate / divisor;
+
+        createFilter (quality);
+
+        history.setSize (numChannels, numTaps + blockSize);
+        reset();
+    }
+
+    void MP4Resampler::createFilter (Quality quality)
+    {
+        // Stopband attenuation in dB and passband edge relative to the Nyquist frequency of the lower rate.
+        double attenuation = 85.0, passband = 0.91;
+
+        switch (quality)
+        {
+            case Quality::fast: attenuation = 60.0; passband = 0.85; break;
+            case Quality::best: attenuation = 110.0; passband = 0.95; break;
+            case Quality::balanced: break;
+        }
+
+        // Frequencies relative to the input Nyquist frequency. The stopband starts at the
+        // Nyquist frequency of the lower rate, so nothing above it aliases by more than
+        // the attenuation; the cutoff is in the middle of the transition band.
+        const double ratio = juce::jmin (1.0, (double) upFactor / (double) downFactor);
+        const double stopband = ratio;
+        const double cutoff = ratio * (passband + 1.0) / 2.0;
+        const double transitionWidth = juce::MathConstants<double>::pi * (stopband - ratio * passband); // in radians per input sample
+
+        // Kaiser's estimates of the window length and shape for the attenuation and transition width.
+        const double beta = 0.1102 * (attenuation - 8.7);
+        numTaps = ((int) std::ceil ((attenuation - 7.95) / (2.285 * transitionWidth)) + 1 + 3) & ~3;
+        numPhases = (int) juce::jmin (upFactor, (juce::int64) maxNumPhases);
+
+        coefficients.assign ((size_t) (numPhases + 1) * (size_t) numTaps, 0.0f);
+
+        const double half = numTaps / 2;
+        const double windowScale = 1.0 / besselI0 (beta);
+
+        for (int p = 0; p <= numPhases; ++p)
+        {
+            float* taps = coefficients.data() + (size_t) p * (size_t) numTaps;
+            const double fraction = (double) p / numPhases;
+            double sum = 0;
+
+            // Tap k weights the sample at distance x from the output position.
+            for (int k = 0; k < numTaps; ++k)
+            {
+                const double x = (half - 1 - k) + fraction;
+                const double w = (std::abs (x) < half) ? besselI0 (beta * std::sqrt (1.0 - (x / half) * (x / half))) * windowScale : 0.0;
+                const double s = (x == 0) ? cutoff : std::sin (juce::MathConstants<double>::pi * cutoff * x) / (juce::MathConstants<double>::pi * x);
+
+                taps[k] = (float) (s * w);
+                sum += s * w;
+            }
+
+            // Unity gain at DC in every phase.
+            for (int k = 0; k < numTaps; ++k)
+                taps[k] = (float) (taps[k] / sum);
+        }
+    }
+
+    void MP4Resampler::reset() noexcept
+    {
+        seek (0);
+    }
+
+    juce::int64 MP4Resampler::seek (juce::int64 outputSample) noexcept
+    {
+        history.clear();
+
+        // The output sample is centred between the input samples at this position, in 1/L.
+        const juce::int64 time = juce::jmax ((juce::int64) 0, outputSample) * downFactor;
+        const juce::int64 firstInput = time / upFactor - (numTaps / 2 - 1);
+
+        // Zeros stand in for the samples before the start of the input.
+        numHistorySamples = (int) juce::jmax ((juce::int64) 0, -firstInput);
+        position = 0;
+        phase = time % upFactor;
+        numInputTotal = juce::jmax ((juce::int64) 0, firstInput);
+        numOutputTotal = time / downFactor; // the output sample
+
+        return numInputTotal;
+    }
+
+    int MP4Resampler::getMaxNumOutputSamples (int numInput) const noexcept
+    {
+        return (int) ((juce::int64) numInput * upFactor / downFactor) + 2;
+    }
+
+    //==============================================================================
+    int MP4Resampler::process (const float* const* input, int numInput, float* const* output) noexcept
+    {
+        const juce::int64 start = juce::Time::getHighResolutionTicks();
+        int numOutput = 0;
+
+        for (int done = 0; done < numInput;)
+        {
+            discardUsedSamples();
+
+            const int numAppended = append (input, done, numInput - done);
+            done += numAppended;
+            numInputTotal += numAppended;
+
+            numOutput += resample (output, numOutput, std::numeric_limits<juce::int64>::max());
+        }
+
+        numOutputTotal += numOutput;
+
+        numInputSamples += numInput;
+        numOutputSamples += numOutput;
+        processTicks += juce::Time::getHighResolutionTicks() - start;
+
+        return numOutput;
+    }
+
+    int MP4Resampler::flush (float* const* output) noexcept
+    {
+        const juce::int64 start = juce::Time::getHighResolutionTicks();
+
+        // Stop at the duration of the input, the zeros only move the filter past its end.
+        const juce::int64 numOutputExpected = (numInputTotal * upFactor + downFactor - 1) / downFactor;
+        int numOutput = 0;
+
+        for (int done = 0; done < getLatency();)
+        {
+            discardUsedSamples();
+            done += append (nullptr, 0, getLatency() - done);
+
+            numOutput += resample (output, numOutput, numOutputExpected - numOutputTotal - numOutput);
+        }
+
+        numOutputTotal += numOutput;
+
+        numOutputSamples += numOutput;
+        processTicks += juce::Time::getHighResolutionTicks() - start;
+
+        return numOutput;
+    }
+
+    //==============================================================================
+    int MP4Resampler::append (const float* const* input, int offset, int numInput) noexcept
+    {
+        const int numToCopy = juce::jmin (numInput, history.getNumSamples() - numHistorySamples);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            if (input != nullptr && input[ch] != nullptr)
+                history.copyFrom (ch, numHistorySamples, input[ch] + offset, numToCopy);
+            else
+                history.clear (ch, numHistorySamples, numToCopy);
+        }
+
+        numHistorySamples += numToCopy;
+
+        return numToCopy;
+    }
+
+    int MP4Resampler::resample (float* const* output, int outputOffset, juce::int64 maxNumOutput) noexcept
+    {
+        int numOutput = 0;
+
+        while (numOutput < maxNumOutput && position + numTaps <= numHistorySamples)
+        {
+            // Exact phase if the ratio has few enough phases, interpolated otherwise.
+            const juce::int64 phasePosition = phase * numPhases;
+            const int p = (int) (phasePosition / upFactor);
+            const float fraction = (float) (phasePosition % upFactor) / (float) upFactor;
+
+            const float* taps = coefficients.data() + (size_t) p * (size_t) numTaps;
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                const float* samples = history.getReadPointer (ch, position);
+                float value = dotProduct (samples, taps, numTaps);
+
+                if (fraction > 0)
+                    value += fraction * (dotProduct (samples, taps + numTaps, numTaps) - value);
+
+                output[ch][outputOffset + numOutput] = value;
+            }
+
+            ++numOutput;
+
+            phase += downFactor;
+            position += (int) (phase / upFactor);
+            phase %= upFactor;
+        }
+
+        return numOutput;
+    }
+
+    void MP4Resampler::discardUsedSamples() noexcept
+    {
+        const int numToDiscard = juce::jmin (position, numHistorySamples);
+
+        if (numToDiscard == 0)
+            return;
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            float* samples = history.getWritePointer (ch);
+            std::memmove (samples, samples + numToDiscard, (size_t) (numHistorySamples - numToDiscard) * sizeof (float));
+        }
+
+        numHistorySamples -= numToDiscard;
+        position -= numToDiscard; // downsampling may skip samples not yet appended
+    }
+
+    //==============================================================================
+    MP4Resampler::Statistics MP4Resampler::getStatistics() const noexcept
+    {
+        Statistics statistics;
+        statistics.numInputSamples = numInputSamples;
+        statistics.numOutputSamples = numOutputSamples;
+        statistics.processSeconds = juce::Time::highResolutionTicksToSeconds (processTicks);
+        return statistics;
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,143 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Polyphase sample rate converter.
+     *
+     * Converts between any two sample rates with a Kaiser windowed sinc
+     * filter. The ratio of the rates is reduced to L/M and one filter phase
+     * is precomputed per output position, so each output sample is a single
+     * dot product. Ratios with more than 1024 phases, e.g. odd rates,
+     * interpolate between 1024 phases.
+     *
+     * The filter delay is compensated: the output starts at the same time as
+     * the input and flush() writes the remaining samples, so input and output
+     * have the same duration.
+     *
+     * Once created, the resampler does not allocate; process() can be called
+     * from an audio thread.
+     */
+    class MP4Resampler final
+    {
+        //==========================================================================
+        public:
+            /** Quality and speed presets.
+             *
+             * The passband ends at a fraction of the Nyquist frequency of the lower
+             * rate and the stopband starts at it. The number of taps per phase
+             * follows from the attenuation and the transition band (Kaiser's
+             * estimate) and grows by the ratio of the rates when downsampling.
+             */
+            enum class Quality
+            {
+                fast,       /**< Passband to 85% of Nyquist, 60 dB stopband, 52 taps. */
+                balanced,   /**< Passband to 91% of Nyquist, 85 dB stopband, 124 taps. */
+                best        /**< Passband to 95% of Nyquist, 110 dB stopband, 288 taps. */
+            };
+
+            /** Throughput of the resampler alone, measured inside process() and flush(). */
+            struct Statistics
+            {
+                juce::int64 numInputSamples = 0;    /**< Samples per channel read. */
+                juce::int64 numOutputSamples = 0;   /**< Samples per channel written. */
+                double processSeconds = 0;          /**< Time spent resampling. */
+
+                /** Returns input samples per channel per second of resampling time. */
+                double getInputSamplesPerSecond() const noexcept
+                {
+                    return (processSeconds > 0) ? (double) numInputSamples / processSeconds : 0.0;
+                }
+            };
+
+            //==========================================================================
+            /** Creates a resampler.
+             *
+             * @param inputSampleRate Sample rate of the input, rounded to whole Hz.
+             * @param outputSampleRate Sample rate of the output, rounded to whole Hz.
+             * @param numChannels Number of channels.
+             * @param quality Quality and speed preset.
+             */
+            MP4Resampler (double inputSampleRate, double outputSampleRate, int numChannels, Quality quality = Quality::balanced);
+
+            /** Returns the maximum number of samples process() writes for a number of input samples. */
+            int getMaxNumOutputSamples (int numInputSamples) const noexcept;
+
+            /** Returns the number of input samples the filter looks ahead, flush() feeds as many zeros. */
+            int getLatency() const noexcept                         { return numTaps / 2; }
+
+            /** Resamples the next block of input.
+             *
+             * @param input One channel per channel of the resampler.
+             * @param numInputSamples Number of input samples per channel.
+             * @param output One channel per channel of the resampler, each with space
+             *               for getMaxNumOutputSamples (numInputSamples) samples.
+             * @return Number of samples per channel written to the output.
+             */
+            int process (const float* const* input, int numInputSamples, float* const* output) noexcept;
+
+            /** Writes the samples still in the filter at the end of the input.
+             *
+             * @param output Space for getMaxNumOutputSamples (getLatency()) samples per channel.
+             * @return Number of samples per channel written to the output.
+             */
+            int flush (float* const* output) noexcept;
+
+            /** Clears the filter for a new input, the statistics are kept. */
+            void reset() noexcept;
+
+            /** Clears the filter to continue at another position of the same input.
+             *
+             * The outputs after a seek are the same as without it, so readers
+             * can jump without clicks or drift.
+             *
+             * @param outputSample Output sample process() writes next.
+             * @return Input sample to pass to process() next.
+             */
+            juce::int64 seek (juce::int64 outputSample) noexcept;
+
+            /** Returns the throughput statistics, from any thread. */
+            Statistics getStatistics() const noexcept;
+
+        //==========================================================================
+        private:
+            static constexpr int blockSize = 4096;  // input samples per channel processed at once
+            static constexpr int maxNumPhases = 1024;
+
+            const int numChannels;
+            juce::int64 upFactor = 1;               // L
+            juce::int64 downFactor = 1;             // M
+            int numPhases = 1;
+            int numTaps = 0;                        // per phase, a multiple of 4
+
+            std::vector<float> coefficients;        // numPhases + 1 phases of numTaps
+            juce::AudioBuffer<float> history;       // numTaps + blockSize samples per channel
+
+            int numHistorySamples = 0;
+            int position = 0;                       // first history sample of the next output
+            juce::int64 phase = 0;                  // next output position between samples, in 1/L
+            juce::int64 numInputTotal = 0;
+            juce::int64 numOutputTotal = 0;
+
+            std::atomic<juce::int64> numInputSamples { 0 };
+            std::atomic<juce::int64> numOutputSamples { 0 };
+            std::atomic<juce::int64> processTicks { 0 };
+
+            void createFilter (Quality quality);
+            int append (const float* const* input, int offset, int numInputSamples) noexcept;
+            int resample (float* const* output, int outputOffset, juce::int64 maxNumOutputSamples) noexcept;
+            void discardUsedSamples() noexcept;
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4Resampler)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
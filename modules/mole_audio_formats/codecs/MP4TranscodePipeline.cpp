@@ -0,0 +1,368 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS
+
+    //==============================================================================
+    class MP4TranscodePipeline::Block final
+    {
+        public:
+            Block (int numChannels, int maxNumSamples, int maxNumOutputSamples, bool isResampling, bool isFloatingPoint)
+                : samples (numChannels, maxNumSamples)
+            {
+                if (isResampling)
+                    resampled.setSize (numChannels, maxNumOutputSamples);
+
+                if (! isFloatingPoint)
+                {
+                    ints.malloc ((size_t) numChannels * (size_t) maxNumOutputSamples);
+                    shorts.malloc ((size_t) maxNumOutputSamples);
+                }
+
+                const auto& output = getOutput();
+
+                // Floating point writers take the float samples as they are.
+                for (int ch = 0; ch < numChannels; ++ch)
+                    channels.push_back (isFloatingPoint ? reinterpret_cast<const int*> (output.getReadPointer (ch))
+                                                        : ints.get() + (size_t) ch * (size_t) maxNumOutputSamples);
+
+                channels.push_back (nullptr); // writers take a null terminated array
+            }
+
+            /** Returns the samples passed on to the writer, the resampled ones if there are.  */
+            const juce::AudioBuffer<float>& getOutput() const noexcept
+            {
+                return (resampled.getNumChannels() > 0) ? resampled : samples;
+            }
+
+            /** Resamples the decoded samples, the filter is flushed after the last block.  */
+            void resample (MP4Resampler& resampler) noexcept
+            {
+                numOutputSamples = resampler.process (samples.getArrayOfReadPointers(), numSamples, resampled.getArrayOfWritePointers());
+
+                if (isLast)
+                {
+                    float* tail[maxNumChannels] = {};
+
+                    for (int ch = 0; ch < resampled.getNumChannels(); ++ch)
+                        tail[ch] = resampled.getWritePointer (ch, numOutputSamples);
+
+                    numOutputSamples += resampler.flush (tail);
+                }
+            }
+
+            /** Converts the float samples to the 32-bit integers integer writers take.
+             *
+             * @param roundTo16Bits True for 16-bit writers, which get samples rounded to 16 bits
+             *                      in the upper bits and take them over without rounding.
+             * @param dither Dither for the rounding to 16 bits, or nullptr.
+             */
+            void convertToInts (bool roundTo16Bits, WindowsMediaFoundation::Dither* dither) noexcept
+            {
+                using Source = juce::AudioData::Pointer<juce::AudioData::Float32, juce::AudioData::NativeEndian,
+                                                        juce::AudioData::NonInterleaved, juce::AudioData::Const>;
+                using Shorts = juce::AudioData::Pointer<juce::AudioData::Int16, juce::AudioData::NativeEndian,
+                                                        juce::AudioData::NonInterleaved, juce::AudioData::NonConst>;
+                using ShortsSource = juce::AudioData::Pointer<juce::AudioData::Int16, juce::AudioData::NativeEndian,
+                                                              juce::AudioData::NonInterleaved, juce::AudioData::Const>;
+                using Dest = juce::AudioData::Pointer<juce::AudioData::Int32, juce::AudioData::NativeEndian,
+                                                      juce::AudioData::NonInterleaved, juce::AudioData::NonConst>;
+
+                const auto& output = getOutput();
+
+                for (int ch = 0; ch < output.getNumChannels(); ++ch)
+                {
+                    Dest dest (const_cast<int*> (channels[(size_t) ch]));
+
+                    if (! roundTo16Bits)
+                    {
+                        dest.convertSamples (Source (output.getReadPointer (ch)), numOutputSamples);
+                        continue;
+                    }
+
+                    if (dither != nullptr)
+                        dither->Process (output.getReadPointer (ch), shorts.get(), 1, numOutputSamples);
+                    else
+                        Shorts (shorts.get()).convertSamples (Source (output.getReadPointer (ch)), numOutputSamples);
+
+                    dest.convertSamples (ShortsSource (shorts.get()), numOutputSamples);
+                }
+            }
+
+            static constexpr int maxNumChannels = 8;
+
+            juce::AudioBuffer<float> samples;       // decoded, at the sample rate of the reader
+            juce::AudioBuffer<float> resampled;     // at the sample rate of the writer, empty if they are the same
+            juce::HeapBlock<int> ints;
+            juce::HeapBlock<juce::int16> shorts;    // one channel rounded to 16 bits
+            std::vector<const int*> channels;       // passed to the writer
+            int numSamples = 0;                     // decoded samples per channel
+            int numOutputSamples = 0;               // samples per channel passed to the writer
+            bool isLast = false;
+    };
+
+    //==============================================================================
+    /** Bounded queue of blocks between two stages, one thread pushes and one pops.  */
+    class MP4TranscodePipeline::Queue final
+    {
+        public:
+            explicit Queue (int capacity)
+                : fifo (capacity + 1), blocks ((size_t) capacity + 1)
+            {
+            }
+
+            /** Never waits, the queue holds all blocks of the pool.  */
+            void push (Block* block) noexcept
+            {
+                {
+                    const auto scope = fifo.write (1);
+                    jassert (scope.blockSize1 == 1);
+                    blocks[(size_t) scope.startIndex1] = block;
+                }
+
+                if (isWaiting)
+                    blockAvailable.signal();
+            }
+
+            /** Waits for a block, returns nullptr if the pipeline was stopped.  */
+            Block* pop (const std::atomic<bool>& stopped)
+            {
+                for (;;)
+                {
+                    if (fifo.getNumReady() > 0)
+                    {
+                        const auto scope = fifo.read (1);
+                        return blocks[(size_t) scope.startIndex1];
+                    }
+
+                    if (stopped)
+                        return nullptr;
+
+                    // Backpressure: the stage waits until the previous one catches up.
+                    isWaiting = true;
+
+                    if (fifo.getNumReady() == 0)
+                        blockAvailable.wait (50); // wakes up to check for cancellation
+
+                    isWaiting = false;
+                }
+            }
+
+        private:
+            juce::AbstractFifo fifo;
+            std::vector<Block*> blocks;
+            juce::WaitableEvent blockAvailable;
+            std::atomic<bool> isWaiting { false };
+    };
+
+    //==============================================================================
+    class MP4TranscodePipeline::Stage final : public juce::Thread
+    {
+        public:
+            Stage (const juce::String& name, std::function<void()> work, std::function<void()> error)
+                : juce::Thread (name), function (std::move (work)), onError (std::move (error))
+            {
+            }
+
+            void run() override
+            {
+                // The stages use the reader and Media Foundation objects, e.g. of MP4 readers, on this thread.
+                Windows::COMLibrary library;
+                Windows::MFPlatform platform;
+
+                if (SUCCEEDED (library.InitializeMTA()) && SUCCEEDED (platform.Initialize()))
+                    function();
+                else
+                    onError();
+            }
+
+        private:
+            std::function<void()> function, onError;
+    };
+
+    //==============================================================================
+    MP4TranscodePipeline::MP4TranscodePipeline (int samplesPerBlock, int blocksInPool)
+        : blockSize (juce::jmax (1, samplesPerBlock)), numBlocks (juce::jmax (3, blocksInPool))
+    {
+    }
+
+    MP4TranscodePipeline::~MP4TranscodePipeline()
+    {
+    }
+
+    //==============================================================================
+    bool MP4TranscodePipeline::transcode (juce::AudioFormatReader& reader, juce::AudioFormatWriter& writer,
+                                          juce::int64 startSample, juce::int64 numSamples)
+    {
+        if (reader.sampleRate <= 0 || writer.getSampleRate() <= 0 || writer.getNumChannels() > Block::maxNumChannels)
+        {
+            DBGSTR("The sample rates or number of channels are not supported.");
+            return false;
+        }
+
+        if (numSamples < 0)
+            numSamples = reader.lengthInSamples - startSample;
+
+        if (numSamples <= 0)
+            return true;
+
+        stopped = false;
+
+        const int numChannels = writer.getNumChannels();
+        const bool isFloatingPoint = writer.isFloatingPoint();
+        const bool roundTo16Bits = ! isFloatingPoint && writer.getBitsPerSample() == 16;
+        const juce::int64 endSample = startSample + numSamples;
+
+        // Used on the convert thread only.
+        std::unique_ptr<MP4Resampler> resampler;
+        WindowsMediaFoundation::Dither dither;
+
+        if (reader.sampleRate != writer.getSampleRate())
+            resampler = std::make_unique<MP4Resampler> (reader.sampleRate, writer.getSampleRate(), numChannels, resamplerQuality);
+
+        // The last block also takes the samples flushed from the filter.
+        const int maxNumOutputSamples = (resampler != nullptr)
+            ? resampler->getMaxNumOutputSamples (blockSize) + resampler->getMaxNumOutputSamples (resampler->getLatency())
+            : blockSize;
+
+        juce::OwnedArray<Block> pool;
+        Queue freeBlocks (numBlocks), decodedBlocks (numBlocks), convertedBlocks (numBlocks);
+
+        for (int i = 0; i < numBlocks; ++i)
+            freeBlocks.push (pool.add (new Block (numChannels, blockSize, maxNumOutputSamples, resampler != nullptr, isFloatingPoint)));
+
+        // Ticks each stage spends working, for the loads in the statistics.
+        std::atomic<juce::int64> decodeTicks { 0 }, convertTicks { 0 };
+        juce::int64 encodeTicks = 0;
+
+        const auto stop = [this] { stopped = true; };
+
+        Stage decodeStage ("Transcode decode", [&]
+        {
+            for (juce::int64 position = startSample; position < endSample;)
+            {
+                Block* block = freeBlocks.pop (stopped);
+
+                if (block == nullptr)
+                    break;
+
+                const juce::int64 start = juce::Time::getHighResolutionTicks();
+
+                block->numSamples = (int) juce::jmin ((juce::int64) blockSize, endSample - position);
+
+                if (! reader.read (block->samples.getArrayOfWritePointers(), numChannels, position, block->numSamples))
+                {
+                    stopped = true;
+                    break;
+                }
+
+                position += block->numSamples;
+                block->isLast = (position >= endSample);
+
+                decodeTicks += juce::Time::getHighResolutionTicks() - start;
+                decodedBlocks.push (block);
+            }
+        }, stop);
+
+        // Sample rate conversion and rounding to the bit depth of the writer, the writer only interleaves.
+        Stage convertStage ("Transcode convert", [&]
+        {
+            for (;;)
+            {
+                Block* block = decodedBlocks.pop (stopped);
+
+                if (block == nullptr)
+                    break;
+
+                const juce::int64 start = juce::Time::getHighResolutionTicks();
+
+                if (resampler != nullptr)
+                    block->resample (*resampler);
+                else
+                    block->numOutputSamples = block->numSamples;
+
+                if (! isFloatingPoint)
+                    block->convertToInts (roundTo16Bits, useDither ? &dither : nullptr);
+
+                convertTicks += juce::Time::getHighResolutionTicks() - start;
+                convertedBlocks.push (block);
+
+                if (block->isLast)
+                    break;
+            }
+        }, stop);
+
+        decodeStage.startThread();
+        convertStage.startThread();
+
+        // Encode on this thread.
+        const juce::int64 startTicks = juce::Time::getHighResolutionTicks();
+        const juce::int64 intervalTicks = juce::Time::secondsToHighResolutionTicks (throughputInterval / 1000.0);
+        juce::int64 nextThroughputTicks = startTicks + intervalTicks;
+        juce::int64 numSamplesDone = 0;
+        bool isDone = false;
+
+        auto getStatistics = [&]
+        {
+            const juce::int64 ticks = juce::jmax ((juce::int64) 1, juce::Time::getHighResolutionTicks() - startTicks);
+
+            Statistics statistics;
+            statistics.numSamplesDone = numSamplesDone;
+            statistics.numSamplesTotal = numSamples;
+            statistics.elapsedSeconds = juce::Time::highResolutionTicksToSeconds (ticks);
+            statistics.samplesPerSecond = numSamplesDone / statistics.elapsedSeconds;
+            statistics.decodeLoad = (double) decodeTicks / (double) ticks;
+            statistics.convertLoad = (double) convertTicks / (double) ticks;
+            statistics.encodeLoad = (double) encodeTicks / (double) ticks;
+            return statistics;
+        };
+
+        while (! isDone)
+        {
+            Block* block = convertedBlocks.pop (stopped);
+
+            if (block == nullptr)
+                break;
+
+            const juce::int64 start = juce::Time::getHighResolutionTicks();
+
+            if (block->numOutputSamples > 0 && ! writer.write (block->channels.data(), block->numOutputSamples))
+            {
+                stopped = true;
+                break;
+            }
+
+            const juce::int64 end = juce::Time::getHighResolutionTicks();
+            encodeTicks += end - start;
+
+            numSamplesDone += block->numSamples;
+            isDone = block->isLast;
+
+            freeBlocks.push (block);
+
+            if (onProgress != nullptr)
+                onProgress ((double) numSamplesDone / (double) numSamples);
+
+            if (onThroughput != nullptr && (isDone || end >= nextThroughputTicks))
+            {
+                onThroughput (getStatistics());
+                nextThroughputTicks = end + intervalTicks;
+            }
+        }
+
+        if (! isDone)
+            stopped = true;
+
+        decodeStage.waitForThreadToExit (-1);
+        convertStage.waitForThreadToExit (-1);
+
+        return isDone;
+    }
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,111 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    //==========================================================================
+    /** Transcodes from a reader to a writer with decode, convert and encode
+     *  running on separate threads.
+     *
+     * AudioFormatWriter::writeFromAudioReader() reads and writes in lockstep
+     * on one thread. The pipeline decodes on one thread, converts the samples
+     * on a second one and encodes on the thread that calls transcode().
+     *
+     * The convert stage resamples from the sample rate of the reader to the
+     * one of the writer (see setResamplerQuality()) and converts the samples
+     * to the format of the writer; for 16-bit writers it rounds them to 16
+     * bits, optionally with TPDF dither (see setDitherEnabled()). Create the
+     * writer at the sample rate of the encoder with 16 bits per sample, e.g.
+     * an MP4AudioFormat writer at 44100 or 48000 Hz without an output sample
+     * rate, and the writer only interleaves the samples and encodes them.
+     *
+     * The stages pass a fixed pool of blocks through bounded single producer,
+     * single consumer lock-free queues; a stage that runs ahead waits for a
+     * free block, so memory use does not grow with the length of the input.
+     * The stage threads join the multithreaded COM apartment and start Media
+     * Foundation, the reader is read on the decode thread.
+     *
+     * Works with any reader and writer, e.g. MP4AudioFormat writers, which
+     * are used on the thread that created them.
+     */
+    class MP4TranscodePipeline final
+    {
+        //==========================================================================
+        public:
+            /** Throughput of a transcode. */
+            struct Statistics
+            {
+                juce::int64 numSamplesDone = 0;     /**< Samples per channel of the reader written. */
+                juce::int64 numSamplesTotal = 0;    /**< Samples per channel of the reader to write. */
+                double elapsedSeconds = 0.0;        /**< Time since the start. */
+                double samplesPerSecond = 0.0;      /**< Samples per channel of the reader written per second. */
+
+                /** Fraction of the elapsed time each stage was working, the busiest stage limits the throughput. */
+                double decodeLoad = 0.0, convertLoad = 0.0, encodeLoad = 0.0;
+            };
+
+            //==========================================================================
+            /** Creates a pipeline.
+             *
+             * @param blockSize Samples per channel in a block.
+             * @param numBlocks Number of blocks in the pool, at least 3 keep all stages busy.
+             */
+            explicit MP4TranscodePipeline (int blockSize = 16384, int numBlocks = 8);
+
+            /** Destructor. */
+            ~MP4TranscodePipeline();
+
+            /** Called after each block with the written fraction (0-1), on the thread that calls transcode(). */
+            std::function<void (double progress)> onProgress;
+
+            /** Called periodically and after the last block, on the thread that calls transcode(). */
+            std::function<void (const Statistics& statistics)> onThroughput;
+
+            /** Sets the interval of onThroughput calls (default 1000 ms). */
+            void setThroughputInterval (int milliseconds) noexcept      { throughputInterval = milliseconds; }
+
+            /** Sets the quality of the sample rate conversion (default balanced). */
+            void setResamplerQuality (MP4Resampler::Quality quality) noexcept   { resamplerQuality = quality; }
+
+            /** Enables TPDF dither when rounding to 16 bits (default off). */
+            void setDitherEnabled (bool shouldDither) noexcept          { useDither = shouldDither; }
+
+            /** Transcodes a range of a reader, returns when all samples are written.
+             *
+             * @param reader Source, read on the decode thread, resampled if its sample rate is not the one of the writer.
+             * @param writer Destination with up to 8 channels, used on this thread only.
+             * @param startSample First sample of the reader.
+             * @param numSamples Number of samples, -1 transcodes to the end of the reader.
+             * @return False if reading or writing failed or the transcode was cancelled.
+             */
+            bool transcode (juce::AudioFormatReader& reader, juce::AudioFormatWriter& writer,
+                            juce::int64 startSample = 0, juce::int64 numSamples = -1);
+
+            /** Stops a running transcode, can be called from any thread. */
+            void cancel() noexcept                                      { stopped = true; }
+
+        //==========================================================================
+        private:
+            class Block;
+            class Queue;
+            class Stage;
+
+            const int blockSize;
+            const int numBlocks;
+            int throughputInterval = 1000;
+            MP4Resampler::Quality resamplerQuality = MP4Resampler::Quality::balanced;
+            bool useDither = false;
+            std::atomic<bool> stopped { false };
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MP4TranscodePipeline)
+    };
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -23,8 +23,27 @@
 #include "native/ByteStreamInput_windows.h"
 #include "native/ByteStreamOutput_windows.h"
 #include "native/ByteStream_windows.cpp"
+#include "native/AACDecoder_windows.h"
+#include "native/AACEncoder_windows.h"
+#include "native/SamplePool_windows.h"
+#include "codecs/MP4AudioIndex.cpp"
+#include "codecs/MP4AudioIndexCache.cpp"
+#include "codecs/MP4FrameCache.cpp"
+#include "codecs/MP4DecodedAudioCache.cpp"
+#include "codecs/MP4DecodeScheduler.cpp"
+#include "codecs/MP4Resampler.cpp"
+#include "codecs/MP4LevelPyramid.cpp"
+#include "codecs/MP4AnalysisTap.cpp"
+#include "codecs/MFAudioFormatReader.h"
 #include "codecs/MP4AudioFormatReader.h"
 #include "codecs/MP4AudioFormatWriter.h"
+#include "codecs/MP4MultiBitrateWriter.h"
+#include "codecs/MP4AccessUnitWriter.h"
 #include "codecs/MP4AudioFormat.cpp"
+#include "codecs/MP4ParallelDecoder.cpp"
+#include "codecs/MP4ParallelEncoder.cpp"
+#include "codecs/MP4TranscodePipeline.cpp"
+#include "codecs/MP4BatchTranscoder.cpp"
+#include "codecs/MP4Recorder.cpp"
 
 #endif // JUCE_WINDOWS
@@ -28,6 +28,8 @@
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_formats/juce_audio_formats.h>
 
+#include <future>
+
 #if JUCE_WINDOWS || DOXYGEN
 
 /** Config: MOLE_MEDIAFOUNDATION_HEADERS
@@ -52,6 +54,22 @@
 #endif
 
 #include "native/ShellMetadata_windows.h"
+#include "codecs/MP4AudioIndex.h"
+#include "codecs/MP4AudioIndexCache.h"
+#include "codecs/MP4FrameCache.h"
+#include "codecs/MP4DecodedAudioCache.h"
+#include "codecs/MP4DecodeScheduler.h"
+#include "codecs/MP4Resampler.h"
+#include "codecs/MP4LevelPyramid.h"
+#include "codecs/MP4AnalysisTap.h"
+#include "codecs/MP4AudioReaderOptions.h"
+#include "codecs/MP4AudioWriterOptions.h"
+#include "codecs/MP4RealtimeReader.h"
+#include "codecs/MP4ParallelDecoder.h"
+#include "codecs/MP4ParallelEncoder.h"
+#include "codecs/MP4TranscodePipeline.h"
+#include "codecs/MP4BatchTranscoder.h"
+#include "codecs/MP4Recorder.h"
 #include "codecs/MP4AudioFormat.h"
 
 #endif // JUCE_WINDOWS
@@ -0,0 +1,444 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    namespace WindowsMediaFoundation {
+
+        using namespace mole::Windows;
+
+        //==========================================================================
+        /** Decodes raw AAC access units with the Media Foundation AAC decoder.
+         *
+         * The decoder is fed from an MP4AudioIndex, so there is no container
+         * parsing and no source reader. Output is interleaved 32-bit float.
+         *
+         * With a channel limit, multichannel streams are downmixed by the
+         * decoder if it offers the output type, otherwise by CopyOutput().
+         */
+        class AACDecoder final
+        {
+            IMFTransform* transform = nullptr;
+
+            IMFSample* inputSample = nullptr;
+            IMFMediaBuffer* inputBuffer = nullptr;
+            IMFSample* outputSample = nullptr;
+            IMFMediaBuffer* outputBuffer = nullptr;
+
+            bool providesSamples = false;
+            bool outputIsFloat = true;
+            UINT32 outputSampleRate = 0;
+            UINT32 outputNumChannels = 0;
+            UINT32 decodedNumChannels = 0; // more than outputNumChannels if CopyOutput() downmixes
+            UINT32 maxNumChannels = 0; // 0 decodes all channels
+
+            // Output format the caller sized its buffers for, kept across stream changes.
+            UINT32 streamSampleRate = 0;
+            UINT32 streamNumChannels = 0;
+
+            //==========================================================================
+            public:
+
+            AACDecoder() = default;
+
+            ~AACDecoder()
+            {
+                SafeRelease (&outputBuffer);
+                SafeRelease (&outputSample);
+                SafeRelease (&inputBuffer);
+                SafeRelease (&inputSample);
+                SafeRelease (&transform);
+            }
+
+            /** Creates the decoder for the stream described by the index.
+             *
+             * @param index Stream to decode.
+             * @param maxChannels Downmixes to 2 (stereo) or 1 (mono) channels, 0 decodes all channels.
+             */
+            HRESULT Initialize (const MP4AudioIndex& index, int maxChannels = 0)
+            {
+                maxNumChannels = (UINT32) juce::jlimit (0, 2, maxChannels);
+
+                HRESULT hr = CreateTransform();
+
+                // Input type (raw AAC, HEAACWAVEINFO payload followed by the audio specific config).
+                if (SUCCEEDED (hr))
+                {
+                    IMFMediaType* inputType = nullptr;
+
+                    const juce::MemoryBlock& asc = index.getAudioSpecificConfig();
+                    juce::MemoryBlock userData (12 + asc.getSize(), true);
+                    userData[2] = (char) 0xfe; // wAudioProfileLevelIndication: unknown
+                    userData.copyFrom (asc.getData(), 12, asc.getSize());
+
+                    hr = ::MFCreateMediaType (&inputType);
+                    if (SUCCEEDED (hr)) hr = inputType->SetGUID (MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+                    if (SUCCEEDED (hr)) hr = inputType->SetGUID (MF_MT_SUBTYPE, MFAudioFormat_AAC);
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, (UINT32) index.getSampleRate());
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, (UINT32) index.getNumChannels());
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AAC_PAYLOAD_TYPE, 0);
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AAC_AUDIO_PROFILE_LEVEL_INDICATION, 0xfe);
+                    if (SUCCEEDED (hr)) hr = inputType->SetBlob (MF_MT_USER_DATA, (const UINT8*) userData.getData(), (UINT32) userData.getSize());
+                    if (SUCCEEDED (hr)) hr = transform->SetInputType (0, inputType, 0);
+
+                    SafeRelease (&inputType);
+                }
+
+                if (SUCCEEDED (hr)) hr = SetOutputType();
+
+                if (SUCCEEDED (hr))
+                {
+                    streamSampleRate = outputSampleRate;
+                    streamNumChannels = outputNumChannels;
+                }
+
+                // Preallocated input sample, large enough for any access unit of the stream.
+                if (SUCCEEDED (hr)) hr = ::MFCreateSample (&inputSample);
+                if (SUCCEEDED (hr)) hr = ::MFCreateMemoryBuffer ((DWORD) juce::jmax (1, index.getMaxFrameSize()), &inputBuffer);
+                if (SUCCEEDED (hr)) hr = inputSample->AddBuffer (inputBuffer);
+
+                if (SUCCEEDED (hr)) hr = transform->ProcessMessage (MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0);
+                if (SUCCEEDED (hr)) hr = transform->ProcessMessage (MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+
+                return hr;
+            }
+
+            /** Returns the decoded sample rate.  */
+            double GetSampleRate() const noexcept { return (double) outputSampleRate; }
+
+            /** Returns the decoded number of channels.  */
+            unsigned int GetNumChannels() const noexcept { return (unsigned int) outputNumChannels; }
+
+            /** Discards decoder state, e.g. before decoding from a new position.  */
+            HRESULT Flush()
+            {
+                return transform->ProcessMessage (MFT_MESSAGE_COMMAND_FLUSH, 0);
+            }
+
+            /** Decodes one access unit.
+             *
+             * @param data Access unit data.
+             * @param size Access unit size in bytes.
+             * @param output Receives interleaved float samples.
+             * @param maxNumSamples Capacity of the output buffer in samples per channel.
+             * @param numSamples Receives the number of decoded samples per channel.
+             */
+            HRESULT Decode (const void* data, int size, float* output, int maxNumSamples, int* numSamples)
+            {
+                *numSamples = 0;
+
+                BYTE* inputData = nullptr;
+                DWORD maxLength = 0;
+
+                HRESULT hr = inputBuffer->Lock (&inputData, &maxLength, nullptr);
+
+                if (SUCCEEDED (hr))
+                {
+                    if ((DWORD) size <= maxLength)
+                        memcpy (inputData, data, (size_t) size);
+                    else
+                        hr = E_INVALIDARG;
+
+                    inputBuffer->Unlock();
+                }
+
+                if (SUCCEEDED (hr)) hr = inputBuffer->SetCurrentLength ((DWORD) size);
+                if (SUCCEEDED (hr)) hr = transform->ProcessInput (0, inputSample, 0);
+
+                while (SUCCEEDED (hr))
+                {
+                    MFT_OUTPUT_DATA_BUFFER outputData = { 0, providesSamples ? nullptr : outputSample, 0, nullptr };
+                    DWORD status = 0;
+
+                    if (outputBuffer != nullptr)
+                        outputBuffer->SetCurrentLength (0);
+
+                    hr = transform->ProcessOutput (0, 1, &outputData, &status);
+
+                    SafeRelease (&outputData.pEvents);
+
+                    if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+                    {
+                        hr = S_OK;
+                        break;
+                    }
+
+                    // Implicit SBR or PS may change the decoded format mid-stream (see SetOutputType()).
+                    if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
+                    {
+                        hr = SetOutputType();
+                        continue;
+                    }
+
+                    if (SUCCEEDED (hr))
+                        hr = CopyOutput (outputData.pSample, output, maxNumSamples, numSamples);
+
+                    if (providesSamples)
+                        SafeRelease (&outputData.pSample);
+                }
+
+                return hr;
+            }
+
+            //==========================================================================
+            private:
+
+            HRESULT CreateTransform()
+            {
+                MFT_REGISTER_TYPE_INFO inputInfo = { MFMediaType_Audio, MFAudioFormat_AAC };
+                IMFActivate** activates = nullptr;
+                UINT32 count = 0;
+
+                HRESULT hr = ::MFTEnumEx (MFT_CATEGORY_AUDIO_DECODER,
+                        MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+                        &inputInfo, nullptr, &activates, &count);
+
+                if (SUCCEEDED (hr) && count == 0) hr = MF_E_TOPO_CODEC_NOT_FOUND;
+                if (SUCCEEDED (hr)) hr = activates[0]->ActivateObject (IID_PPV_ARGS (&transform));
+
+                for (UINT32 i = 0; i < count; ++i)
+                    SafeRelease (&activates[i]);
+
+                ::CoTaskMemFree (activates);
+
+                return hr;
+            }
+
+            HRESULT SetOutputType()
+            {
+                IMFMediaType* outputType = nullptr;
+                IMFMediaType* type = nullptr;
+                HRESULT hr = S_OK;
+
+                int bestScore = 0;
+
+                // Prefer types within the channel limit, then float output, otherwise 16-bit PCM.
+                for (DWORD i = 0; SUCCEEDED (hr) && bestScore < 4; ++i)
+                {
+                    hr = transform->GetOutputAvailableType (0, i, &type);
+
+                    if (SUCCEEDED (hr))
+                    {
+                        GUID subtype = GUID_NULL;
+                        UINT32 bits = 0, channels = 0;
+                        type->GetGUID (MF_MT_SUBTYPE, &subtype);
+                        type->GetUINT32 (MF_MT_AUDIO_BITS_PER_SAMPLE, &bits);
+                        type->GetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, &channels);
+
+                        const bool isFloat = (subtype == MFAudioFormat_Float && bits == 32);
+                        const bool isPCM = (subtype == MFAudioFormat_PCM && bits == 16);
+                        const bool isWithinLimit = (maxNumChannels == 0 || channels <= maxNumChannels);
+                        const int score = (isFloat || isPCM) ? 1 + (isFloat ? 1 : 0) + (isWithinLimit ? 2 : 0) : 0;
+
+                        if (score > bestScore)
+                        {
+                            SafeRelease (&outputType);
+                            outputType = type;
+                            bestScore = score;
+                        }
+                        else
+                        {
+                            SafeRelease (&type);
+                        }
+                    }
+                }
+
+                hr = (outputType != nullptr) ? S_OK : MF_E_INVALIDMEDIATYPE;
+
+                // Ask the decoder to downmix if it does not list such a type.
+                if (SUCCEEDED (hr) && bestScore < 3)
+                {
+                    IMFMediaType* downmixType = nullptr;
+
+                    if (SUCCEEDED (CreateDownmixType (outputType, &downmixType))
+                        && SUCCEEDED (transform->SetOutputType (0, downmixType, MFT_SET_TYPE_TEST_ONLY)))
+                    {
+                        SafeRelease (&outputType);
+                        outputType = downmixType;
+                    }
+                    else
+                    {
+                        SafeRelease (&downmixType);
+                    }
+                }
+
+                if (SUCCEEDED (hr)) hr = transform->SetOutputType (0, outputType, 0);
+
+                if (SUCCEEDED (hr))
+                {
+                    GUID subtype = GUID_NULL;
+                    hr = outputType->GetGUID (MF_MT_SUBTYPE, &subtype);
+                    outputIsFloat = (subtype == MFAudioFormat_Float);
+                }
+
+                if (SUCCEEDED (hr)) hr = outputType->GetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, &outputSampleRate);
+                if (SUCCEEDED (hr)) hr = outputType->GetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, &decodedNumChannels);
+
+                // Downmixed by CopyOutput() if the decoder does not.
+                if (SUCCEEDED (hr))
+                    outputNumChannels = (maxNumChannels > 0) ? juce::jmin (decodedNumChannels, maxNumChannels) : decodedNumChannels;
+
+                // After a stream change, the output keeps the format the caller sized its buffers for:
+                // a PS switch between mono and stereo is mixed by CopyOutput(), other changes are errors.
+                if (SUCCEEDED (hr) && streamNumChannels > 0)
+                {
+                    if (outputSampleRate != streamSampleRate)
+                        hr = MF_E_INVALIDMEDIATYPE;
+                    else if (outputNumChannels != streamNumChannels && (outputNumChannels > 2 || streamNumChannels > 2))
+                        hr = MF_E_INVALIDMEDIATYPE;
+                    else
+                        outputNumChannels = streamNumChannels;
+                }
+
+                // Allocate output sample unless the decoder provides its own.
+                if (SUCCEEDED (hr))
+                {
+                    MFT_OUTPUT_STREAM_INFO info = {};
+                    hr = transform->GetOutputStreamInfo (0, &info);
+
+                    providesSamples = SUCCEEDED (hr)
+                        && (info.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES | MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+
+                    SafeRelease (&outputBuffer);
+                    SafeRelease (&outputSample);
+
+                    if (SUCCEEDED (hr) && ! providesSamples)
+                    {
+                        // Room for one HE-AAC frame (2048 samples) at 32 bits per sample.
+                        const DWORD size = juce::jmax (info.cbSize, (DWORD) (2048 * 4 * decodedNumChannels));
+
+                        hr = ::MFCreateSample (&outputSample);
+                        if (SUCCEEDED (hr)) hr = ::MFCreateMemoryBuffer (size, &outputBuffer);
+                        if (SUCCEEDED (hr)) hr = outputSample->AddBuffer (outputBuffer);
+                    }
+                }
+
+                SafeRelease (&outputType);
+
+                return hr;
+            }
+
+            /** Creates a copy of an output type with the channel limit, for decoders that downmix on request.  */
+            HRESULT CreateDownmixType (IMFMediaType* type, IMFMediaType** downmixType)
+            {
+                UINT32 bits = 0, rate = 0;
+
+                HRESULT hr = ::MFCreateMediaType (downmixType);
+                if (SUCCEEDED (hr)) hr = type->CopyAllItems (*downmixType);
+                if (SUCCEEDED (hr)) hr = type->GetUINT32 (MF_MT_AUDIO_BITS_PER_SAMPLE, &bits);
+                if (SUCCEEDED (hr)) hr = type->GetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, &rate);
+
+                const UINT32 blockAlign = maxNumChannels * bits / 8;
+
+                if (SUCCEEDED (hr)) hr = (*downmixType)->SetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, maxNumChannels);
+                if (SUCCEEDED (hr)) hr = (*downmixType)->SetUINT32 (MF_MT_AUDIO_CHANNEL_MASK,
+                        (maxNumChannels == 1) ? SPEAKER_FRONT_CENTER : (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT));
+                if (SUCCEEDED (hr)) hr = (*downmixType)->SetUINT32 (MF_MT_AUDIO_BLOCK_ALIGNMENT, blockAlign);
+                if (SUCCEEDED (hr)) hr = (*downmixType)->SetUINT32 (MF_MT_AUDIO_AVG_BYTES_PER_SECOND, blockAlign * rate);
+
+                if (FAILED (hr))
+                    SafeRelease (downmixType);
+
+                return hr;
+            }
+
+            /** Mixes one decoded frame of samples down to the output channels.
+             *
+             * 5.1 (L R C LFE Ls Rs) uses the ITU-R BS.775 coefficients without the
+             * LFE, scaled so full scale input does not clip. Other layouts keep
+             * the first channels, mono averages them. Mono input to a stereo
+             * output, after a stream change, is copied to both channels.
+             */
+            void Downmix (const float* source, float* dest) const noexcept
+            {
+                constexpr float minus3dB = 0.70710678f;
+
+                float left = source[0];
+                float right = (decodedNumChannels > 1) ? source[1] : source[0];
+
+                if (decodedNumChannels == 6)
+                {
+                    constexpr float scale = 1.0f / (1.0f + 2.0f * minus3dB);
+
+                    left = (source[0] + minus3dB * (source[2] + source[4])) * scale;
+                    right = (source[1] + minus3dB * (source[2] + source[5])) * scale;
+                }
+
+                if (outputNumChannels == 1)
+                {
+                    dest[0] = 0.5f * (left + right);
+                }
+                else
+                {
+                    dest[0] = left;
+                    dest[1] = right;
+                }
+            }
+
+            HRESULT CopyOutput (IMFSample* sample, float* output, int maxNumSamples, int* numSamples)
+            {
+                IMFMediaBuffer* buffer = nullptr;
+                BYTE* data = nullptr;
+                DWORD dataSize = 0;
+
+                HRESULT hr = (sample != nullptr) ? sample->ConvertToContiguousBuffer (&buffer) : E_POINTER;
+
+                if (SUCCEEDED (hr)) hr = buffer->Lock (&data, nullptr, &dataSize);
+
+                if (SUCCEEDED (hr))
+                {
+                    const int bytesPerFrame = (int) decodedNumChannels * (outputIsFloat ? 4 : 2);
+                    const int available = juce::jmin ((int) dataSize / bytesPerFrame, maxNumSamples - *numSamples);
+                    float* dest = output + (size_t) *numSamples * outputNumChannels;
+
+                    if (decodedNumChannels != outputNumChannels)
+                    {
+                        float frame[8] = {};
+                        const int numFrameChannels = juce::jmin ((int) decodedNumChannels, 8);
+
+                        for (int i = 0; i < available; ++i)
+                        {
+                            for (int ch = 0; ch < numFrameChannels; ++ch)
+                            {
+                                const size_t n = (size_t) i * decodedNumChannels + (size_t) ch;
+
+                                frame[ch] = outputIsFloat ? reinterpret_cast<const float*> (data)[n]
+                                                          : (float) reinterpret_cast<const juce::int16*> (data)[n] * (1.0f / 32768.0f);
+                            }
+
+                            Downmix (frame, dest + (size_t) i * outputNumChannels);
+                        }
+                    }
+                    else if (outputIsFloat)
+                    {
+                        memcpy (dest, data, (size_t) available * (size_t) bytesPerFrame);
+                    }
+                    else
+                    {
+                        const juce::int16* src = reinterpret_cast<const juce::int16*> (data);
+
+                        for (int i = 0; i < available * (int) outputNumChannels; ++i)
+                            dest[i] = (float) src[i] * (1.0f / 32768.0f);
+                    }
+
+                    *numSamples += available;
+
+                    hr = buffer->Unlock();
+                }
+
+                SafeRelease (&buffer);
+
+                return hr;
+            }
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AACDecoder)
+        };
+    } // namespace WindowsMediaFoundation
+
+#endif // JUCE_WINDOWS
+} // namespace mole
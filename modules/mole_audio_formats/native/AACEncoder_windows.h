@@ -0,0 +1,295 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    namespace WindowsMediaFoundation {
+
+        using namespace mole::Windows;
+
+        //==========================================================================
+        /** Raw AAC access units in encoding order.  */
+        class AACAccessUnits final
+        {
+            std::vector<char> data;
+            std::vector<size_t> offsets;
+
+            public:
+
+            /** Appends an access unit.  */
+            void Add (const void* unit, size_t size)
+            {
+                offsets.push_back (data.size());
+                data.insert (data.end(), static_cast<const char*> (unit), static_cast<const char*> (unit) + size);
+            }
+
+            /** Removes all access units and frees their memory.  */
+            void Clear()
+            {
+                std::vector<char>().swap (data);
+                std::vector<size_t>().swap (offsets);
+            }
+
+            /** Returns the number of access units.  */
+            int GetNumUnits() const noexcept { return (int) offsets.size(); }
+
+            /** Returns the data of an access unit.  */
+            const void* GetData (int unit) const noexcept
+            {
+                return data.data() + offsets[(size_t) unit];
+            }
+
+            /** Returns the size of an access unit in bytes.  */
+            size_t GetSize (int unit) const noexcept
+            {
+                const size_t end = ((size_t) unit + 1 < offsets.size()) ? offsets[(size_t) unit + 1] : data.size();
+                return end - offsets[(size_t) unit];
+            }
+        };
+
+        //==========================================================================
+        /** Encodes 16-bit PCM to raw AAC access units with the Media Foundation AAC encoder.
+         *
+         * Each access unit holds 1024 samples per channel. The encoder delay is
+         * constant, so access unit n of an encoder that starts at a multiple of
+         * 1024 samples covers the same input as the one of a single encoder.
+         */
+        class AACEncoder final
+        {
+            IMFTransform* transform = nullptr;
+
+            IMFSample* inputSample = nullptr;
+            IMFMediaBuffer* inputBuffer = nullptr;
+            IMFSample* outputSample = nullptr;
+            IMFMediaBuffer* outputBuffer = nullptr;
+
+            bool providesSamples = false;
+            UINT32 sampleRate = 0;
+            UINT32 numChannels = 0;
+            juce::int64 numSamplesEncoded = 0;
+
+            //==========================================================================
+            public:
+
+            AACEncoder() = default;
+
+            ~AACEncoder()
+            {
+                SafeRelease (&outputBuffer);
+                SafeRelease (&outputSample);
+                SafeRelease (&inputBuffer);
+                SafeRelease (&inputSample);
+                SafeRelease (&transform);
+            }
+
+            /** Creates the encoder.
+             *
+             * @param rate Sample rate, 44100 or 48000 Hz.
+             * @param channels Number of channels, 1, 2 or 6.
+             * @param bytesPerSecond Bit rate in bytes per second.
+             * @param maxNumSamples Maximum number of samples per channel passed to Encode().
+             */
+            HRESULT Initialize (double rate, int channels, UINT32 bytesPerSecond, int maxNumSamples)
+            {
+                sampleRate = (UINT32) rate;
+                numChannels = (UINT32) channels;
+
+                HRESULT hr = CreateTransform();
+
+                // Output type first, the encoder derives the input types from it.
+                if (SUCCEEDED (hr))
+                {
+                    IMFMediaType* outputType = nullptr;
+
+                    hr = ::MFCreateMediaType (&outputType);
+                    if (SUCCEEDED (hr)) hr = outputType->SetGUID (MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+                    if (SUCCEEDED (hr)) hr = outputType->SetGUID (MF_MT_SUBTYPE, MFAudioFormat_AAC);
+                    if (SUCCEEDED (hr)) hr = outputType->SetUINT32 (MF_MT_AUDIO_BITS_PER_SAMPLE, 16);
+                    if (SUCCEEDED (hr)) hr = outputType->SetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, sampleRate);
+                    if (SUCCEEDED (hr)) hr = outputType->SetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, numChannels);
+                    if (SUCCEEDED (hr)) hr = outputType->SetUINT32 (MF_MT_AUDIO_AVG_BYTES_PER_SECOND, bytesPerSecond);
+                    if (SUCCEEDED (hr)) hr = outputType->SetUINT32 (MF_MT_AAC_PAYLOAD_TYPE, 0);
+                    if (SUCCEEDED (hr)) hr = transform->SetOutputType (0, outputType, 0);
+
+                    SafeRelease (&outputType);
+                }
+
+                if (SUCCEEDED (hr))
+                {
+                    IMFMediaType* inputType = nullptr;
+
+                    hr = ::MFCreateMediaType (&inputType);
+                    if (SUCCEEDED (hr)) hr = inputType->SetGUID (MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+                    if (SUCCEEDED (hr)) hr = inputType->SetGUID (MF_MT_SUBTYPE, MFAudioFormat_PCM);
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AUDIO_BITS_PER_SAMPLE, 16);
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AUDIO_SAMPLES_PER_SECOND, sampleRate);
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AUDIO_NUM_CHANNELS, numChannels);
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AUDIO_BLOCK_ALIGNMENT, 2 * numChannels);
+                    if (SUCCEEDED (hr)) hr = inputType->SetUINT32 (MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 2 * numChannels * sampleRate);
+                    if (SUCCEEDED (hr)) hr = transform->SetInputType (0, inputType, 0);
+
+                    SafeRelease (&inputType);
+                }
+
+                // Preallocated input sample.
+                if (SUCCEEDED (hr)) hr = ::MFCreateSample (&inputSample);
+                if (SUCCEEDED (hr)) hr = ::MFCreateMemoryBuffer ((DWORD) juce::jmax (1, maxNumSamples) * 2 * numChannels, &inputBuffer);
+                if (SUCCEEDED (hr)) hr = inputSample->AddBuffer (inputBuffer);
+
+                // Allocate output sample unless the encoder provides its own.
+                if (SUCCEEDED (hr))
+                {
+                    MFT_OUTPUT_STREAM_INFO info = {};
+                    hr = transform->GetOutputStreamInfo (0, &info);
+
+                    providesSamples = SUCCEEDED (hr)
+                        && (info.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES | MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+
+                    if (SUCCEEDED (hr) && ! providesSamples)
+                    {
+                        // Room for the largest access unit (6144 bits per channel).
+                        const DWORD size = juce::jmax (info.cbSize, (DWORD) (768 * numChannels));
+
+                        hr = ::MFCreateSample (&outputSample);
+                        if (SUCCEEDED (hr)) hr = ::MFCreateMemoryBuffer (size, &outputBuffer);
+                        if (SUCCEEDED (hr)) hr = outputSample->AddBuffer (outputBuffer);
+                    }
+                }
+
+                if (SUCCEEDED (hr)) hr = transform->ProcessMessage (MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0);
+                if (SUCCEEDED (hr)) hr = transform->ProcessMessage (MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+
+                return hr;
+            }
+
+            /** Returns the output media type, with the audio specific config in MF_MT_USER_DATA.  */
+            HRESULT GetOutputType (IMFMediaType** type)
+            {
+                return transform->GetOutputCurrentType (0, type);
+            }
+
+            /** Encodes interleaved samples, appends finished access units to the output.  */
+            HRESULT Encode (const juce::int16* samples, int numSamples, AACAccessUnits& output)
+            {
+                const DWORD size = (DWORD) numSamples * 2 * numChannels;
+
+                BYTE* inputData = nullptr;
+                DWORD maxLength = 0;
+
+                HRESULT hr = inputBuffer->Lock (&inputData, &maxLength, nullptr);
+
+                if (SUCCEEDED (hr))
+                {
+                    if (size <= maxLength)
+                        memcpy (inputData, samples, size);
+                    else
+                        hr = E_INVALIDARG;
+
+                    inputBuffer->Unlock();
+                }
+
+                const LONGLONG sampleTime = GetTime (numSamplesEncoded);
+
+                if (SUCCEEDED (hr)) hr = inputBuffer->SetCurrentLength (size);
+                if (SUCCEEDED (hr)) hr = inputSample->SetSampleTime (sampleTime);
+                if (SUCCEEDED (hr)) hr = inputSample->SetSampleDuration (GetTime (numSamplesEncoded + numSamples) - sampleTime);
+                if (SUCCEEDED (hr)) hr = transform->ProcessInput (0, inputSample, 0);
+                if (SUCCEEDED (hr)) numSamplesEncoded += numSamples;
+                if (SUCCEEDED (hr)) hr = ProcessOutput (output);
+
+                return hr;
+            }
+
+            /** Encodes the samples still held by the encoder, call it after the last Encode().  */
+            HRESULT Drain (AACAccessUnits& output)
+            {
+                HRESULT hr = transform->ProcessMessage (MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0);
+                if (SUCCEEDED (hr)) hr = transform->ProcessMessage (MFT_MESSAGE_COMMAND_DRAIN, 0);
+                if (SUCCEEDED (hr)) hr = ProcessOutput (output);
+
+                return hr;
+            }
+
+            //==========================================================================
+            private:
+
+            HRESULT CreateTransform()
+            {
+                MFT_REGISTER_TYPE_INFO inputInfo = { MFMediaType_Audio, MFAudioFormat_PCM };
+                MFT_REGISTER_TYPE_INFO outputInfo = { MFMediaType_Audio, MFAudioFormat_AAC };
+                IMFActivate** activates = nullptr;
+                UINT32 count = 0;
+
+                HRESULT hr = ::MFTEnumEx (MFT_CATEGORY_AUDIO_ENCODER,
+                        MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+                        &inputInfo, &outputInfo, &activates, &count);
+
+                if (SUCCEEDED (hr) && count == 0) hr = MF_E_TOPO_CODEC_NOT_FOUND;
+                if (SUCCEEDED (hr)) hr = activates[0]->ActivateObject (IID_PPV_ARGS (&transform));
+
+                for (UINT32 i = 0; i < count; ++i)
+                    SafeRelease (&activates[i]);
+
+                ::CoTaskMemFree (activates);
+
+                return hr;
+            }
+
+            HRESULT ProcessOutput (AACAccessUnits& output)
+            {
+                HRESULT hr = S_OK;
+
+                while (SUCCEEDED (hr))
+                {
+                    MFT_OUTPUT_DATA_BUFFER outputData = { 0, providesSamples ? nullptr : outputSample, 0, nullptr };
+                    DWORD status = 0;
+
+                    if (outputBuffer != nullptr)
+                        outputBuffer->SetCurrentLength (0);
+
+                    hr = transform->ProcessOutput (0, 1, &outputData, &status);
+
+                    SafeRelease (&outputData.pEvents);
+
+                    if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+                        return S_OK;
+
+                    IMFMediaBuffer* buffer = nullptr;
+                    BYTE* data = nullptr;
+                    DWORD dataSize = 0;
+
+                    if (SUCCEEDED (hr)) hr = (outputData.pSample != nullptr) ? outputData.pSample->ConvertToContiguousBuffer (&buffer) : E_POINTER;
+                    if (SUCCEEDED (hr)) hr = buffer->Lock (&data, nullptr, &dataSize);
+
+                    if (SUCCEEDED (hr))
+                    {
+                        output.Add (data, (size_t) dataSize);
+                        hr = buffer->Unlock();
+                    }
+
+                    SafeRelease (&buffer);
+
+                    if (providesSamples)
+                        SafeRelease (&outputData.pSample);
+                }
+
+                return hr;
+            }
+
+            /** Returns the presentation time of a sample in 100 ns time units.  */
+            LONGLONG GetTime (juce::int64 sampleNumber) const noexcept
+            {
+                return (LONGLONG) (sampleNumber * 10000000 / (juce::int64) sampleRate);
+            }
+
+            JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AACEncoder)
+        };
+    } // namespace WindowsMediaFoundation
+
+#endif // JUCE_WINDOWS
+} // namespace mole
@@ -0,0 +1,219 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+namespace mole {
+
+#if JUCE_WINDOWS || DOXYGEN
+
+    namespace WindowsMediaFoundation {
+
+        using namespace mole::Windows;
+
+        //==========================================================================
+        /** Pool of media samples with one memory buffer each.
+         *
+         * The samples are tracked samples: when the consumer (e.g. a sink writer)
+         * releases the last reference, Media Foundation calls Invoke() and the
+         * sample goes back to the pool instead of being destroyed. Once the pool
+         * holds as many samples as are in flight, getting a sample allocates
+         * nothing.
+         */
+        class SamplePool final : public IMFAsyncCallback
+        {
+            std::vector<IMFSample*> freeSamples;
+            DWORD bufferSize = 0;
+            size_t numSamples = 0;
+            bool isShutdown = false;
+
+            LONG refCount = 1;
+
+            juce::CriticalSection criticalSection;
+
+            //==========================================================================
+            public:
+
+            SamplePool() = delete;
+
+            /** Creates a pool.
+             *
+             * @param sampleBufferSize Size of the buffer of each sample in bytes.
+             * @param initialNumSamples Samples created up front, the pool grows if more are in flight.
+             */
+            SamplePool (DWORD sampleBufferSize, int initialNumSamples)
+                : bufferSize (sampleBufferSize)
+            {
+                for (int i = 0; i < initialNumSamples; ++i)
+                {
+                    IMFSample* sample = nullptr;
+
+                    if (SUCCEEDED (CreateSample (&sample)))
+                        freeSamples.push_back (sample);
+                }
+            }
+
+            //==========================================================================
+            /** Returns a sample with an empty buffer, call Release() when done with it.  */
+            HRESULT GetSample (IMFSample** sample)
+            {
+                if (sample == nullptr) return E_POINTER;
+
+                IMFSample* pooled = nullptr;
+
+                {
+                    const juce::ScopedLock lock (criticalSection);
+
+                    if (! freeSamples.empty())
+                    {
+                        pooled = freeSamples.back();
+                        freeSamples.pop_back();
+                    }
+                }
+
+                // The consumer holds more samples than before, grow the pool.
+                HRESULT hr = (pooled != nullptr) ? S_OK : CreateSample (&pooled);
+
+                IMFTrackedSample* tracked = nullptr;
+                IMFMediaBuffer* buffer = nullptr;
+
+                // The allocator is called once, set it again each time.
+                if (SUCCEEDED (hr)) hr = pooled->QueryInterface (IID_PPV_ARGS (&tracked));
+                if (SUCCEEDED (hr)) hr = tracked->SetAllocator (this, nullptr);
+                if (SUCCEEDED (hr)) hr = pooled->GetBufferByIndex (0, &buffer);
+                if (SUCCEEDED (hr)) hr = buffer->SetCurrentLength (0);
+
+                SafeRelease (&buffer);
+                SafeRelease (&tracked);
+
+                if (SUCCEEDED (hr))
+                    *sample = pooled;
+                else
+                    SafeRelease (&pooled);
+
+                return hr;
+            }
+
+            /** Releases the free samples, samples in flight are destroyed when they come back.  */
+            void Shutdown()
+            {
+                const juce::ScopedLock lock (criticalSection);
+
+                isShutdown = true;
+
+                for (auto*& sample : freeSamples)
+                    SafeRelease (&sample);
+
+                freeSamples.clear();
+            }
+
+            //==========================================================================
+            /// @name IUnknown interface
+            /// @{
+
+            /** Increments the reference count for an interface pointer to a COM object.  */
+            STDMETHODIMP_(ULONG) AddRef() override
+            {
+                return (ULONG) ::InterlockedIncrement (&refCount);
+            }
+
+            /** Retrieves pointers to the supported interfaces on an object.  */
+            STDMETHODIMP QueryInterface (REFIID iid, void** ptr) override
+            {
+                if (ptr == nullptr) { return E_POINTER; }
+
+                if (iid == IID_IUnknown) { *ptr = static_cast<IUnknown*> (this); }
+                else if (iid == IID_IMFAsyncCallback) { *ptr = static_cast<IMFAsyncCallback*> (this); }
+                else { *ptr = nullptr; return E_NOINTERFACE; }
+
+                AddRef();
+                return S_OK;
+            }
+
+            /** Decrements the reference count for an interface on a COM object.  */
+            STDMETHODIMP_(ULONG) Release() override
+            {
+                LONG count = ::InterlockedDecrement (&refCount);
+                if (count == 0)
+                {
+                    delete this;
+                }
+                return (ULONG) count;
+            }
+            /// @}
+
+            //==========================================================================
+            /// @name IMFAsyncCallback interface
+            /// @{
+
+            /** Default dispatching parameters.  */
+            STDMETHODIMP GetParameters (DWORD*, DWORD*) override
+            {
+                return E_NOTIMPL;
+            }
+
+            /** Called when the last reference to a sample of the pool is released.  */
+            STDMETHODIMP Invoke (IMFAsyncResult* result) override
+            {
+                IUnknown* object = nullptr;
+                IMFSample* sample = nullptr;
+
+                HRESULT hr = result->GetObject (&object);
+                if (SUCCEEDED (hr)) hr = object->QueryInterface (IID_PPV_ARGS (&sample));
+
+                SafeRelease (&object);
+
+                if (SUCCEEDED (hr))
+                {
+                    const juce::ScopedLock lock (criticalSection);
+
+                    // Capacity is reserved for all samples of the pool.
+                    if (! isShutdown)
+                        freeSamples.push_back (sample);
+                    else
+                        SafeRelease (&sample);
+                }
+
+                return hr;
+            }
+            /// @}
+
+            //==========================================================================
+            private:
+
+            ~SamplePool()
+            {
+                Shutdown();
+            }
+
+            HRESULT CreateSample (IMFSample** sample)
+            {
+                IMFTrackedSample* tracked = nullptr;
+                IMFMediaBuffer* buffer = nullptr;
+
+                HRESULT hr = ::MFCreateTrackedSample (&tracked);
+                if (SUCCEEDED (hr)) hr = tracked->QueryInterface (IID_PPV_ARGS (sample));
+                if (SUCCEEDED (hr)) hr = ::MFCreateAlignedMemoryBuffer (bufferSize, MF_16_BYTE_ALIGNMENT, &buffer);
+                if (SUCCEEDED (hr)) hr = (*sample)->AddBuffer (buffer);
+
+                if (SUCCEEDED (hr))
+                {
+                    const juce::ScopedLock lock (criticalSection);
+                    freeSamples.reserve (++numSamples);
+                }
+                else if (*sample != nullptr)
+                {
+                    SafeRelease (sample);
+                }
+
+                SafeRelease (&buffer);
+                SafeRelease (&tracked);
+
+                return hr;
+            }
+        };
+    } // namespace WindowsMediaFoundation
+
+#endif // JUCE_WINDOWS
+} // namespace mole
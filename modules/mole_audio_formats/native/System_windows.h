@@ -93,22 +93,26 @@ namespace mole {
                 return InitializeSTA();
             }
 
-            /** Initialize with 'apartmentthreaded' and 'disable ole1dde'.  */
+            /** Initialize with 'apartmentthreaded' and 'disable ole1dde'.
+             *  Succeeds without changing the apartment on threads in the multithreaded apartment.
+             */
             HRESULT InitializeSTA()
             {
                 if (hr == E_HANDLE)
                     hr = ::CoInitializeEx (nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
 
-                return hr;
+                return (hr == RPC_E_CHANGED_MODE) ? S_FALSE : hr;
             }
 
-            /** Initialize with 'multithreaded' and 'disable ole1dde'.  */
+            /** Initialize with 'multithreaded' and 'disable ole1dde'.
+             *  Succeeds without changing the apartment on threads in a single-threaded apartment.
+             */
             HRESULT InitializeMTA()
             {
                 if (hr == E_HANDLE)
                     hr = ::CoInitializeEx (nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
 
-                return hr;
+                return (hr == RPC_E_CHANGED_MODE) ? S_FALSE : hr;
             }
         };
 